@@ -14,15 +14,15 @@
 
 #include "pool/sql_conn_pool.h"
 
-#include <mysql/mysql.h>
+#include "assert.h"
 
 typedef class SqlConnRAII {
 public:
-    SqlConnRAII(SqlConnPool* conn_pool) {
+    // 等待超时取不到连接时_mysql为空，调用方需先判断
+    SqlConnRAII(SqlConnPool* conn_pool, int timeout_ms = 1000) {
         assert(conn_pool);
         _conn_pool = conn_pool;
-        _mysql = _conn_pool->getConn();
-        assert(_mysql);
+        _mysql = _conn_pool->getConn(timeout_ms);
     }
 
     ~SqlConnRAII() {
@@ -31,16 +31,20 @@ public:
         }
     }
 
-    MYSQL* operator->() {
+    explicit operator bool() const {
+        return _mysql != nullptr;
+    }
+
+    MysqlConn* operator->() {
         return _mysql;
     }
 
     MYSQL* operator&() {
-        return _mysql;
+        return _mysql->get();
     }
     
 private:
-    MYSQL* _mysql;
+    MysqlConn* _mysql;
     // why pointer?
     SqlConnPool* _conn_pool;
 } SqlConn;
@@ -0,0 +1,53 @@
+/**
+ * @file sql_route_RAII.hpp
+ * @author weilai
+ * @brief 按读写路由从SqlRouter获取连接，析构时归还并上报本次请求是否成功
+ * @version 0.1
+ * @date 2023-08-28
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef SQL_ROUTE_RAII_HPP
+#define SQL_ROUTE_RAII_HPP
+
+#include "pool/sql_router.h"
+
+typedef class SqlRouteRAII {
+public:
+    // 取不到连接时为空，调用方需先判断
+    explicit SqlRouteRAII(SqlRouter::ROUTE route, int timeout_ms = 1000): _ok(true) {
+        _mysql = SqlRouter::instance().acquire(route, timeout_ms, &_endpoint);
+    }
+
+    ~SqlRouteRAII() {
+        if (_mysql != nullptr) {
+            SqlRouter::instance().release(_endpoint, _mysql, _ok);
+        }
+    }
+
+    explicit operator bool() const {
+        return _mysql != nullptr;
+    }
+
+    MysqlConn* operator->() {
+        return _mysql;
+    }
+
+    // 查询因数据库故障失败时调用，副本据此决定是否摘除
+    void fail() {
+        _ok = false;
+    }
+
+    bool fromReplica() const {
+        return _endpoint != SqlRouter::PRIMARY;
+    }
+
+private:
+    MysqlConn* _mysql;
+    int _endpoint;
+    bool _ok;
+} SqlRoute;
+
+#endif // SQL_ROUTE_RAII_HPP
@@ -0,0 +1,105 @@
+/**
+ * @file auth_cache.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "auth_cache.h"
+
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AuthCache& AuthCache::instance() {
+    static AuthCache cache;
+    return cache;
+}
+
+void AuthCache::init(size_t capacity, int ttl_ms) {
+    _shard_capacity = capacity / SHARD_NUM + 1;
+    _ttl_ms = ttl_ms;
+}
+
+bool AuthCache::verify(const std::string& username, const std::string& password) {
+    Shard& shard = _shard(username);
+    std::lock_guard<std::mutex> locker(shard.m);
+    auto it = shard.map.find(username);
+    if (it == shard.map.end()) {
+        return false;
+    }
+    Entry& e = *it->second;
+    if (e.expire_ms <= nowMs()) {
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+        return false;
+    }
+    if (e.digest != _digest(e.salt, password)) {
+        return false;
+    }
+    // 命中移到表头
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return true;
+}
+
+void AuthCache::put(const std::string& username, const std::string& password) {
+    if (_shard_capacity == 0) {
+        return;
+    }
+    uint64_t salt;
+    crypto::randomBytes(&salt, sizeof salt);
+    uint64_t digest = _digest(salt, password);
+    int64_t expire = nowMs() + _ttl_ms;
+
+    Shard& shard = _shard(username);
+    std::lock_guard<std::mutex> locker(shard.m);
+    auto it = shard.map.find(username);
+    if (it != shard.map.end()) {
+        Entry& e = *it->second;
+        e.salt = salt;
+        e.digest = digest;
+        e.expire_ms = expire;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    if (shard.map.size() >= _shard_capacity) {
+        shard.map.erase(shard.lru.back().username);
+        shard.lru.pop_back();
+    }
+    shard.lru.push_front(Entry{username, salt, digest, expire});
+    shard.map[username] = shard.lru.begin();
+}
+
+void AuthCache::invalidate(const std::string& username) {
+    Shard& shard = _shard(username);
+    std::lock_guard<std::mutex> locker(shard.m);
+    auto it = shard.map.find(username);
+    if (it != shard.map.end()) {
+        shard.lru.erase(it->second);
+        shard.map.erase(it);
+    }
+}
+
+// private methods
+AuthCache::AuthCache(): _key(crypto::randomKey()), _shard_capacity(0), _ttl_ms(0) {}
+
+AuthCache::Shard& AuthCache::_shard(const std::string& username) {
+    // 分片用带密钥的哈希，外部无法构造集中到同一分片的用户名
+    return _shards[crypto::sipHash(_key, username.data(), username.size()) % SHARD_NUM];
+}
+
+uint64_t AuthCache::_digest(uint64_t salt, const std::string& password) const {
+    std::vector<char> buf(sizeof salt + password.size());
+    memcpy(buf.data(), &salt, sizeof salt);
+    memcpy(buf.data() + sizeof salt, password.data(), password.size());
+    return crypto::sipHash(_key, buf.data(), buf.size());
+}
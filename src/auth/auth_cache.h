@@ -0,0 +1,78 @@
+/**
+ * @file auth_cache.h
+ * @author weilai
+ * @brief 登录结果缓存：用户名 -> 加盐的密码摘要
+ *        同一用户短时间内重复登录不再访问MySQL，数据库压力与独立用户数相关而不是请求数。
+ *        缓存中不保存明文，摘要为SipHash(进程密钥, 随机盐 + 密码)。
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef AUTH_CACHE_H
+#define AUTH_CACHE_H
+
+#include "crypto.h"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class AuthCache {
+public:
+    static AuthCache& instance();
+
+    /**
+     * @brief
+     *
+     * @param capacity 总条目上限，平均分到各分片，满了淘汰最久未用的
+     * @param ttl_ms 条目有效期，过期后必须重新查库
+     */
+    void init(size_t capacity = 65536, int ttl_ms = 300000);
+
+    // 缓存命中且密码一致返回true；未命中、过期或不一致都返回false，由调用方查库
+    bool verify(const std::string& username, const std::string& password);
+
+    // 查库验证通过后写入
+    void put(const std::string& username, const std::string& password);
+
+    // 注册等会改变用户数据的操作之后调用
+    void invalidate(const std::string& username);
+
+private:
+    AuthCache();
+    ~AuthCache() = default;
+
+    AuthCache(const AuthCache&) = delete;
+    AuthCache& operator=(const AuthCache&) = delete;
+
+    static const int SHARD_NUM = 16;
+
+    struct Entry {
+        std::string username;
+        uint64_t salt;
+        uint64_t digest;
+        int64_t expire_ms;
+    };
+
+    // 每个分片一把锁，分片内按LRU组织
+    struct Shard {
+        std::mutex m;
+        std::list<Entry> lru;
+        std::unordered_map<std::string, std::list<Entry>::iterator> map;
+    };
+
+    Shard& _shard(const std::string& username);
+    uint64_t _digest(uint64_t salt, const std::string& password) const;
+
+    crypto::SipKey _key;
+    size_t _shard_capacity;
+    int64_t _ttl_ms;
+    Shard _shards[SHARD_NUM];
+};
+
+#endif // AUTH_CACHE_H
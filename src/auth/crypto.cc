@@ -0,0 +1,106 @@
+/**
+ * @file crypto.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "crypto.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "assert.h"
+#include "sys/syscall.h"
+#include "unistd.h"
+
+namespace crypto {
+
+static inline uint64_t rotl(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND                                    \
+    do {                                            \
+        v0 += v1; v1 = rotl(v1, 13); v1 ^= v0;      \
+        v0 = rotl(v0, 32);                          \
+        v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;      \
+        v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;      \
+        v2 += v1; v1 = rotl(v1, 17); v1 ^= v2;      \
+        v2 = rotl(v2, 32);                          \
+    } while (0)
+
+uint64_t sipHash(const SipKey& key, const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key.k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key.k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key.k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ key.k1;
+
+    const unsigned char* end = p + (len & ~static_cast<size_t>(7));
+    for (; p != end; p += 8) {
+        // 按小端读取8字节
+        uint64_t m = 0;
+        for (int i = 7; i >= 0; --i) {
+            m = (m << 8) | p[i];
+        }
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    for (int i = static_cast<int>(len & 7) - 1; i >= 0; --i) {
+        b |= static_cast<uint64_t>(p[i]) << (8 * i);
+    }
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+
+void randomBytes(void* buf, size_t len) {
+    char* p = static_cast<char*>(buf);
+    size_t got = 0;
+#ifdef SYS_getrandom
+    while (got < len) {
+        long n = syscall(SYS_getrandom, p + got, len - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        got += static_cast<size_t>(n);
+    }
+#endif
+    if (got < len) {
+        FILE* fp = fopen("/dev/urandom", "rb");
+        assert(fp != nullptr);
+        got += fread(p + got, 1, len - got, fp);
+        fclose(fp);
+    }
+    assert(got == len);
+}
+
+SipKey randomKey() {
+    SipKey key;
+    randomBytes(&key, sizeof key);
+    return key;
+}
+
+} // namespace crypto
@@ -0,0 +1,38 @@
+/**
+ * @file crypto.h
+ * @author weilai
+ * @brief 认证相关的基础工具：SipHash-2-4带密钥哈希，内核随机数
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef AUTH_CRYPTO_H
+#define AUTH_CRYPTO_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace crypto {
+
+// 128位密钥
+struct SipKey {
+    uint64_t k0;
+    uint64_t k1;
+};
+
+/**
+ * @brief SipHash-2-4，密钥未知时无法构造碰撞，可抵御针对哈希表的洪泛攻击
+ */
+uint64_t sipHash(const SipKey& key, const void* data, size_t len);
+
+// 从内核取随机数（getrandom，失败时读/dev/urandom），可用于密钥和会话令牌
+void randomBytes(void* buf, size_t len);
+
+SipKey randomKey();
+
+} // namespace crypto
+
+#endif // AUTH_CRYPTO_H
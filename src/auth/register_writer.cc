@@ -0,0 +1,216 @@
+/**
+ * @file register_writer.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-27
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "register_writer.h"
+#include "log/log.h"
+#include "metrics/alloc_stats.h"
+#include "RAIIs/sql_conn_RAII.hpp"
+
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+RegisterWriter& RegisterWriter::instance() {
+    static RegisterWriter writer;
+    return writer;
+}
+
+void RegisterWriter::init(SqlConnPool* pool, int max_batch, int max_wait_ms) {
+    assert(pool != nullptr and max_batch > 0 and max_wait_ms >= 0);
+    assert(!_writer.joinable());
+    _pool = pool;
+    _max_batch = static_cast<size_t>(max_batch);
+    _max_wait_ms = max_wait_ms;
+    _closed = false;
+    _writer = std::thread(&RegisterWriter::_loop, this);
+}
+
+RegisterWriter::RESULT RegisterWriter::submit(const std::string& username, const std::string& password,
+                                                int64_t* latency_ms) {
+    std::future<RESULT> result;
+    {
+        std::lock_guard<std::mutex> locker(_mtx);
+        if (_closed) {
+            return FAILED;
+        }
+        _queue.push_back(Pending{username, password, latency_ms, std::promise<RESULT>()});
+        result = _queue.back().done.get_future();
+    }
+    _cond.notify_one();
+    return result.get();
+}
+
+void RegisterWriter::close() {
+    {
+        std::lock_guard<std::mutex> locker(_mtx);
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+    }
+    _cond.notify_one();
+    if (_writer.joinable()) {
+        _writer.join();
+    }
+    std::lock_guard<std::mutex> locker(_mtx);
+    for (auto& p : _queue) {
+        p.done.set_value(FAILED);
+    }
+    _queue.clear();
+}
+
+// private methods
+RegisterWriter::RegisterWriter(): _pool(nullptr), _max_batch(64), _max_wait_ms(2), _closed(true) {}
+
+RegisterWriter::~RegisterWriter() {
+    close();
+}
+
+void RegisterWriter::_loop() {
+    // 写线程只做批量插入，整个线程记为SQL阶段
+    AllocScope scope(AllocStats::SQL);
+    std::vector<Pending> batch;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> locker(_mtx);
+            _cond.wait(locker, [this] { return _closed or !_queue.empty(); });
+            if (_closed) {
+                break;
+            }
+            // 从队首请求到达算起最多等max_wait_ms，凑满一批立即提交
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_max_wait_ms);
+            _cond.wait_until(locker, deadline, [this] { return _closed or _queue.size() >= _max_batch; });
+            while (!_queue.empty() and batch.size() < _max_batch) {
+                batch.push_back(std::move(_queue.front()));
+                _queue.pop_front();
+            }
+        }
+        _flush(batch);
+        batch.clear();
+    }
+}
+
+void RegisterWriter::_flush(std::vector<Pending>& batch) {
+    std::vector<RESULT> results(batch.size(), FAILED);
+    SqlConn sql(_pool);
+    // 从拿到连接开始计时，等连接的时间不算在查询耗时里
+    auto start = std::chrono::steady_clock::now();
+    if (!sql) {
+        LOG_ERROR("RegisterWriter: no SqlConn for %d rows", static_cast<int>(batch.size()))
+    } else {
+        // 同一批里重名时只有第一个参与写入，其余直接判重复
+        std::unordered_map<std::string, size_t> first;
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (first.emplace(batch[i].username, i).second) {
+                rows.push_back(i);
+            } else {
+                results[i] = DUPLICATE;
+            }
+        }
+        if (!_commitBatch(sql.operator->(), batch, rows, results)) {
+            LOG_WARN("RegisterWriter: batch of %d rows failed, insert one by one", static_cast<int>(rows.size()))
+            _insertEach(sql.operator->(), batch, rows, results);
+        }
+    }
+    int64_t latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+    for (size_t i = 0; i < batch.size(); ++i) {
+        // 提交方阻塞在future上，set_value之前写入的耗时对它可见
+        if (batch[i].latency_ms != nullptr) {
+            *batch[i].latency_ms = latency;
+        }
+        batch[i].done.set_value(results[i]);
+    }
+}
+
+bool RegisterWriter::_commitBatch(MysqlConn* conn, std::vector<Pending>& batch,
+                                    const std::vector<size_t>& rows, std::vector<RESULT>& results) {
+    if (!conn->begin()) {
+        return false;
+    }
+    // 先锁住批内已存在的用户名，剩下的才进INSERT，避免一条重复拖垮整批
+    std::string select_sql = "SELECT username FROM user WHERE username IN (?";
+    std::vector<std::string> names;
+    names.reserve(rows.size());
+    for (size_t i : rows) {
+        names.push_back(batch[i].username);
+    }
+    for (size_t i = 1; i < rows.size(); ++i) {
+        select_sql += ", ?";
+    }
+    select_sql += ") FOR UPDATE";
+    std::unordered_set<std::string> exists;
+    long n = conn->executeSql(select_sql, names, [&exists](const std::vector<std::string>& row) {
+        exists.insert(row[0]);
+        return true;
+    });
+    if (n < 0) {
+        conn->rollback();
+        return false;
+    }
+
+    std::string insert_sql = "INSERT INTO user(username, password) VALUES ";
+    std::vector<std::string> params;
+    std::vector<size_t> inserted;
+    for (size_t i : rows) {
+        if (exists.count(batch[i].username) > 0) {
+            continue;
+        }
+        insert_sql += inserted.empty() ? "(?, ?)" : ", (?, ?)";
+        params.push_back(batch[i].username);
+        params.push_back(batch[i].password);
+        inserted.push_back(i);
+    }
+    if (!inserted.empty() and conn->executeSql(insert_sql, params) < 0) {
+        conn->rollback();
+        return false;
+    }
+    if (!conn->commit()) {
+        // 提交结果未知，不能再逐行重试，否则本批写入的行会被误判为重复
+        LOG_ERROR("RegisterWriter: commit failed, errno %u", conn->getErrno())
+        for (size_t i : inserted) {
+            results[i] = UNKNOWN;
+        }
+        return true;
+    }
+    for (size_t i : rows) {
+        results[i] = DUPLICATE;
+    }
+    for (size_t i : inserted) {
+        results[i] = OK;
+    }
+    LOG_DEBUG("RegisterWriter: committed %d rows, %d duplicates",
+                static_cast<int>(inserted.size()), static_cast<int>(rows.size() - inserted.size()))
+    return true;
+}
+
+void RegisterWriter::_insertEach(MysqlConn* conn, std::vector<Pending>& batch,
+                                    const std::vector<size_t>& rows, std::vector<RESULT>& results) {
+    for (size_t i : rows) {
+        if (conn->execute(MysqlConn::STMT_REGISTER, {batch[i].username, batch[i].password}) >= 0) {
+            results[i] = OK;
+        } else {
+            unsigned int err = conn->getErrno();
+            if (err == ER_DUP_ENTRY) {
+                results[i] = DUPLICATE;
+            } else if (err == CR_SERVER_GONE_ERROR or err == CR_SERVER_LOST) {
+                // 自动提交的INSERT可能在断线前已经生效
+                results[i] = UNKNOWN;
+            } else {
+                results[i] = FAILED;
+            }
+        }
+    }
+}
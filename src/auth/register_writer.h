@@ -0,0 +1,89 @@
+/**
+ * @file register_writer.h
+ * @author weilai
+ * @brief 注册请求的组提交
+ *        并发的注册先进入队列，写线程攒够max_batch条或等满max_wait_ms后，
+ *        在一个事务里用一条多行INSERT写入，提交一次落盘一次，吞吐随批量增长而不是受限于提交延迟。
+ *        每个请求仍然拿到自己的结果：成功、用户名已存在或失败。
+ * @version 0.1
+ * @date 2023-08-27
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef REGISTER_WRITER_H
+#define REGISTER_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SqlConnPool;
+class MysqlConn;
+
+class RegisterWriter {
+public:
+    enum RESULT {
+        OK,
+        DUPLICATE,
+        FAILED,   // 确定没有写入
+        UNKNOWN,  // 提交或执行时连接出错，行可能已经落库
+    };
+
+    static RegisterWriter& instance();
+
+    /**
+     * @brief 启动写线程
+     *
+     * @param max_batch 单个事务最多写入的行数
+     * @param max_wait_ms 队首请求最多等待凑批的时间
+     */
+    void init(SqlConnPool* pool, int max_batch = 64, int max_wait_ms = 2);
+
+    // 阻塞直到所在批次提交完成；latency_ms非空时写回这一批在连接上执行的耗时，不含凑批和等连接
+    RESULT submit(const std::string& username, const std::string& password, int64_t* latency_ms = nullptr);
+
+    // 停止写线程，队列中未处理的请求返回FAILED
+    void close();
+
+private:
+    RegisterWriter();
+    ~RegisterWriter();
+
+    RegisterWriter(const RegisterWriter&) = delete;
+    RegisterWriter& operator=(const RegisterWriter&) = delete;
+
+    struct Pending {
+        std::string username;
+        std::string password;
+        int64_t* latency_ms;
+        std::promise<RESULT> done;
+    };
+
+    void _loop();
+    void _flush(std::vector<Pending>& batch);
+    // 整批在一个事务里写入，任何一步失败都回滚并返回false
+    bool _commitBatch(MysqlConn* conn, std::vector<Pending>& batch,
+                        const std::vector<size_t>& rows, std::vector<RESULT>& results);
+    // 批量失败后逐行插入，按各自的错误码区分重复和失败
+    void _insertEach(MysqlConn* conn, std::vector<Pending>& batch,
+                        const std::vector<size_t>& rows, std::vector<RESULT>& results);
+
+    SqlConnPool* _pool;
+    size_t _max_batch;
+    int _max_wait_ms;
+    bool _closed;
+
+    std::mutex _mtx;
+    std::condition_variable _cond;
+    std::deque<Pending> _queue;
+    std::thread _writer;
+};
+
+#endif // REGISTER_WRITER_H
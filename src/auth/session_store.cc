@@ -0,0 +1,262 @@
+/**
+ * @file session_store.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "session_store.h"
+#include "crypto.h"
+
+#include <chrono>
+#include <cstdio>
+
+#include "assert.h"
+
+static const size_t NPOS = static_cast<size_t>(-1);
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline bool isEmpty(uint64_t hi, uint64_t lo) {
+    return hi == 0 and lo == 0;
+}
+
+SessionStore& SessionStore::instance() {
+    static SessionStore store;
+    return store;
+}
+
+void SessionStore::init(int ttl_sec, size_t shard_capacity) {
+    _ttl_sec = static_cast<uint32_t>(ttl_sec);
+    // 容量取2的幂，用掩码代替取模
+    size_t cap = 16;
+    while (cap < shard_capacity) {
+        cap <<= 1;
+    }
+    _init_capacity = cap;
+}
+
+std::string SessionStore::create(const std::string& username) {
+    Entry e;
+    do {
+        crypto::randomBytes(&e.hi, sizeof e.hi);
+        crypto::randomBytes(&e.lo, sizeof e.lo);
+    } while (isEmpty(e.hi, e.lo));
+    e.expire = _now() + _ttl_sec;
+
+    Shard& shard = _shard(e.lo);
+    {
+        std::lock_guard<std::mutex> locker(shard.m);
+        e.user = _refUser(shard, username);
+        _insert(shard, e);
+    }
+    char buf[TOKEN_LEN + 1];
+    snprintf(buf, sizeof buf, "%016llx%016llx", (unsigned long long)e.hi, (unsigned long long)e.lo);
+    return std::string(buf, TOKEN_LEN);
+}
+
+bool SessionStore::lookup(const std::string& token, std::string* username) {
+    uint64_t hi, lo;
+    if (!_parseToken(token, &hi, &lo)) {
+        return false;
+    }
+    Shard& shard = _shard(lo);
+    std::lock_guard<std::mutex> locker(shard.m);
+    size_t i = _find(shard, hi, lo);
+    if (i == NPOS) {
+        return false;
+    }
+    if (shard.table[i].expire <= _now()) {
+        _unrefUser(shard, shard.table[i].user);
+        _erase(shard, i);
+        return false;
+    }
+    if (username != nullptr) {
+        *username = shard.users[shard.table[i].user].name;
+    }
+    return true;
+}
+
+void SessionStore::remove(const std::string& token) {
+    uint64_t hi, lo;
+    if (!_parseToken(token, &hi, &lo)) {
+        return;
+    }
+    Shard& shard = _shard(lo);
+    std::lock_guard<std::mutex> locker(shard.m);
+    size_t i = _find(shard, hi, lo);
+    if (i != NPOS) {
+        _unrefUser(shard, shard.table[i].user);
+        _erase(shard, i);
+    }
+}
+
+void SessionStore::sweep() {
+    Shard& shard = _shards[_sweep_next.fetch_add(1, std::memory_order_relaxed) % SHARD_NUM];
+    uint32_t now = _now();
+    std::lock_guard<std::mutex> locker(shard.m);
+    size_t i = 0;
+    while (i < shard.table.size()) {
+        const Entry& e = shard.table[i];
+        if (!isEmpty(e.hi, e.lo) and e.expire <= now) {
+            _unrefUser(shard, e.user);
+            // 删除会把后续元素前移到i，需要原地再检查一次
+            _erase(shard, i);
+            continue;
+        }
+        ++i;
+    }
+}
+
+size_t SessionStore::size() {
+    size_t n = 0;
+    for (auto& shard : _shards) {
+        std::lock_guard<std::mutex> locker(shard.m);
+        n += shard.count;
+    }
+    return n;
+}
+
+int SessionStore::getTtl() const {
+    return static_cast<int>(_ttl_sec);
+}
+
+// private methods
+SessionStore::SessionStore(): _ttl_sec(1800), _init_capacity(1024), _epoch_ms(nowMs()), _sweep_next(0) {}
+
+bool SessionStore::_parseToken(const std::string& token, uint64_t* hi, uint64_t* lo) {
+    if (token.size() != TOKEN_LEN) {
+        return false;
+    }
+    uint64_t v[2] = {0, 0};
+    for (size_t i = 0; i < TOKEN_LEN; ++i) {
+        char c = token[i];
+        uint64_t d;
+        if (c >= '0' and c <= '9') {
+            d = c - '0';
+        } else if (c >= 'a' and c <= 'f') {
+            d = c - 'a' + 10;
+        } else {
+            return false;
+        }
+        v[i / 16] = (v[i / 16] << 4) | d;
+    }
+    *hi = v[0];
+    *lo = v[1];
+    return !isEmpty(*hi, *lo);
+}
+
+uint32_t SessionStore::_now() const {
+    return static_cast<uint32_t>((nowMs() - _epoch_ms) / 1000);
+}
+
+SessionStore::Shard& SessionStore::_shard(uint64_t lo) {
+    // 令牌本身是随机数，低位选分片，hi选槽位
+    return _shards[lo % SHARD_NUM];
+}
+
+size_t SessionStore::_find(Shard& shard, uint64_t hi, uint64_t lo) {
+    if (shard.table.empty()) {
+        return NPOS;
+    }
+    size_t mask = shard.table.size() - 1;
+    for (size_t i = hi & mask; ; i = (i + 1) & mask) {
+        const Entry& e = shard.table[i];
+        if (isEmpty(e.hi, e.lo)) {
+            return NPOS;
+        }
+        if (e.hi == hi and e.lo == lo) {
+            return i;
+        }
+    }
+}
+
+void SessionStore::_insert(Shard& shard, const Entry& e) {
+    // 负载因子不超过3/4
+    if ((shard.count + 1) * 4 > shard.table.size() * 3) {
+        _grow(shard);
+    }
+    size_t mask = shard.table.size() - 1;
+    size_t i = e.hi & mask;
+    while (!isEmpty(shard.table[i].hi, shard.table[i].lo)) {
+        i = (i + 1) & mask;
+    }
+    shard.table[i] = e;
+    ++shard.count;
+}
+
+// 线性探测的后移删除，不留墓碑
+void SessionStore::_erase(Shard& shard, size_t i) {
+    size_t mask = shard.table.size() - 1;
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        const Entry& e = shard.table[j];
+        if (isEmpty(e.hi, e.lo)) {
+            break;
+        }
+        size_t home = e.hi & mask;
+        // home不在(i, j]区间内时，e可以前移到i
+        bool stay = i <= j ? (i < home and home <= j) : (i < home or home <= j);
+        if (!stay) {
+            shard.table[i] = e;
+            i = j;
+        }
+    }
+    shard.table[i] = Entry{0, 0, 0, 0};
+    --shard.count;
+}
+
+void SessionStore::_grow(Shard& shard) {
+    std::vector<Entry> old;
+    old.swap(shard.table);
+    shard.table.assign(old.empty() ? _init_capacity : old.size() * 2, Entry{0, 0, 0, 0});
+    shard.count = 0;
+    size_t mask = shard.table.size() - 1;
+    for (const Entry& e : old) {
+        if (isEmpty(e.hi, e.lo)) {
+            continue;
+        }
+        size_t i = e.hi & mask;
+        while (!isEmpty(shard.table[i].hi, shard.table[i].lo)) {
+            i = (i + 1) & mask;
+        }
+        shard.table[i] = e;
+        ++shard.count;
+    }
+}
+
+uint32_t SessionStore::_refUser(Shard& shard, const std::string& name) {
+    auto it = shard.user_index.find(name);
+    if (it != shard.user_index.end()) {
+        ++shard.users[it->second].refs;
+        return it->second;
+    }
+    uint32_t idx;
+    if (!shard.free_users.empty()) {
+        idx = shard.free_users.back();
+        shard.free_users.pop_back();
+        shard.users[idx] = User{name, 1};
+    } else {
+        idx = static_cast<uint32_t>(shard.users.size());
+        shard.users.push_back(User{name, 1});
+    }
+    shard.user_index[name] = idx;
+    return idx;
+}
+
+void SessionStore::_unrefUser(Shard& shard, uint32_t user) {
+    assert(user < shard.users.size() and shard.users[user].refs > 0);
+    if (--shard.users[user].refs == 0) {
+        shard.user_index.erase(shard.users[user].name);
+        shard.users[user].name.clear();
+        shard.free_users.push_back(user);
+    }
+}
@@ -0,0 +1,106 @@
+/**
+ * @file session_store.h
+ * @author weilai
+ * @brief 服务端会话：登录成功后签发128位随机令牌（Set-Cookie: sid=...），
+ *        之后带着有效令牌的请求直接放行，不再校验密码也不访问数据库。
+ *        面向百万级会话：分片的开放寻址表，每项24字节，用户名在分片内驻留共享。
+ *        过期项在查找时惰性剔除，另由Server的Timer周期性地逐个分片清理。
+ * @version 0.1
+ * @date 2023-08-26
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class SessionStore {
+public:
+    // 令牌编码为32个十六进制字符
+    static const size_t TOKEN_LEN = 32;
+
+    static SessionStore& instance();
+
+    /**
+     * @brief
+     *
+     * @param ttl_sec 会话有效期
+     * @param shard_capacity 每个分片的初始槽位数，按需翻倍
+     */
+    void init(int ttl_sec = 1800, size_t shard_capacity = 1024);
+
+    // 为用户签发新会话，返回令牌
+    std::string create(const std::string& username);
+
+    // 令牌有效时返回true并取出用户名
+    bool lookup(const std::string& token, std::string* username);
+
+    void remove(const std::string& token);
+
+    // 清理下一个分片中的过期会话，由定时器周期调用
+    void sweep();
+
+    size_t size();
+
+    int getTtl() const;
+
+private:
+    SessionStore();
+    ~SessionStore() = default;
+
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+
+    static const int SHARD_NUM = 64;
+
+    // hi和lo同时为0表示空槽
+    struct Entry {
+        uint64_t hi;
+        uint64_t lo;
+        uint32_t user;
+        uint32_t expire;
+    };
+
+    struct User {
+        std::string name;
+        uint32_t refs;
+    };
+
+    struct Shard {
+        std::mutex m;
+        std::vector<Entry> table;
+        size_t count = 0;
+        // 分片内驻留的用户名，引用计数归零后回收下标
+        std::vector<User> users;
+        std::vector<uint32_t> free_users;
+        std::unordered_map<std::string, uint32_t> user_index;
+    };
+
+    static bool _parseToken(const std::string& token, uint64_t* hi, uint64_t* lo);
+    uint32_t _now() const;
+    Shard& _shard(uint64_t lo);
+
+    // 以下均要求持有分片锁
+    size_t _find(Shard& shard, uint64_t hi, uint64_t lo);
+    void _insert(Shard& shard, const Entry& e);
+    void _erase(Shard& shard, size_t i);
+    void _grow(Shard& shard);
+    uint32_t _refUser(Shard& shard, const std::string& name);
+    void _unrefUser(Shard& shard, uint32_t user);
+
+    uint32_t _ttl_sec;
+    size_t _init_capacity;
+    int64_t _epoch_ms;
+    std::atomic<int> _sweep_next;
+    Shard _shards[SHARD_NUM];
+};
+
+#endif // SESSION_STORE_H
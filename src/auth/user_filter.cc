@@ -0,0 +1,102 @@
+/**
+ * @file user_filter.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-27
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "user_filter.h"
+#include "log/log.h"
+#include "RAIIs/sql_conn_RAII.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+UserFilter& UserFilter::instance() {
+    static UserFilter filter;
+    return filter;
+}
+
+bool UserFilter::load(SqlConnPool& pool, size_t capacity, double fp_rate) {
+    _ready = false;
+    SqlConn sql(&pool, 5000);
+    if (!sql) {
+        LOG_ERROR("UserFilter load failed: no SqlConn")
+        return false;
+    }
+    std::vector<std::string> row;
+    if (sql->execute(MysqlConn::STMT_USER_COUNT, {}, &row) <= 0 or row.empty()) {
+        LOG_ERROR("UserFilter load failed: count users")
+        return false;
+    }
+    size_t users = strtoull(row[0].c_str(), nullptr, 10);
+    // 留出一倍余量给之后的注册
+    _reset(users * 2 > capacity ? users * 2 : capacity, fp_rate);
+    long n = sql->executeEach(MysqlConn::STMT_ALL_USERS, {}, [this](const std::vector<std::string>& r) {
+        add(r[0]);
+        return true;
+    });
+    if (n < 0) {
+        LOG_ERROR("UserFilter load failed: scan users")
+        return false;
+    }
+    _ready = true;
+    LOG_INFO("UserFilter loaded %ld users, %llu bits, %d hashes",
+                n, (unsigned long long)_bit_count, _hash_count)
+    return true;
+}
+
+bool UserFilter::mightExist(const std::string& username) const {
+    if (!_ready.load(std::memory_order_acquire)) {
+        return true;
+    }
+    // 双重哈希：h1 + i * h2 模拟k个独立哈希
+    uint64_t h = crypto::sipHash(_key, username.data(), username.size());
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (int i = 0; i < _hash_count; ++i) {
+        uint64_t bit = (h1 + i * h2) % _bit_count;
+        if ((_bits[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void UserFilter::add(const std::string& username) {
+    if (_bit_count == 0) {
+        return;
+    }
+    uint64_t h = crypto::sipHash(_key, username.data(), username.size());
+    uint64_t h1 = h & 0xffffffff, h2 = (h >> 32) | 1;
+    for (int i = 0; i < _hash_count; ++i) {
+        uint64_t bit = (h1 + i * h2) % _bit_count;
+        _bits[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+    }
+}
+
+bool UserFilter::isReady() const {
+    return _ready.load(std::memory_order_acquire);
+}
+
+// private methods
+UserFilter::UserFilter(): _key(crypto::randomKey()), _bit_count(0), _hash_count(0), _ready(false) {}
+
+// m = -n*ln(p)/ln(2)^2, k = m/n*ln(2)
+void UserFilter::_reset(size_t capacity, double fp_rate) {
+    double ln2 = std::log(2.0);
+    double m = -static_cast<double>(capacity) * std::log(fp_rate) / (ln2 * ln2);
+    size_t words = static_cast<size_t>(std::ceil(m / 64));
+    words = words > 0 ? words : 1;
+    _bits.reset(new std::atomic<uint64_t>[words]);
+    for (size_t i = 0; i < words; ++i) {
+        _bits[i].store(0, std::memory_order_relaxed);
+    }
+    _bit_count = words * 64;
+    _hash_count = std::max(1, static_cast<int>(std::lround(static_cast<double>(_bit_count) / capacity * ln2)));
+}
@@ -0,0 +1,61 @@
+/**
+ * @file user_filter.h
+ * @author weilai
+ * @brief 已注册用户名的布隆过滤器
+ *        启动时从user表加载，注册成功后加入。判定"一定不存在"的用户名登录时直接失败，
+ *        随机用户名的撞库请求到不了数据库。位数组用原子操作读写，查询和加入都不加锁。
+ * @version 0.1
+ * @date 2023-08-27
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef USER_FILTER_H
+#define USER_FILTER_H
+
+#include "crypto.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class SqlConnPool;
+
+class UserFilter {
+public:
+    static UserFilter& instance();
+
+    /**
+     * @brief 从数据库加载全部用户名，失败时过滤器保持未就绪，所有查询都判为可能存在
+     *
+     * @param capacity 预计用户数下限，实际用户数更多时按两倍实际数分配
+     * @param fp_rate 期望的误判率
+     */
+    bool load(SqlConnPool& pool, size_t capacity = 1 << 20, double fp_rate = 0.01);
+
+    // false表示一定不存在
+    bool mightExist(const std::string& username) const;
+
+    void add(const std::string& username);
+
+    bool isReady() const;
+
+private:
+    UserFilter();
+    ~UserFilter() = default;
+
+    UserFilter(const UserFilter&) = delete;
+    UserFilter& operator=(const UserFilter&) = delete;
+
+    void _reset(size_t capacity, double fp_rate);
+
+    crypto::SipKey _key;
+    std::unique_ptr<std::atomic<uint64_t>[]> _bits;
+    uint64_t _bit_count;
+    int _hash_count;
+    std::atomic<bool> _ready;
+};
+
+#endif // USER_FILTER_H
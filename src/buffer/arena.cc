@@ -0,0 +1,198 @@
+/**
+ * @file arena.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-09-04
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "arena.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// 每个线程缓存的空闲块，连接只在所属的工作线程里处理，块基本不跨线程流动
+// 超过上限的块直接释放，避免突发流量后长期占着内存
+class BlockPool {
+public:
+    static const size_t MAX_FREE = 256;
+
+    ~BlockPool() {
+        while (_free) {
+            Node* next = _free->next;
+            free(_free);
+            _free = next;
+        }
+    }
+
+    void* get() {
+        if (_free) {
+            Node* node = _free;
+            _free = node->next;
+            --_count;
+            return node;
+        }
+        return malloc(Arena::BLOCK_SIZE);
+    }
+
+    void put(void* block) {
+        if (_count >= MAX_FREE) {
+            free(block);
+            return;
+        }
+        Node* node = static_cast<Node*>(block);
+        node->next = _free;
+        _free = node;
+        ++_count;
+    }
+
+private:
+    struct Node {
+        Node* next;
+    };
+
+    Node* _free = nullptr;
+    size_t _count = 0;
+};
+
+thread_local BlockPool tl_pool;
+
+inline size_t alignUp(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+const size_t Arena::HEADER_SIZE = (sizeof(Block) + alignof(std::max_align_t) - 1)
+                                    & ~(alignof(std::max_align_t) - 1);
+
+Arena::~Arena() {
+    release();
+}
+
+void* Arena::alloc(size_t size, size_t align) {
+    assert((align & (align - 1)) == 0);
+    if (_cur) {
+        char* p = reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(_cur), align));
+        if (p + size <= _end) {
+            _cur = p + size;
+            return p;
+        }
+    }
+    if (size + align > (BLOCK_SIZE - HEADER_SIZE) / 2) {
+        // 大对象单独分配，挂在链表第二位，不影响当前块继续使用
+        Block* big = static_cast<Block*>(malloc(HEADER_SIZE + size + align));
+        if (!big) {
+            throw std::bad_alloc();
+        }
+        big->big = size + align;
+        if (_head) {
+            big->next = _head->next;
+            _head->next = big;
+        } else {
+            big->next = nullptr;
+            _head = big;
+        }
+        char* data = reinterpret_cast<char*>(big) + HEADER_SIZE;
+        return reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(data), align));
+    }
+    _newBlock();
+    char* p = reinterpret_cast<char*>(alignUp(reinterpret_cast<uintptr_t>(_cur), align));
+    _cur = p + size;
+    return p;
+}
+
+char* Arena::copy(const char* s, size_t len) {
+    char* p = static_cast<char*>(alloc(len + 1, 1));
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+ArenaStr Arena::concat(const ArenaStr& a, const ArenaStr& b) {
+    char* p = static_cast<char*>(alloc(a.len + b.len + 1, 1));
+    memcpy(p, a.ptr, a.len);
+    memcpy(p + a.len, b.ptr, b.len);
+    p[a.len + b.len] = '\0';
+    return ArenaStr(p, a.len + b.len);
+}
+
+void Arena::reset() {
+    // keep-alive连接的下一个请求常在另一个工作线程处理，块全部归还会在各线程块池之间漂移，
+    // 有的线程池空了又去malloc；留一块在连接手里，普通请求一块就够用，不再经过块池
+    Block* keep = _fixed;
+    while (_head) {
+        Block* next = _head->next;
+        // 常驻块不归还
+        if (_head == _fixed) {
+            _head = next;
+            continue;
+        }
+        if (_head->big) {
+            free(_head);
+        } else if (keep == nullptr) {
+            keep = _head;
+        } else {
+            tl_pool.put(_head);
+        }
+        _head = next;
+    }
+    if (keep) {
+        _useBlock(keep);
+    } else {
+        _cur = _end = nullptr;
+    }
+}
+
+void Arena::release() {
+    while (_head) {
+        Block* next = _head->next;
+        if (_head == _fixed) {
+            _head = next;
+            continue;
+        }
+        if (_head->big) {
+            free(_head);
+        } else {
+            tl_pool.put(_head);
+        }
+        _head = next;
+    }
+    if (_fixed) {
+        _useBlock(_fixed);
+    } else {
+        _cur = _end = nullptr;
+    }
+}
+
+void Arena::attach(void* block) {
+    assert(_head == nullptr and block != nullptr);
+    _fixed = static_cast<Block*>(block);
+    _fixed->big = 0;
+    _useBlock(_fixed);
+}
+
+void Arena::_newBlock() {
+    Block* block = static_cast<Block*>(tl_pool.get());
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    block->big = 0;
+    Block* prev = _head;
+    _useBlock(block);
+    block->next = prev;
+}
+
+void Arena::_useBlock(Block* block) {
+    block->next = nullptr;
+    _head = block;
+    _cur = reinterpret_cast<char*>(block) + HEADER_SIZE;
+    _end = reinterpret_cast<char*>(block) + BLOCK_SIZE;
+}
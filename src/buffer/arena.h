@@ -0,0 +1,114 @@
+/**
+ * @file arena.h
+ * @author weilai
+ * @brief 请求级bump分配器：每个连接一个Arena，解析和生成响应用到的字符串、头部表都从中顺序分配，
+ *        请求结束时整体重置，不逐个释放。内存以固定大小的块为单位，块取自当前线程的空闲块池；
+ *        重置时保留第一块给下一个请求用，其余归还块池，连接关闭时再全部归还，稳态下不再调用malloc。
+ *        超过半块的大对象单独分配，重置时直接释放。
+ *        也可以用attach交给它一块外部内存（如连接池预分配的大页）作为常驻块，它不进出块池。
+ * @version 0.1
+ * @date 2023-09-04
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+// 只读字符串片段，总是以'\0'结尾，可以直接当C字符串用
+// 内容在Arena或静态存储中，指向Arena时重置后失效
+struct ArenaStr {
+    const char* ptr;
+    size_t len;
+
+    ArenaStr(): ptr(""), len(0) {}
+    ArenaStr(const char* s, size_t n): ptr(s), len(n) {}
+    // 字面量和其他静态字符串
+    ArenaStr(const char* s): ptr(s), len(strlen(s)) {}
+
+    const char* c_str() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return len;
+    }
+
+    bool empty() const {
+        return len == 0;
+    }
+
+    std::string str() const {
+        return std::string(ptr, len);
+    }
+
+    // 非成员形式，两侧都可以是字面量
+    friend bool operator==(const ArenaStr& a, const ArenaStr& b) {
+        return a.len == b.len and memcmp(a.ptr, b.ptr, a.len) == 0;
+    }
+
+    friend bool operator!=(const ArenaStr& a, const ArenaStr& b) {
+        return !(a == b);
+    }
+};
+
+class Arena {
+public:
+    static const size_t BLOCK_SIZE = 4096;
+
+    Arena(): _head(nullptr), _fixed(nullptr), _cur(nullptr), _end(nullptr) {}
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t size, size_t align = alignof(std::max_align_t));
+
+    template<class T>
+    T* allocArray(size_t n) {
+        return static_cast<T*>(alloc(sizeof(T) * n, alignof(T)));
+    }
+
+    // 拷贝一份并补'\0'，返回可写的副本
+    char* copy(const char* s, size_t len);
+
+    ArenaStr copyStr(const char* s, size_t len) {
+        return ArenaStr(copy(s, len), len);
+    }
+
+    ArenaStr concat(const ArenaStr& a, const ArenaStr& b);
+
+    // 丢弃已分配的内容，保留一个块复用，其余块归还线程块池
+    void reset();
+
+    // 所有块归还线程块池，attach的常驻块除外
+    void release();
+
+    // 以调用方持有的BLOCK_SIZE字节内存作为常驻块，只能在分配之前调用；内存须比Arena活得久
+    void attach(void* block);
+
+private:
+    struct Block {
+        Block* next;
+        // 0表示普通块，否则为单独分配的大块的数据大小
+        size_t big;
+    };
+
+    // 块头按最大对齐取整，数据区从这里开始
+    static const size_t HEADER_SIZE;
+
+    void _newBlock();
+    void _useBlock(Block* block);
+
+    Block* _head;
+    Block* _fixed;
+    char* _cur;
+    char* _end;
+};
+
+#endif // ARENA_H
@@ -55,7 +55,10 @@ void Buffer::retrieveUntil(const char* pos) {
 }
 
 void Buffer::retrieveAll() {
-    memset(&_buf, 0, _buf.size());
+    // 清空的是vector里的数据，而不是vector对象本身
+    memset(&_buf[0], 0, _buf.size());
+    _read_pos = 0;
+    _write_pos = 0;
 }
 std::string Buffer::retrieveAllTOString() {
     std::string str(getReadPos(), getReadableBytes());
@@ -67,6 +70,11 @@ void Buffer::append(const std::string& s) {
     append(s.data(), s.length());
 }
 
+void Buffer::append(const char* str) {
+    assert(str != nullptr);
+    append(str, strlen(str));
+}
+
 void Buffer::append(const char* str, size_t len) {
     assert(str != nullptr);
     ensureWritable(len);
@@ -41,6 +41,8 @@ public:
     std::string retrieveAllTOString();
 
     void append(const std::string& s);
+    // 字面量走这里，不必先构造string
+    void append(const char* str);
     void append(const char* str, size_t len);
     void append(const void* data, size_t len);
     void append(const Buffer& buf);
@@ -1,11 +1,18 @@
 #include "http_conn.h"
+#include "metrics/alloc_stats.h"
+#include "metrics/metrics.h"
 
 #include "unistd.h"
 #include <sys/uio.h>
 
 const int MAX_EXTRA_SPACE = 65536;
 
-HttpConn::HttpConn(): _fd(-1), _addr({0}), _is_closed(true), _iov_count(0) {}
+bool HttpConn::is_ET;
+const char* HttpConn::src_dir;
+std::atomic<int> HttpConn::user_count;
+
+HttpConn::HttpConn(): _fd(-1), _addr({0}), _is_closed(true), _parse_ok(false), _iov_count(0),
+    _bytes_in(0), _bytes_out(0) {}
 
 HttpConn::~HttpConn() {
     close_conn();
@@ -14,14 +21,27 @@ HttpConn::~HttpConn() {
 void HttpConn::init(int socket_fd, const sockaddr_in& addr) {
     assert(socket_fd > 0); // why fd > 0 ？
     user_count++;
+    Metrics::add(Metrics::CONN_ACCEPTED);
     _addr = addr;
     _fd = socket_fd;
     _read_buf.retrieveAll();
     _write_buf.retrieveAll();
     _is_closed = false;
     _version = "1.1";
-    LOG_INFO("New client connection [%d](%s:%d), current user count: %d",
-                _fd, getIP(), getPort(), user_count)
+    _timing.reset();
+    _timing.mark(RequestTiming::ACCEPT);
+    _bytes_in = _bytes_out = 0;
+    LOG_INFO_RATE(10, "New client connection [%d](%s:%d), current user count: %d",
+                _fd, getIP(), getPort(), user_count.load())
+}
+
+void HttpConn::prewarm(void* arena_block, size_t read_bytes, size_t write_bytes) {
+    _arena.attach(arena_block);
+    _read_buf.ensureWritable(read_bytes);
+    _write_buf.ensureWritable(write_bytes);
+    // retrieveAll会把整个缓冲区清零，顺便完成写页
+    _read_buf.retrieveAll();
+    _write_buf.retrieveAll();
 }
 
 void HttpConn::close_conn() {
@@ -29,13 +49,16 @@ void HttpConn::close_conn() {
     if (_is_closed == false) {
         _is_closed = true;
         user_count--;
+        Metrics::add(Metrics::CONN_CLOSED);
         close(_fd);
-        LOG_INFO("A client quit [%d](%s:%d), current user count: %d",
-                    _fd, getIP(), getPort(), user_count)
+        _arena.release();
+        LOG_INFO_RATE(10, "A client quit [%d](%s:%d), current user count: %d",
+                    _fd, getIP(), getPort(), user_count.load())
     }
 }
 
 ssize_t HttpConn::read(int* save_errno) {
+    AllocScope scope(AllocStats::READ);
     // 这里以非正值来表征读取结束
     ssize_t len = -1;
     do {
@@ -48,6 +71,7 @@ ssize_t HttpConn::read(int* save_errno) {
 }
 
 ssize_t HttpConn::write(int* save_errno) {
+    AllocScope scope(AllocStats::WRITE);
     ssize_t len = -1;
     do {
         len = writev(_fd, _iov, _iov_count);
@@ -55,6 +79,8 @@ ssize_t HttpConn::write(int* save_errno) {
             *save_errno = errno;
             break;
         }
+        Metrics::add(Metrics::BYTES_OUT, static_cast<uint64_t>(len));
+        _bytes_out += static_cast<uint64_t>(len);
         // writev成功后会将iov_len置为0吗？？？ TODO
         if (_iov[0].iov_len == 0 and _iov[1].iov_len == 0) {
             break;
@@ -73,39 +99,49 @@ ssize_t HttpConn::write(int* save_errno) {
             _write_buf.retrieve(l);
         }
     } while (is_ET or getBytesToWrite() > 10240); // why 10240?
+    if (getBytesToWrite() == 0 and _timing.t[RequestTiming::BUILT] != 0) {
+        _finishRequest();
+    }
     return len;
 }
 
 bool HttpConn::process() {
-    _request.init();
+    // 上一个请求的响应已经写完，它在arena中的内容可以丢弃了
+    _arena.reset();
+    _request.init(_arena);
     if (_read_buf.getReadableBytes() <= 0) {
         return false;
     }
-    bool is_keep_alive = false;
-    int code = 400;
-    if (_request.parse(_read_buf) == true) {
-        LOG_DEBUG("Path: %s", _request.getPath().c_str())
-        is_keep_alive = _request.isKeepAlive();
-        code = 200;
+    {
+        AllocScope scope(AllocStats::PARSE);
+        _parse_ok = _request.parse(_read_buf);
     }
-    _response.init(src_dir, _request.getPath(), is_keep_alive, code);
-    _response.makeResponse(_write_buf);
-    
-    // 状态栏和响应头
-    _iov[0].iov_base = const_cast<char*>(_write_buf.getReadPos());
-    _iov[0].iov_len = _write_buf.getReadableBytes();
-    _iov_count += 1;
-
-    // 请求的文件
-    if (_response.getFileLen() > 0 and _response.getFile() != nullptr) {
-        _iov[1].iov_base = static_cast<char*>(_response.getFile());
-        _iov[1].iov_len = static_cast<size_t>(_response.getFileLen());
-        _iov_count += 1;
+    if (_parse_ok and !_request.isComplete()) {
+        // 请求还没收全，字节留在读缓冲里，等下次可读时连同新数据一起重新解析
+        return false;
     }
-    LOG_DEBUG("Process done!")
+    _timing.mark(RequestTiming::PARSED);
+    if (_parse_ok and _request.isWaitingDb()) {
+        // 响应要等查库结果，交给Server转到DB线程池
+        return true;
+    }
+    _makeResponse();
     return true;
 }
 
+void HttpConn::processDb() {
+    {
+        AllocScope scope(AllocStats::SQL);
+        _request.runDb();
+    }
+    _timing.mark(RequestTiming::DB_END);
+    _makeResponse();
+}
+
+bool HttpConn::isWaitingDb() const {
+    return _request.isWaitingDb();
+}
+
 int HttpConn::getBytesToWrite() const {
     return _iov[0].iov_len + _iov[1].iov_len;
 }
@@ -126,11 +162,42 @@ std::string HttpConn::getHttpVersion() const {
     return _version;
 }
 
+void HttpConn::mark(RequestTiming::MARK m) {
+    _timing.mark(m);
+}
+
 bool HttpConn::isKeepAlive() const {
     return _request.isKeepAlive();
 }
 
 // private methods
+void HttpConn::_finishRequest() {
+    _timing.mark(RequestTiming::WRITTEN);
+    int route = LatencyStats::instance().routeIndex(_request.getRoute().c_str());
+    uint64_t total_us = LatencyStats::instance().finish(route, _timing);
+    AllocStats::requestDone();
+    if (TraceRing::instance().isSlow(route, total_us)) {
+        RequestTrace trace;
+        std::copy(_timing.t, _timing.t + RequestTiming::MARK_NUM, trace.t);
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        trace.wall_ms = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+        trace.fd = _fd;
+        trace.code = _response.getCode();
+        trace.bytes_in = _bytes_in;
+        trace.bytes_out = _bytes_out;
+        snprintf(trace.method, sizeof trace.method, "%s", _request.getMethod().c_str());
+        snprintf(trace.route, sizeof trace.route, "%s", _request.getRoute().c_str());
+        snprintf(trace.path, sizeof trace.path, "%s", _request.getPath().c_str());
+        TraceRing::instance().capture(trace);
+    }
+    // keep-alive的下一个请求从这里开始等待
+    int64_t done = _timing.t[RequestTiming::WRITTEN];
+    _timing.reset();
+    _timing.t[RequestTiming::ACCEPT] = done;
+    _bytes_in = _bytes_out = 0;
+}
+
 ssize_t HttpConn::_readToBuf(int fd, int* err_state) {
     // why 65536?
     char buf[MAX_EXTRA_SPACE];
@@ -145,6 +212,10 @@ ssize_t HttpConn::_readToBuf(int fd, int* err_state) {
     iov[1].iov_len = sizeof buf;
 
     ssize_t len = readv(_fd, iov, 2);
+    if (len > 0) {
+        Metrics::add(Metrics::BYTES_IN, static_cast<uint64_t>(len));
+        _bytes_in += static_cast<uint64_t>(len);
+    }
     if (len < 0) {
         *err_state = errno;
     } else if ((size_t)len <= writable) {
@@ -156,6 +227,38 @@ ssize_t HttpConn::_readToBuf(int fd, int* err_state) {
     return len;
 }
 
+void HttpConn::_makeResponse() {
+    AllocScope scope(AllocStats::RESPOND);
+    bool is_keep_alive = false;
+    int code = 400;
+    if (_parse_ok) {
+        LOG_DEBUG("Path: %s", _request.getPath().c_str())
+        is_keep_alive = _request.isKeepAlive();
+        code = _request.isDbUnavailable() ? 503 : 200;
+    }
+    _response.init(_arena, src_dir, _request.getPath(), is_keep_alive, code);
+    if (!_request.getSetCookie().empty()) {
+        _response.setCookie(_request.getSetCookie());
+    }
+    _response.makeResponse(_write_buf);
+    _timing.mark(RequestTiming::BUILT);
+    Metrics::add(Metrics::requestCounter(_response.getCode()));
+
+    // 状态栏和响应头
+    _iov[0].iov_base = const_cast<char*>(_write_buf.getReadPos());
+    _iov[0].iov_len = _write_buf.getReadableBytes();
+    _iov[1].iov_len = 0;
+    _iov_count = 1;
+
+    // 请求的文件
+    if (_response.getFileLen() > 0 and _response.getFile() != nullptr) {
+        _iov[1].iov_base = static_cast<char*>(_response.getFile());
+        _iov[1].iov_len = static_cast<size_t>(_response.getFileLen());
+        _iov_count = 2;
+    }
+    LOG_DEBUG("Process done!")
+}
+
 ssize_t HttpConn::_writeToBuf() {
 
 }
\ No newline at end of file
@@ -13,9 +13,11 @@
 #define HTTP_CONN_H
 
 #include "log/log.h"
+#include "buffer/arena.h"
 #include "buffer/buffer.h"
 #include "http/http_request.h"
 #include "http/http_response.h"
+#include "metrics/trace_ring.h"
 
 #include <arpa/inet.h> // sockaddr_in
 
@@ -27,6 +29,9 @@ public:
 
     void init(int sock_fd, const sockaddr_in& addr);
 
+    // 连接池启动时调用：arena改用池里的常驻块，缓冲区预留到给定大小并逐页写过，接入后不再扩容和缺页
+    void prewarm(void* arena_block, size_t read_bytes, size_t write_bytes);
+
     // 命名需要注意，这里用到了unistd.h中的close来关闭fd
     void close_conn();
 
@@ -35,8 +40,15 @@ public:
 
     ssize_t write(int* save_errno);
 
+    // 解析请求并生成响应；需要查库时只解析，isWaitingDb()为真
+    // 读缓冲里没有完整的请求时返回false，调用方应继续等待可读
     bool process();
 
+    // 在DB线程中调用：执行挂起的数据库操作，然后生成响应
+    void processDb();
+
+    bool isWaitingDb() const;
+
     int getBytesToWrite() const;
 
     int getFd() const;
@@ -49,6 +61,9 @@ public:
 
     bool isKeepAlive() const;
 
+    // 记录当前请求到达某个阶段的时间
+    void mark(RequestTiming::MARK m);
+
     static bool is_ET;
     static const char* src_dir;
     static std::atomic<int> user_count;
@@ -56,12 +71,17 @@ public:
 private:
     ssize_t _readToBuf(int fd, int* err_state);
     ssize_t _writeToBuf();
+    void _makeResponse();
+    // 响应写完：计入阶段直方图，慢请求再留下完整记录
+    void _finishRequest();
 
 private:
     int _fd;
     sockaddr_in _addr;
 
     bool _is_closed;
+    // 本次请求是否解析成功，挂起查库时需要保存下来
+    bool _parse_ok;
 
     // _iov_count不初始化，因为不一定要用到2个iov，值不确定
     int _iov_count;
@@ -71,8 +91,15 @@ private:
     Buffer _read_buf;
     Buffer _write_buf;
 
+    // 请求和响应的临时字符串都放在这里，下一个请求开始或连接关闭时整体回收
+    // 必须声明在_request/_response之前
+    Arena _arena;
     HttpRequest _request;
     HttpResponse _response;
+    RequestTiming _timing;
+    // 当前请求读写的字节数
+    uint64_t _bytes_in;
+    uint64_t _bytes_out;
 
     std::string _version;
 };
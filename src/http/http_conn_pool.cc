@@ -0,0 +1,114 @@
+/**
+ * @file http_conn_pool.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-09-05
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "http_conn_pool.h"
+#include "log/log.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+
+HttpConnPool::HttpConnPool(int size, bool huge_pages)
+    : _size(0), _mem(nullptr), _mem_len(0), _backing("normal"), _conns(nullptr), _overflow_count(0) {
+    if (size <= 0) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    size_t blocks_len = static_cast<size_t>(size) * Arena::BLOCK_SIZE;
+    if (!_map(blocks_len + static_cast<size_t>(size) * sizeof(HttpConn), huge_pages)) {
+        LOG_ERROR("HttpConnPool mmap failed, connections will be created on demand!")
+        return;
+    }
+    _size = size;
+    char* blocks = static_cast<char*>(_mem);
+    _conns = reinterpret_cast<HttpConn*>(blocks + blocks_len);
+    // 在这里把所有页写一遍，缺页集中发生在启动阶段
+    memset(blocks, 0, blocks_len);
+    for (int i = 0; i < _size; ++i) {
+        HttpConn* conn = new (_conns + i) HttpConn();
+        conn->prewarm(blocks + i * Arena::BLOCK_SIZE, READ_RESERVE, WRITE_RESERVE);
+    }
+    LOG_INFO("HttpConnPool: %d connections prewarmed, %zu KB %s pages, %lld ms", _size, _mem_len / 1024, _backing,
+                static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count()))
+    // LOG_MIN_LEVEL高于INFO时上面的日志被编译掉，start不再被用到
+    (void)start;
+}
+
+HttpConnPool::~HttpConnPool() {
+    for (int i = 0; i < _size; ++i) {
+        _conns[i].~HttpConn();
+    }
+    if (_mem != nullptr) {
+        munmap(_mem, _mem_len);
+    }
+}
+
+HttpConn* HttpConnPool::find(int fd) {
+    if (fd >= 0 and fd < _size) {
+        return _conns + fd;
+    }
+    auto it = _overflow.find(fd);
+    return it == _overflow.end() ? nullptr : it->second.get();
+}
+
+HttpConn* HttpConnPool::get(int fd) {
+    HttpConn* conn = find(fd);
+    if (conn == nullptr) {
+        // 对象建好后一直留着给以后同号的fd用，和原来的map一样
+        conn = new HttpConn();
+        _overflow.emplace(fd, std::unique_ptr<HttpConn>(conn));
+        _overflow_count.fetch_add(1, std::memory_order_relaxed);
+    }
+    return conn;
+}
+
+int HttpConnPool::getSize() const {
+    return _size;
+}
+
+int HttpConnPool::getOverflow() const {
+    return _overflow_count.load(std::memory_order_relaxed);
+}
+
+const char* HttpConnPool::getBacking() const {
+    return _backing;
+}
+
+// private methods
+bool HttpConnPool::_map(size_t len, bool huge_pages) {
+    void* mem = MAP_FAILED;
+    if (huge_pages) {
+        size_t huge_len = (len + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        mem = mmap(nullptr, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            _mem = mem;
+            _mem_len = huge_len;
+            _backing = "hugetlb";
+            return true;
+        }
+        LOG_WARN("MAP_HUGETLB failed (errno %d), falling back to transparent huge pages", errno)
+    }
+    mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    _mem = mem;
+    _mem_len = len;
+    // 透明大页只作用于按2MB对齐的部分，失败（内核关闭了THP）就用普通页
+    if (huge_pages and madvise(mem, len, MADV_HUGEPAGE) == 0) {
+        _backing = "thp";
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file http_conn_pool.h
+ * @author weilai
+ * @brief 预分配的HttpConn池：启动时按配置一次建好size个连接对象，连同每个连接的常驻Arena块放在同一块mmap内存里，
+ *        读写缓冲区预留到常见请求的大小，所有页面在启动时写一遍，刚重启时接入连接不再集中触发分配和缺页。
+ *        连接按fd直接下标定位：内核总是分配最小的空闲fd，并发连接不超过size（减去监听、日志、数据库等fd）
+ *        时都落在池内，超出的按需创建。
+ *        huge_pages为真时先试MAP_HUGETLB（需要预留大页，vm.nr_hugepages），失败则退回透明大页（MADV_HUGEPAGE）。
+ *        池在Reactor所在的主线程中构造并写页，按Linux默认的首次访问策略，内存落在Reactor所在的NUMA节点。
+ * @version 0.1
+ * @date 2023-09-05
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef HTTP_CONN_POOL_H
+#define HTTP_CONN_POOL_H
+
+#include "http/http_conn.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+
+class HttpConnPool {
+public:
+    HttpConnPool(int size, bool huge_pages);
+    ~HttpConnPool();
+
+    HttpConnPool(const HttpConnPool&) = delete;
+    HttpConnPool& operator=(const HttpConnPool&) = delete;
+
+    // fd从未接入过时返回nullptr；池内的fd总能找到
+    HttpConn* find(int fd);
+
+    // 取fd对应的连接对象，池外的fd按需创建，只在主线程调用
+    HttpConn* get(int fd);
+
+    // 预分配的连接数
+    int getSize() const;
+
+    // 池外按需创建的连接数，可在任意线程读取
+    int getOverflow() const;
+
+    // 实际使用的页面类型："hugetlb"、"thp"或"normal"
+    const char* getBacking() const;
+
+    // 每个预分配连接预留的缓冲区大小，覆盖一般浏览器请求和响应头
+    static const size_t READ_RESERVE = 4096;
+    static const size_t WRITE_RESERVE = 1024;
+
+private:
+    // 映射一块至少len字节的匿名内存，成功时设置_mem/_mem_len/_backing
+    bool _map(size_t len, bool huge_pages);
+
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    int _size;
+    // [Arena块 x size][HttpConn x size]
+    void* _mem;
+    size_t _mem_len;
+    const char* _backing;
+    HttpConn* _conns;
+    std::unordered_map<int, std::unique_ptr<HttpConn>> _overflow;
+    // map只在主线程改动，指标由管理线程读取，单独计数
+    std::atomic<int> _overflow_count;
+};
+
+#endif // HTTP_CONN_POOL_H
@@ -1,135 +1,261 @@
 #include "http_request.h"
 #include "log/log.h"
-#include "RAIIs/sql_conn_RAII.hpp"
-#include "pool/sql_conn_pool.h"
+#include "auth/auth_cache.h"
+#include "auth/register_writer.h"
+#include "auth/session_store.h"
+#include "auth/user_filter.h"
+#include "metrics/probes.h"
+#include "pool/circuit_breaker.h"
+#include "RAIIs/sql_route_RAII.hpp"
 
 #include <algorithm>
-#include <regex>
-#include <unordered_set>
-#include <mysql/mysql.h>
+#include <chrono>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
 
-const std::unordered_set<std::string> DEFAULT_HTML {
+const char* const HttpRequest::DEFAULT_HTML[] {
     "/", "/index", "/register", "/login",
     "/welcome", "/picture", "/video"
 };
 
-const std::unordered_map<std::string, int> LOGIN_OPTIONS {
+const std::unordered_map<std::string, int> HttpRequest::LOGIN_OPTIONS {
     {"/login.html", 0}, {"/register.html", 1}
 };
 
-HttpRequest::HttpRequest() {
+HttpRequest::HttpRequest(): _arena(nullptr), _state(PARSE_STATE::REQUEST_LINE), _db_task(DB_TASK::NONE),
+    _db_unavailable(false), _db_ms(0), _content_length(0) {
     // init();
 }
 
-void HttpRequest::init() {
-    _method = _path = _version = _body = "";
+void HttpRequest::init(Arena& arena) {
+    _arena = &arena;
+    _method = _path = _version = _body = _route = ArenaStr();
     _state = PARSE_STATE::REQUEST_LINE;
+    _db_task = DB_TASK::NONE;
+    _db_unavailable = false;
+    _db_ms = 0;
+    _content_length = 0;
+    _set_cookie.clear();
     _headers.clear();
     _post.clear();
 }
 
 bool HttpRequest::parse(Buffer& buf) {
-    const std::string CRLF = "\r\n";
-    if (buf.getReadableBytes() <= 0) {
-        LOG_ERROR("No request to be parsed!")
-        return false;
-    }
-    while (buf.getReadableBytes() > 0 and _state != PARSE_STATE::FINISH) {
-        // find and copy a line
-        const char* line_end = std::search(buf.getReadPos(), buf.getWritePosConst(), CRLF.begin(), CRLF.end());
-        std::string line(buf.getReadPos(), line_end);
-        // FINISH不会进入switch
-        switch (_state) {
-            case PARSE_STATE::REQUEST_LINE:
-                if (_parseRequestLine(line) == false) {
-                    return false;
-                }
-                _parsePath();
-                break;
-            case PARSE_STATE::HEADERS:
-                if (_parseHeaders(line) == false) {
-                    return false;
-                }
-                break;
-            case PARSE_STATE::BODY:
-                if (_parseBody(line) == false) {
-                    return false;
-                }
-                break;
-            default:
-                break;
-        }
-        if (line_end + 2 == buf.getWritePos()) {
+    PROBE2(parse_begin, this, buf.getReadableBytes());
+    bool ok = _parse(buf);
+    PROBE2(parse_end, this, ok);
+    return ok;
+}
+
+const ArenaStr& HttpRequest::getPath() const {
+    return _path;
+}
+
+const ArenaStr& HttpRequest::getMethod() const {
+    return _method;
+}
+
+const ArenaStr& HttpRequest::getRoute() const {
+    return _route;
+}
+
+bool HttpRequest::isComplete() const {
+    return _state == PARSE_STATE::FINISH;
+}
+
+bool HttpRequest::isWaitingDb() const {
+    return _db_task != DB_TASK::NONE;
+}
+
+void HttpRequest::runDb() {
+    _db_ms = 0;
+    // 只有登录注册走到这里，拷贝成string交给认证模块
+    std::string username = _post.get("username").str();
+    std::string password = _post.get("password").str();
+    switch (_db_task) {
+        case DB_TASK::VERIFY:
+            if (_userVerify(username, password)) {
+                _path = "/welcome.html";
+                _issueSession(username);
+            } else {
+                _path = "/error.html";
+            }
+            break;
+        case DB_TASK::REGISTER:
+            // 注册成功停留在原页面
+            if (!_userRegister(username, password)) {
+                _path = "/error.html";
+            }
+            break;
+        default:
             break;
-        }
-        buf.retrieveUntil(line_end + 2);
     }
-    LOG_INFO("Request parse done: [%s], [%s], [%s]",
-                _method.c_str(), _path.c_str(), _body.c_str())
-    return true;
+    _db_task = DB_TASK::NONE;
+    // 密码错误、用户名重复不算故障，只有取不到连接或查询出错才计入熔断
+    if (_db_unavailable) {
+        CircuitBreaker::instance().onFailure();
+    } else {
+        CircuitBreaker::instance().onSuccess(_db_ms);
+    }
 }
 
-std::string HttpRequest::getPath() const {
-    return _path;
+bool HttpRequest::isDbUnavailable() const {
+    return _db_unavailable;
+}
+
+const std::string& HttpRequest::getSetCookie() const {
+    return _set_cookie;
 }
 
 bool HttpRequest::isKeepAlive() const {
-    if (_headers.find("Connection") == _headers.end()) {
+    const ArenaStr* conn = _headers.find("Connection");
+    if (conn == nullptr) {
         return false;
     }
-    if (_headers.at("Connection") == "keep-alive" and _version == "1.1") {
+    if (*conn == "keep-alive" and _version == "1.1") {
         return true;
     }
     return false;
 }
 
 // private methods
-bool HttpRequest::_parseRequestLine(const std::string& line) {
-    std::regex pattern("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch submatch;
-    if (regex_match(line, submatch, pattern)) {
-        _method = submatch[1];
-        _path = submatch[2];
-        _version = submatch[3];
-        _state = PARSE_STATE::HEADERS;
-        LOG_INFO("RequestLine parse done: [%s]", submatch[0])
+bool HttpRequest::_parse(Buffer& buf) {
+    static const char CRLF[] = "\r\n";
+    if (buf.getReadableBytes() <= 0) {
+        LOG_ERROR("No request to be parsed!")
+        return false;
+    }
+    static const char HEADER_END[] = "\r\n\r\n";
+    // 整个请求收全之前不取走任何字节，下次读到更多数据后从头重新解析
+    // 流水线上的请求常在读缓冲的末尾被截断，剩下的部分不能被当成一个新请求
+    const char* pos = buf.getReadPos();
+    const char* end = buf.getWritePosConst();
+    const char* header_end = std::search(pos, end, HEADER_END, HEADER_END + 4);
+    if (header_end == end) {
+        if (static_cast<size_t>(end - pos) > MAX_HEADER_LEN) {
+            LOG_ERROR("Request headers too long!")
+            return false;
+        }
         return true;
     }
-    LOG_ERROR("Match failed! Bad RequestLine!")
-    return false;
+    // 逐行解析到空行为止，空行之后根据Content-Length进入BODY或直接FINISH
+    while (_state == PARSE_STATE::REQUEST_LINE or _state == PARSE_STATE::HEADERS) {
+        const char* line_end = std::search(pos, header_end + 4, CRLF, CRLF + 2);
+        size_t len = line_end - pos;
+        char* line = _arena->copy(pos, len);
+        if (_state == PARSE_STATE::REQUEST_LINE) {
+            if (_parseRequestLine(line, len) == false) {
+                return false;
+            }
+            _parsePath();
+            _route = _path;
+        } else if (_parseHeaders(line, len) == false) {
+            return false;
+        }
+        pos = line_end + 2;
+    }
+    if (_state == PARSE_STATE::BODY) {
+        size_t len;
+        const char* body_end;
+        if (_content_length > 0) {
+            // 按Content-Length取消息体，不按行切，后面的字节留给流水线上的下一个请求
+            if (_content_length > MAX_BODY_LEN) {
+                LOG_ERROR("Request body too long: %zu", _content_length)
+                return false;
+            }
+            if (static_cast<size_t>(end - pos) < _content_length) {
+                return true;
+            }
+            len = _content_length;
+            body_end = pos + len;
+        } else {
+            // 没有Content-Length的POST只能按原来的方式取到行尾或缓冲区末尾
+            const char* line_end = std::search(pos, end, CRLF, CRLF + 2);
+            len = line_end - pos;
+            body_end = line_end == end ? end : line_end + 2;
+        }
+        char* body = _arena->copy(pos, len);
+        if (_parseBody(body, len) == false) {
+            return false;
+        }
+        _state = PARSE_STATE::FINISH;
+        pos = body_end;
+    }
+    buf.retrieveUntil(pos);
+    // 已登录用户直接进入欢迎页
+    if (_method == "GET" and _path == "/login.html" and _hasSession(nullptr)) {
+        _path = "/welcome.html";
+    }
+    // 每个请求都会走到这里，只采样记录
+    LOG_INFO_EVERY_N(100, "Request parse done: [%s], [%s], [%s]",
+                _method.c_str(), _path.c_str(), _body.c_str())
+    return true;
 }
 
-bool HttpRequest::_parseHeaders(const std::string& line) {
-    // 匹配到空行直接继续解析消息体
-    if (line.empty()) {
-        _state = PARSE_STATE::BODY;
-        LOG_INFO("All RequestHeaders parse done.")
-        return true;
+bool HttpRequest::_parseRequestLine(char* line, size_t len) {
+    // METHOD SP PATH SP HTTP/VERSION，三段都不含空格
+    char* line_end = line + len;
+    char* sp1 = std::find(line, line_end, ' ');
+    char* sp2 = sp1 == line_end ? line_end : std::find(sp1 + 1, line_end, ' ');
+    if (sp2 == line_end or std::find(sp2 + 1, line_end, ' ') != line_end
+            or line_end - sp2 < 6 or memcmp(sp2 + 1, "HTTP/", 5) != 0) {
+        LOG_ERROR("Match failed! Bad RequestLine!")
+        return false;
     }
-    std::regex pattern("^([^:]*): ?(.*)$");
-    std::smatch submatch;
-    if (regex_match(line, submatch, pattern)) {
-        _headers[submatch[1]] = submatch[2];
-        LOG_INFO("RequestHeader parse done: [%s]", submatch[0])
+    *sp1 = *sp2 = '\0';
+    _method = ArenaStr(line, sp1 - line);
+    _path = ArenaStr(sp1 + 1, sp2 - sp1 - 1);
+    _version = ArenaStr(sp2 + 6, line_end - sp2 - 6);
+    _state = PARSE_STATE::HEADERS;
+    LOG_DEBUG("RequestLine parse done: [%s %s HTTP/%s]", _method.c_str(), _path.c_str(), _version.c_str())
+    return true;
+}
+
+bool HttpRequest::_parseHeaders(char* line, size_t len) {
+    // 匹配到空行，按Content-Length决定是否还有消息体
+    if (len == 0) {
+        const ArenaStr* cl = _headers.find("Content-Length");
+        _content_length = cl == nullptr ? 0 : strtoul(cl->c_str(), nullptr, 10);
+        // 没有消息体的请求到此结束，不能把流水线上的下一个请求当成消息体吞掉
+        // 没有Content-Length的POST仍按原来的方式取一行作为消息体
+        if (_content_length > 0 or (_method == "POST" and cl == nullptr)) {
+            _state = PARSE_STATE::BODY;
+        } else {
+            _state = PARSE_STATE::FINISH;
+        }
+        LOG_DEBUG("All RequestHeaders parse done.")
         return true;
-    } else {
+    }
+    // Name: value，冒号后最多跳过一个空格
+    char* line_end = line + len;
+    char* colon = std::find(line, line_end, ':');
+    if (colon == line_end) {
         LOG_ERROR("Match Failed! Bad headers!")
         return false;
     }
+    *colon = '\0';
+    char* value = colon + 1;
+    if (value != line_end and *value == ' ') {
+        ++value;
+    }
+    _headers.set(*_arena, ArenaStr(line, colon - line), ArenaStr(value, line_end - value));
+    LOG_DEBUG("RequestHeader parse done: [%s: %s]", line, value)
+    return true;
 }
 
-bool HttpRequest::_parseBody(const std::string& line) {
+bool HttpRequest::_parseBody(char* line, size_t len) {
     // GET请求也可以携带body，不报错只给一个警告
     if (_method != "POST") {
-        LOG_WARN("A GET request with body: [%s]", line.c_str())
+        LOG_WARN_RATE(10, "A GET request with body: [%s]", line)
         return true;
     }
     // 后面的操作可以确定这是一个POST请求
-    if (line.empty()) {
-        LOG_INFO("A POST request with empty body.")
+    if (len == 0) {
+        LOG_INFO_RATE(10, "A POST request with empty body.")
         return true;
     }
-    _body = line;
+    _body = ArenaStr(line, len);
     if (_parsePost() == false) {
         return false;
     }
@@ -138,29 +264,30 @@ bool HttpRequest::_parseBody(const std::string& line) {
 }
 
 bool HttpRequest::_parsePath() {
-    if (DEFAULT_HTML.find(_path) == DEFAULT_HTML.end()) {
+    if (std::find(std::begin(DEFAULT_HTML), std::end(DEFAULT_HTML), _path) == std::end(DEFAULT_HTML)) {
         return false;
     }
     if (_path == "/") {
         _path = "/index.html";
     } else {
-        _path += ".html";
+        _path = _arena->concat(_path, ".html");
     }
     return true;
 }
 
 // POST请求实现用户名和密码验证，可以隐藏具体数据
 bool HttpRequest::_parsePost() {
-    const std::string ct{"Content-Type"};
-    if (_headers.find(ct) == _headers.end()) {
+    const ArenaStr* ct = _headers.find("Content-Type");
+    if (ct == nullptr) {
         LOG_ERROR("Find no Content-Type when parsing POST body!")
         return false;
     }
-    if (_headers[ct] != "application/x-www-form-urlencoded") {
+    if (*ct != "application/x-www-form-urlencoded") {
         return false;
     }
     _parseEncodedUrl();
-    if (LOGIN_OPTIONS.find(_path) == LOGIN_OPTIONS.end()) {
+    auto option = LOGIN_OPTIONS.find(_path.str());
+    if (option == LOGIN_OPTIONS.end()) {
         return true;
     }
     // const map does not support []
@@ -168,29 +295,45 @@ bool HttpRequest::_parsePost() {
     // int tag = LOGIN_OPTIONS[_path]; // error
     // 可以使用at或find取得对应的值
     // int tag = LOGIN_OPTIONS.find(_path)->second; // correct
-    int tag = LOGIN_OPTIONS.at(_path);
+    int tag = option->second;
     LOG_DEBUG("LOGIN tag: %d", tag)
-    if (tag == 1) {
-        if (_userRegister(_post["username"], _post["password"])) {
-            return true;
-        }
-        return false;
+    std::string username = _post.get("username").str();
+    // 同一用户带着有效会话再次登录，不校验密码也不查库
+    if (tag == 0 and _hasSession(username.c_str())) {
+        _path = "/welcome.html";
+        return true;
     }
-    if (_userVerify(_post["username"], _post["password"])) {
+    // 登录缓存命中直接完成，不必转到DB线程
+    if (tag == 0 and AuthCache::instance().verify(username, _post.get("password").str())) {
+        LOG_DEBUG("Auth cache hit: %s", username.c_str())
         _path = "/welcome.html";
-    } else {
+        _issueSession(username);
+        return true;
+    }
+    // 布隆过滤器判定不存在的用户名直接登录失败
+    if (tag == 0 and !UserFilter::instance().mightExist(username)) {
+        LOG_INFO_RATE(10, "No such user: %s", username.c_str())
         _path = "/error.html";
+        return true;
     }
+    // 熔断期间不再排队等数据库，直接503
+    if (!CircuitBreaker::instance().allow()) {
+        _db_unavailable = true;
+        return true;
+    }
+    // 这里只登记，不在工作线程里阻塞查库，见runDb()
+    _db_task = tag == 1 ? DB_TASK::REGISTER : DB_TASK::VERIFY;
     return true;
-    
 }
 
 bool HttpRequest::_parseEncodedUrl() {
-    std::string key = "", value = "";
+    // _body指向本请求拷贝到arena中的行，可以原地改写
+    char* body = const_cast<char*>(_body.c_str());
+    ArenaStr key, value;
     // 这里用正则匹配太麻烦了 TODO：regex
-    int end = 0, start = 0;
+    size_t end = 0, start = 0;
     for (; end < _body.size(); ++end) {
-        char& c = _body[end];
+        char& c = body[end];
         switch (c) {
             // 特殊地，http用'+'来编码' '，解析时转换回' '
             case '+':
@@ -201,17 +344,17 @@ bool HttpRequest::_parseEncodedUrl() {
                 // TODO
                 break;
             case '=':
-                key = _body.substr(start, end - start);
+                key = _arena->copyStr(body + start, end - start);
                 start = end + 1;
                 break;
             case '&':
-                value = _body.substr(start, end - start);
+                value = _arena->copyStr(body + start, end - start);
                 start = end + 1;
-                if (_post.find(key) != _post.end()) {
-                    LOG_WARN("Duplicate header: [%s: %s]",
-                            key, _post[key])
+                if (_post.find(key) != nullptr) {
+                    LOG_WARN_RATE(10, "Duplicate header: [%s: %s]",
+                            key.c_str(), _post.find(key)->c_str())
                 }
-                _post[key] = value;
+                _post.set(*_arena, key, value);
                 LOG_DEBUG("Store a single header: [%s: %s]",
                             key.c_str(), value.c_str())
                 break;
@@ -224,10 +367,42 @@ bool HttpRequest::_parseEncodedUrl() {
         return true;
     }
     // 处理最后一个键值对
-    _post[key] = _body.substr(start, end - start);
+    _post.set(*_arena, key, _arena->copyStr(body + start, end - start));
     return true;
 }
 
+bool HttpRequest::_hasSession(const char* username) {
+    const ArenaStr* cookie_header = _headers.find("Cookie");
+    if (cookie_header == nullptr) {
+        return false;
+    }
+    // Cookie: a=1; sid=xxxx; b=2
+    const char* cookie = cookie_header->c_str();
+    const char* pos = cookie;
+    while ((pos = strstr(pos, "sid=")) != nullptr) {
+        if (pos == cookie or pos[-1] == ' ' or pos[-1] == ';') {
+            break;
+        }
+        pos += 4;
+    }
+    if (pos == nullptr) {
+        return false;
+    }
+    pos += 4;
+    std::string token(pos, strnlen(pos, SessionStore::TOKEN_LEN));
+    std::string user;
+    if (!SessionStore::instance().lookup(token, &user)) {
+        return false;
+    }
+    return username == nullptr or user == username;
+}
+
+void HttpRequest::_issueSession(const std::string& username) {
+    _set_cookie = "sid=" + SessionStore::instance().create(username)
+                + "; Path=/; Max-Age=" + std::to_string(SessionStore::instance().getTtl())
+                + "; HttpOnly; SameSite=Lax";
+}
+
 bool HttpRequest::_userVerify(const std::string& username, const std::string& password) {
     if (username == "") {
         LOG_ERROR("No username!")
@@ -235,46 +410,103 @@ bool HttpRequest::_userVerify(const std::string& username, const std::string& pa
     }
     LOG_DEBUG("Verify username: %s, password: %s",
             username.c_str(), password.c_str())
-    SqlConn sql(&SqlConnPool::instance());
-    
-    char order[256] = { 0 };
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", username.c_str());
-    LOG_DEBUG("MySQL query: [%s]", order);
-
-    MYSQL_RES *res = nullptr;
-    if (mysql_query(&sql, order) != 0) {
-        mysql_free_result(res);
+    // 预编译语句按参数绑定，用户名不再拼进SQL文本
+    std::vector<std::string> row;
+    int ret = -1;
+    for (SqlRouter::ROUTE route : {SqlRouter::READ, SqlRouter::WRITE}) {
+        SqlRoute sql(route);
+        if (!sql) {
+            _db_unavailable = true;
+            return false;
+        }
+        // 连接已经拿到，从这里开始计时
+        auto start = std::chrono::steady_clock::now();
+        ret = sql->execute(MysqlConn::STMT_VERIFY, {username}, &row);
+        _db_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        if (ret < 0) {
+            sql.fail();
+        }
+        // 副本出错或还没同步到刚注册的用户时，回主库再查一次
+        if (ret > 0 or !sql.fromReplica()) {
+            break;
+        }
+    }
+    if (ret < 0) {
+        _db_unavailable = true;
         return false;
     }
-    res = mysql_store_result(&sql);
-    unsigned int num_fields = mysql_num_fields(res);
-    MYSQL_FIELD *fields = mysql_fetch_fields(res);
-
-    // 这里应该只fetch到一行？
-    MYSQL_ROW row = mysql_fetch_row(res);
-    LOG_DEBUG("Get MySQL row: %s %s", row[0], row[1]);
-    std::string pwd(row[1]);
-    bool f = false;
-    if (pwd == password) {
-        f = true;
-    } else {
-        LOG_INFO("Wrong password!")
+    if (ret == 0 or row.size() < 2) {
+        LOG_INFO_RATE(10, "No such user: %s", username.c_str())
+        return false;
+    }
+    LOG_DEBUG("Get MySQL row: %s %s", row[0].c_str(), row[1].c_str())
+    if (row[1] != password) {
+        LOG_INFO_RATE(10, "Wrong password!")
+        return false;
     }
-    // 这里可以RAII？
-    mysql_free_result(res);
-    return f;
+    AuthCache::instance().put(username, password);
+    return true;
 }
 
 bool HttpRequest::_userRegister(const std::string& username, const std::string& password) {
-    LOG_DEBUG("New user register.")
-    char order[256] = { 0 };
-    snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s', '%s')", username.c_str(), password.c_str());
-    LOG_DEBUG("New user register: [%s]", order);
-    SqlConn sql(&SqlConnPool::instance());
-    if (mysql_query(&sql, order) != 0) {
+    if (username == "") {
+        LOG_ERROR("No username!")
+        return false;
+    }
+    LOG_DEBUG("New user register: %s", username.c_str())
+    // 交给写线程和其他注册请求合并提交，等待期间不占用连接
+    RegisterWriter::RESULT ret = RegisterWriter::instance().submit(username, password, &_db_ms);
+    if (ret != RegisterWriter::OK) {
         LOG_ERROR("Register failed!")
+        // 用户名已存在或可能已经写入，都要进过滤器，否则登录会被过滤器直接拒绝；多放进一个只多一次查询
+        if (ret != RegisterWriter::FAILED) {
+            UserFilter::instance().add(username);
+        }
+        if (ret != RegisterWriter::DUPLICATE) {
+            _db_unavailable = true;
+        }
         return false;
     }
+    AuthCache::instance().invalidate(username);
+    UserFilter::instance().add(username);
     LOG_DEBUG("Register done!")
     return true;
+}
+
+void HttpRequest::FieldTable::clear() {
+    // 数组在arena中，随arena一起回收
+    _fields = nullptr;
+    _size = _cap = 0;
+}
+
+void HttpRequest::FieldTable::set(Arena& arena, const ArenaStr& key, const ArenaStr& value) {
+    for (size_t i = 0; i < _size; ++i) {
+        if (_fields[i].key == key) {
+            _fields[i].value = value;
+            return;
+        }
+    }
+    if (_size == _cap) {
+        size_t cap = _cap == 0 ? 16 : _cap * 2;
+        Field* fields = arena.allocArray<Field>(cap);
+        std::copy(_fields, _fields + _size, fields);
+        _fields = fields;
+        _cap = cap;
+    }
+    _fields[_size++] = Field{key, value};
+}
+
+const ArenaStr* HttpRequest::FieldTable::find(const ArenaStr& key) const {
+    for (size_t i = 0; i < _size; ++i) {
+        if (_fields[i].key == key) {
+            return &_fields[i].value;
+        }
+    }
+    return nullptr;
+}
+
+ArenaStr HttpRequest::FieldTable::get(const ArenaStr& key) const {
+    const ArenaStr* value = find(key);
+    return value ? *value : ArenaStr();
 }
\ No newline at end of file
@@ -13,11 +13,12 @@
 #define HTTP_REQUEST_H
 
 #include "log/log.h"
+#include "buffer/arena.h"
 #include "buffer/buffer.h"
 
+#include <cstdint>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 
 class HttpRequest {
 public:
@@ -27,10 +28,17 @@ public:
     enum class PARSE_STATE {
         REQUEST_LINE,
         HEADERS,
-        BODY, // 只对POST请求
+        BODY, // 带Content-Length的请求，或没有Content-Length的POST
         FINISH
     };
 
+    // 解析阶段发现需要访问数据库的操作，交给DB线程执行
+    enum class DB_TASK {
+        NONE,
+        VERIFY,
+        REGISTER
+    };
+
     enum class HTTP_CODE {
         NO_REQUEST,
         GET_REQUEST,
@@ -42,31 +50,92 @@ public:
     HttpRequest();
     ~HttpRequest() = default;
 
-    void init();
+    // 解析出的字符串都放在arena中，arena重置前有效
+    void init(Arena& arena);
+    // 格式错误时返回false；请求还没收全时返回true但isComplete()为false，不取走缓冲区里的字节
     bool parse(Buffer& buf);
 
-    std::string getPath() const;
+    bool isComplete() const;
+
+    const ArenaStr& getPath() const;
+
+    const ArenaStr& getMethod() const;
+
+    // 解析出的原始路径，登录结果等改写_path之前的值，用于按路由统计
+    const ArenaStr& getRoute() const;
+
+    bool isWaitingDb() const;
+
+    // 本次请求新签发的会话，非空时响应需带上Set-Cookie
+    const std::string& getSetCookie() const;
+
+    // 执行挂起的数据库操作并据此改写_path，运行在DB线程中
+    void runDb();
+
+    // 熔断或数据库故障，响应应为503
+    bool isDbUnavailable() const;
 
     bool isKeepAlive() const;
 
 private:
-    bool _parseRequestLine(const std::string& line);
-    bool _parseHeaders(const std::string& line);
-    bool _parseBody(const std::string& line);
+    // 头部和表单字段都只有十几个，线性查找比哈希表快，数组本身也分配在arena中
+    class FieldTable {
+    public:
+        void clear();
+        // 同名字段后者覆盖前者
+        void set(Arena& arena, const ArenaStr& key, const ArenaStr& value);
+        // 不存在时返回nullptr
+        const ArenaStr* find(const ArenaStr& key) const;
+        // 不存在时返回空串
+        ArenaStr get(const ArenaStr& key) const;
+
+    private:
+        struct Field {
+            ArenaStr key;
+            ArenaStr value;
+        };
+
+        Field* _fields = nullptr;
+        size_t _size = 0;
+        size_t _cap = 0;
+    };
+
+    bool _parse(Buffer& buf);
+    // 行已拷贝到arena中，解析时原地写入'\0'切分
+    bool _parseRequestLine(char* line, size_t len);
+    bool _parseHeaders(char* line, size_t len);
+    bool _parseBody(char* line, size_t len);
 
     bool _parsePath();
     bool _parsePost();
     bool _parseEncodedUrl();
 
+    // 请求带有效会话Cookie时返回true；username非空时还要求会话属于该用户
+    bool _hasSession(const char* username);
+    void _issueSession(const std::string& username);
+
     bool _userVerify(const std::string& username, const std::string& password);
     bool _userRegister(const std::string& username, const std::string& password);
     
+    Arena* _arena;
     PARSE_STATE _state;
-    std::string _method, _path, _version, _body;
-    std::unordered_map<std::string, std::string> _headers;
-    std::unordered_map<std::string, std::string> _post;
+    DB_TASK _db_task;
+    bool _db_unavailable;
+    // 本次请求在数据库连接上执行的耗时，不含等待连接池和组提交凑批，熔断按它判定慢调用
+    int64_t _db_ms;
+    // 消息体长度，0表示没有Content-Length
+    size_t _content_length;
+    std::string _set_cookie;
+    ArenaStr _method, _path, _version, _body;
+    ArenaStr _route;
+    FieldTable _headers;
+    FieldTable _post;
+
+    // 请求头和消息体的长度上限，超过按错误请求处理，不再等待剩余部分
+    static const size_t MAX_HEADER_LEN = 8192;
+    static const size_t MAX_BODY_LEN = 65536;
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
+    static const char* const DEFAULT_HTML[];
     static const std::unordered_map<std::string, int> LOGIN_OPTIONS;
 };
 
@@ -1,6 +1,9 @@
 #include "http_response.h"
 #include "log/log.h"
+#include "metrics/probes.h"
 
+#include <cstdio>
+#include <cstring>
 #include <unordered_map>
 
 #include <sys/stat.h>
@@ -34,35 +37,51 @@ const std::unordered_map<int, std::string> HttpResponse::STATUS_CODE {
     { 200, "OK" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
-    { 404, "Not Found" }
+    { 404, "Not Found" },
+    { 503, "Service Unavailable" }
 };
 
 const std::unordered_map<int, std::string> HttpResponse::ERROR_CODE {
     { 400, "/400.html" },
     { 403, "/403.html" },
-    { 404, "/404.html" }
+    { 404, "/404.html" },
+    { 503, "/503.html" }
 };
 
 HttpResponse::HttpResponse()
-    : _code(-1), _keep_alive(false), _path(""),
-    _src_dir(""), _file(nullptr), _file_stat({0}) {}
+    : _arena(nullptr), _code(-1), _keep_alive(false), _file(nullptr), _file_stat({0}) {}
 
 HttpResponse::~HttpResponse() {
     _unmapFile();
 }
 
-void HttpResponse::init(const std::string& src_dir, const std::string& path, bool keep_alive, int code) {
+void HttpResponse::init(Arena& arena, const char* src_dir, const ArenaStr& path, bool keep_alive, int code) {
     if (_file != nullptr) {
         _unmapFile();
     }
+    _arena = &arena;
     _src_dir = src_dir;
     _path = path;
+    _file_path = _arena->concat(_src_dir, _path);
     _keep_alive = keep_alive;
     _code = code;
+    _cookie.clear();
+}
+
+void HttpResponse::setCookie(const std::string& cookie) {
+    _cookie = cookie;
 }
 
 void HttpResponse::makeResponse(Buffer& buf) {
-    if (stat((_src_dir + _path).c_str(), &_file_stat) < 0 or S_ISDIR(_file_stat.st_mode)) {
+    // 5xx由调用方在找文件之前就决定了，保持不变
+    if (_code >= 500) {
+        _errorHtml();
+        _addStateLine(buf);
+        _addHeader(buf);
+        _addContent(buf);
+        return;
+    }
+    if (stat(_file_path.c_str(), &_file_stat) < 0 or S_ISDIR(_file_stat.st_mode)) {
         _code = 404;
     } else if (!(_file_stat.st_mode & S_IROTH)) {
         _code = 403;
@@ -75,6 +94,10 @@ void HttpResponse::makeResponse(Buffer& buf) {
     _addContent(buf);
 }
 
+int HttpResponse::getCode() const {
+    return _code;
+}
+
 int HttpResponse::getFileLen() const {
     return _file_stat.st_size;
 }
@@ -85,11 +108,15 @@ void* HttpResponse::getFile() {
 
 // private methods
 void HttpResponse::_addStateLine(Buffer& buf) {
-    if (STATUS_CODE.find(_code) == STATUS_CODE.end()) {
+    auto it = STATUS_CODE.find(_code);
+    if (it == STATUS_CODE.end()) {
         _code = 400;
+        it = STATUS_CODE.find(_code);
     }
-    std::string status = STATUS_CODE.at(_code);
-    buf.append("HTTP/1.1 " + std::to_string(_code) + " " + status + "\r\n");
+    // 直接格式化到栈上，不拼接临时string
+    char line[64];
+    int len = snprintf(line, sizeof line, "HTTP/1.1 %d %s\r\n", _code, it->second.c_str());
+    buf.append(line, static_cast<size_t>(len));
 }
 
 void HttpResponse::_addHeader(Buffer& buf) {
@@ -100,19 +127,36 @@ void HttpResponse::_addHeader(Buffer& buf) {
     } else {
         buf.append("close\r\n");
     }
-    buf.append("Content-type: " + _getFileType() + "\r\n");
+    buf.append("Content-type: ");
+    buf.append(_getFileType());
+    buf.append("\r\n");
+    if (!_cookie.empty()) {
+        buf.append("Set-Cookie: ");
+        buf.append(_cookie);
+        buf.append("\r\n");
+    }
+    if (_code == 503) {
+        buf.append("Retry-After: 1\r\n");
+    }
 }
 
 void HttpResponse::_addContent(Buffer& buf) {
-    int fd = open((_src_dir + _path).c_str(), O_RDONLY);
+    const char* file = _file_path.c_str();
+    int fd = open(file, O_RDONLY);
+    PROBE2(file_open, file, fd);
     if (fd < 0) {
+        if (_code == 503) {
+            _errorContent(buf, "Database unavailable, please retry later.");
+            return;
+        }
         LOG_ERROR("Open file failed!")
         _errorContent(buf, "File NotFound!");
         return;
     }
-    LOG_DEBUG("mmap file path: %s", (_src_dir + _path).c_str())
+    LOG_DEBUG("mmap file path: %s", file)
     // mmap将文件映射到内存提高访问速度，PROT_READ只读，MAP_PRIVATE建立私有写时拷贝映射
     void* ret = mmap(0, _file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    PROBE3(file_mmap, file, ret, _file_stat.st_size);
     // #define MAP_FAILED ((void*)-1)
     // ((void*)-1) convert -1 to a pointer 0xFFFFFFFF
     // why -1?因为mmap是映射到虚拟内存空间的，可能会映射到0x0
@@ -124,36 +168,40 @@ void HttpResponse::_addContent(Buffer& buf) {
     }
     _file = ret;
     close(fd);
-    buf.append("Content-length: " + std::to_string(_file_stat.st_size) + "\r\n\r\n");
+    char line[64];
+    int len = snprintf(line, sizeof line, "Content-length: %lld\r\n\r\n", static_cast<long long>(_file_stat.st_size));
+    buf.append(line, static_cast<size_t>(len));
 }
 
 void HttpResponse::_errorHtml() {
-    if (ERROR_CODE.find(_code) == ERROR_CODE.end()) {
+    auto it = ERROR_CODE.find(_code);
+    if (it == ERROR_CODE.end()) {
         return;
     }
-    _path = ERROR_CODE.at(_code);
-    stat((_src_dir + _path).c_str(), &_file_stat);
+    _path = ArenaStr(it->second.c_str(), it->second.size());
+    _file_path = _arena->concat(_src_dir, _path);
+    stat(_file_path.c_str(), &_file_stat);
 }
 
-std::string HttpResponse::_getFileType() const {
-    std::string default_type = "text/plain";
-    // auto pos = _path.rfind(".");
-    auto pos = _path.find_last_of('.');
-    if (pos == std::string::npos) {
+const std::string& HttpResponse::_getFileType() const {
+    static const std::string default_type = "text/plain";
+    const char* dot = strrchr(_path.c_str(), '.');
+    // 后缀都很短，超长的不可能匹配，也避免构造查找键时分配
+    if (dot == nullptr or _path.c_str() + _path.size() - dot > 8) {
         return default_type;
     }
-    std::string type = _path.substr(pos);
-    if (FILE_TYPE.find(type) == FILE_TYPE.end()) {
+    auto it = FILE_TYPE.find(dot);
+    if (it == FILE_TYPE.end()) {
         return default_type;
     }
-    return FILE_TYPE.at(type);
+    return it->second;
 }
 
 void HttpResponse::_errorContent(Buffer& buf, std::string message) {
     std::string body;
     std::string status = "Bad Request";
-    if (ERROR_CODE.find(_code) != ERROR_CODE.end()) {
-        status = ERROR_CODE.at(_code);
+    if (STATUS_CODE.find(_code) != STATUS_CODE.end()) {
+        status = STATUS_CODE.at(_code);
     }
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
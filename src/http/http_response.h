@@ -12,6 +12,7 @@
 #ifndef HTTP_RESPONSE_H
 #define HTTP_RESPONSE_H
 
+#include "buffer/arena.h"
 #include "buffer/buffer.h"
 
 #include <string>
@@ -24,10 +25,17 @@ public:
     HttpResponse();
     ~HttpResponse();
 
-    void init(const std::string& src_dir, const std::string& path, bool keep_alive = false, int code = -1);
+    // path和拼接出的文件路径都在arena中，响应写完之前arena不能重置
+    void init(Arena& arena, const char* src_dir, const ArenaStr& path, bool keep_alive = false, int code = -1);
     
     void makeResponse(Buffer& buf);
 
+    // 附带一个Set-Cookie头，init时清空
+    void setCookie(const std::string& cookie);
+
+    // makeResponse之后为最终的状态码
+    int getCode() const;
+
     int getFileLen() const ;
     void* getFile();
 
@@ -37,15 +45,19 @@ private:
     void _addContent(Buffer& buf);
 
     void _errorHtml();
-    std::string _getFileType() const;
-    void HttpResponse::_errorContent(Buffer& buf, std::string message);
+    const std::string& _getFileType() const;
+    void _errorContent(Buffer& buf, std::string message);
 
     void _unmapFile();
 
+    Arena* _arena;
     int _code;
     bool _keep_alive;
-    std::string _path;
-    std::string _src_dir;
+    ArenaStr _path;
+    ArenaStr _src_dir;
+    // _src_dir + _path
+    ArenaStr _file_path;
+    std::string _cookie;
 
     void* _file; // mmap file address
     struct stat _file_stat;
@@ -19,6 +19,8 @@
 #include <condition_variable>
 #include <chrono>
 
+#include "metrics/profiled_mutex.h"
+
 #include "assert.h"
 
 template<class T>
@@ -61,9 +63,9 @@ public:
 
 private:
     std::queue<T> _q;
-    std::mutex _m;
-    std::condition_variable _cond_consumer;
-    std::condition_variable _cond_producer;
+    ServerMutex _m{"block_queue"};
+    ServerCondVar _cond_consumer;
+    ServerCondVar _cond_producer;
     size_t _capacity;
     bool _is_closed;
 };
@@ -83,7 +85,7 @@ template<class T>
 void BlockQueue<T>::close() {
     // lock_guard应用RAII，作用域结束析构解锁
     {
-        std::lock_guard<std::mutex> locker(_m);
+        std::lock_guard<ServerMutex> locker(_m);
         _is_closed = true;
     }
     // 唤醒所有等待线程的最后机会！
@@ -95,12 +97,13 @@ template<class T>
 bool BlockQueue<T>::push(const T& item) {
     // lock_guard内部delete掉了拷贝和赋值构造函数，无法作为函数值传递参数传入
     // 这里使用unique_lock的真正原因是：wait函数的参数类型是unique_lock。。。
-    std::unique_lock<std::mutex> locker(_m);
+    ServerLock locker(_m);
+    // 先检查关闭标志再等待，否则关闭之后到来的调用会永远睡下去
     while (_q.size() >= _capacity) {
-        _cond_producer.wait(locker);
         if (_is_closed) {
             return false;
         }
+        _cond_producer.wait(locker);
     }
     _q.push(item);
     _cond_consumer.notify_one();
@@ -109,14 +112,15 @@ bool BlockQueue<T>::push(const T& item) {
 
 template<class T>
 bool BlockQueue<T>::pop(T& item) {
-    std::unique_lock<std::mutex> locker(_m);
+    ServerLock locker(_m);
+    // 关闭后仍把队列中剩余的元素取完
     while (_q.empty()) {
-        _cond_consumer.wait(locker);
         if (_is_closed) {
             return false;
         }
+        _cond_consumer.wait(locker);
     }
-    item = _q.top();
+    item = std::move(_q.front());
     _q.pop();
     _cond_producer.notify_one();
     return true;
@@ -124,31 +128,32 @@ bool BlockQueue<T>::pop(T& item) {
 
 template<class T>
 size_t BlockQueue<T>::size() {
-    std::lock_guard<std::mutex> locker(_m);
+    std::lock_guard<ServerMutex> locker(_m);
     return _q.size();
 }
 
 template<class T>
 size_t BlockQueue<T>::capacity() {
-    std::lock_guard<std::mutex> locker(_m);
+    std::lock_guard<ServerMutex> locker(_m);
     return _capacity;
 }
 
 template<class T>
 void BlockQueue<T>::clear() {
-    std::lock_guard<std::mutex> locker(_m);
-    return _q.clear();
+    std::lock_guard<ServerMutex> locker(_m);
+    // std::queue没有clear，和空队列交换
+    std::queue<T>().swap(_q);
 }
 
 template<class T>
 bool BlockQueue<T>::full() {
-    std::lock_guard<std::mutex> locker(_m);
+    std::lock_guard<ServerMutex> locker(_m);
     return _q.size() >= _capacity;
 }
 
 template<class T>
 bool BlockQueue<T>::empty() {
-    std::lock_guard<std::mutex> locker(_m);
+    std::lock_guard<ServerMutex> locker(_m);
     return _q.empty();
 }
 
@@ -159,17 +164,17 @@ void BlockQueue<T>::flush() {
 
 template<class T>
 bool BlockQueue<T>::popTimeout(T& item, int timeout) {
-    std::unique_lock<std::mutex> locker(_m);
+    ServerLock locker(_m);
     while (_q.empty()) {
-        if (_cond_consumer.wait_for(locker, std::chrono::milliseconds(timeout))
-                == std::cv_status::timeout) {
+        if (_is_closed) {
             return false;
         }
-        if (_is_closed) {
+        if (_cond_consumer.wait_for(locker, std::chrono::milliseconds(timeout))
+                == std::cv_status::timeout) {
             return false;
         }
     }
-    item = _q.top();
+    item = std::move(_q.front());
     _q.pop();
     _cond_producer.notify_one();
     return true;
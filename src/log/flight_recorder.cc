@@ -0,0 +1,93 @@
+/**
+ * @file flight_recorder.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-24
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "flight_recorder.h"
+
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+FlightRecorder::FlightRecorder()
+    : _header(nullptr), _base(nullptr), _slots(nullptr), _size(0), _slot_count(0) {}
+
+FlightRecorder::~FlightRecorder() {
+    if (_base != nullptr) {
+        // 正常退出时也让内核尽快写回，崩溃时靠页缓存兜底
+        msync(_base, _size, MS_ASYNC);
+        munmap(_base, _size);
+    }
+}
+
+bool FlightRecorder::open(const char* path, size_t size, int64_t anchor_steady_ns, int64_t anchor_real_ns) {
+    if (size < FLIGHT_HEADER_SIZE + DICT_SIZE + SLOT_SIZE * 64) {
+        return false;
+    }
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // 一次性把文件撑满，写入时不会再触发扩展文件的缺页
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // 映射建立后fd就可以关掉了
+    close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    _base = static_cast<char*>(p);
+    _size = size;
+    _slots = _base + FLIGHT_HEADER_SIZE + DICT_SIZE;
+    _slot_count = (size - FLIGHT_HEADER_SIZE - DICT_SIZE) / SLOT_SIZE;
+
+    FlightHeader* h = new (_base) FlightHeader;
+    memcpy(h->magic, FLIGHT_MAGIC, sizeof h->magic);
+    h->version = FLIGHT_VERSION;
+    h->slot_size = SLOT_SIZE;
+    h->slot_count = _slot_count;
+    h->dict_capacity = DICT_SIZE;
+    h->anchor_steady_ns = anchor_steady_ns;
+    h->anchor_real_ns = anchor_real_ns;
+    h->dict_used.store(0, std::memory_order_relaxed);
+    h->next_slot.store(0, std::memory_order_relaxed);
+    // 预先触碰全部页面，运行期不再有缺页
+    for (uint64_t i = 0; i < _slot_count; ++i) {
+        new (_slot(i)) FlightSlot;
+        _slot(i)->seq.store(0, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    _header = h;
+    return true;
+}
+
+void FlightRecorder::addFormat(uint32_t id, int level, const char* format) {
+    if (_header == nullptr) {
+        return;
+    }
+    uint32_t len = static_cast<uint32_t>(strlen(format));
+    uint64_t used = _header->dict_used.load(std::memory_order_relaxed);
+    size_t need = 3 * sizeof(uint32_t) + len;
+    if (used + need > DICT_SIZE) {
+        return;
+    }
+    char* p = _base + FLIGHT_HEADER_SIZE + used;
+    uint32_t lv = static_cast<uint32_t>(level);
+    memcpy(p, &id, sizeof id);
+    memcpy(p + sizeof(uint32_t), &lv, sizeof lv);
+    memcpy(p + 2 * sizeof(uint32_t), &len, sizeof len);
+    memcpy(p + 3 * sizeof(uint32_t), format, len);
+    // 字典项写完整后再发布长度
+    _header->dict_used.store(used + need, std::memory_order_release);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file flight_recorder.h
+ * @author weilai
+ * @brief 崩溃安全的黑匣子：定长的MAP_SHARED环形文件，日志以二进制记录直接写进映射内存，
+ *        没有系统调用也没有fflush。进程崩溃后页缓存仍会落盘，用tools/flight_dump解码最后的日志。
+ *        文件布局：FlightHeader(4KB) | 格式串字典(DICT_SIZE) | 槽位 * slot_count
+ * @version 0.1
+ * @date 2023-08-24
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include "log_record.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "flight recorder needs address-free 64-bit atomics");
+
+struct FlightHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t slot_count;
+    uint64_t dict_capacity;
+    int64_t anchor_steady_ns;
+    int64_t anchor_real_ns;
+    std::atomic<uint64_t> dict_used;
+    std::atomic<uint64_t> next_slot;
+};
+
+// 槽位头部：seq为0表示空或正在写入，写完最后一步才发布seq
+struct FlightSlot {
+    std::atomic<uint64_t> seq;
+    LogRecordHeader header;
+};
+
+// 字典项：uint32 id | uint32 level | uint32 len | 格式串
+const char FLIGHT_MAGIC[8] = {'W', 'S', 'F', 'L', 'I', 'G', 'H', 'T'};
+const uint32_t FLIGHT_VERSION = 1;
+const size_t FLIGHT_HEADER_SIZE = 4096;
+
+class FlightRecorder {
+public:
+    static const size_t SLOT_SIZE = 256;
+    static const size_t DICT_SIZE = 256 * 1024;
+    static const size_t PAYLOAD_SIZE = SLOT_SIZE - sizeof(FlightSlot);
+
+    FlightRecorder();
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    /**
+     * @brief 创建并映射环形文件，已存在则覆盖
+     *
+     * @param size 文件总大小，槽位数由它推算
+     */
+    bool open(const char* path, size_t size, int64_t anchor_steady_ns, int64_t anchor_real_ns);
+
+    // 调用方负责串行化（Log在登记格式串时持有_m）
+    void addFormat(uint32_t id, int level, const char* format);
+
+    // 请求线程调用：一次原子自增抢占槽位，其余全是普通的内存写
+    template<class... Args>
+    void record(uint32_t fmt_id, Args... args);
+
+private:
+    FlightSlot* _slot(uint64_t i) {
+        return reinterpret_cast<FlightSlot*>(_slots + (i % _slot_count) * SLOT_SIZE);
+    }
+
+    FlightHeader* _header;
+    char* _base;
+    char* _slots;
+    size_t _size;
+    uint64_t _slot_count;
+};
+
+template<class... Args>
+void FlightRecorder::record(uint32_t fmt_id, Args... args) {
+    if (_header == nullptr) {
+        return;
+    }
+    uint64_t i = _header->next_slot.fetch_add(1, std::memory_order_relaxed);
+    FlightSlot* slot = _slot(i);
+    slot->seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t len = logrec::encodedSize(args...);
+    char* payload = reinterpret_cast<char*>(slot) + sizeof(FlightSlot);
+    if (len <= PAYLOAD_SIZE) {
+        logrec::encodeArgs(payload, args...);
+    } else {
+        // 放不下的参数截断，解码端遇到不完整的参数会停止
+        char tmp[logrec::MAX_STRING * 4];
+        if (len <= sizeof tmp) {
+            logrec::encodeArgs(tmp, args...);
+            memcpy(payload, tmp, PAYLOAD_SIZE);
+        }
+        len = len <= sizeof tmp ? PAYLOAD_SIZE : 0;
+    }
+    slot->header.size = static_cast<uint32_t>(sizeof(LogRecordHeader) + len);
+    slot->header.fmt_id = fmt_id;
+    slot->header.ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+    slot->seq.store(i + 1, std::memory_order_release);
+}
+
+#endif // FLIGHT_RECORDER_H
@@ -4,124 +4,229 @@
  * @brief Log类初始化、格式化数据、写入等功能的具体实现
  * @version 0.1
  * @date 2023-08-05
- * 
+ *
  * @copyright Copyleft Apache 2.0
- * 
+ *
  */
 
 #include "log.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
 #include "assert.h"
-#include "sys/time.h"
-#include "stdarg.h" // va_list va_start va_end
+#include "unistd.h" // fdatasync unlink
+#include "sys/stat.h"
+#include "sys/resource.h" // setpriority
+#include "sys/syscall.h"
+#include "zlib.h"
+
+// 压缩线程每次读入的块大小
+static const size_t COMPRESS_CHUNK = 256 * 1024;
+
+// 把path压缩为path.gz，成功后删除原文件
+static bool gzipFile(const std::string& path) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (in == nullptr) {
+        return false;
+    }
+    std::string gz_path = path + ".gz";
+    // 不覆盖已有的压缩文件，宁可留着原文件不压缩
+    if (access(gz_path.c_str(), F_OK) == 0) {
+        fclose(in);
+        return false;
+    }
+    gzFile out = gzopen(gz_path.c_str(), "wb6");
+    if (out == nullptr) {
+        fclose(in);
+        return false;
+    }
+    std::unique_ptr<char[]> chunk(new char[COMPRESS_CHUNK]);
+    bool ok = true;
+    size_t n;
+    while ((n = fread(chunk.get(), 1, COMPRESS_CHUNK, in)) > 0) {
+        if (gzwrite(out, chunk.get(), static_cast<unsigned>(n)) != static_cast<int>(n)) {
+            ok = false;
+            break;
+        }
+    }
+    fclose(in);
+    if (gzclose(out) != Z_OK) {
+        ok = false;
+    }
+    if (ok) {
+        unlink(path.c_str());
+    } else {
+        unlink(gz_path.c_str());
+    }
+    return ok;
+}
+
+// 统计已有日志文件的行数，重启后续写时接着计入行数上限
+static int countLines(const char* path) {
+    FILE* in = fopen(path, "rb");
+    if (in == nullptr) {
+        return 0;
+    }
+    std::unique_ptr<char[]> chunk(new char[COMPRESS_CHUNK]);
+    int lines = 0;
+    size_t n;
+    while ((n = fread(chunk.get(), 1, COMPRESS_CHUNK, in)) > 0) {
+        lines += static_cast<int>(std::count(chunk.get(), chunk.get() + n, '\n'));
+    }
+    fclose(in);
+    return lines;
+}
+
+std::atomic<int> Log::_threshold(INT_MAX);
 
 Log& Log::instance() {
     static Log log;
     return log;
 }
 
-void Log::init(int level = 1, const char* dirname, const char* filename, int maxsize) {
-    // 队列长度大于零，说明使用了异步写入
-    if (maxsize > 0) {
-        _is_async = true;
-        _que = std::make_unique<BlockQueue<std::string>>(maxsize);
-        _write_thread = std::make_unique<std::thread>(flushLogThread);
-
-    }
-    _is_open = true;
+void Log::init(int level, const char* dirname, const char* filename, int maxsize,
+                int flush_interval_ms, int sync_interval_ms, MODE mode) {
     _level = level;
+    // 二进制记录只能由后端线程处理
+    _mode = maxsize > 0 ? mode : MODE::TEXT;
+    if (_mode == MODE::DEFERRED) {
+        _decode_buf = std::make_unique<LogBuffer>();
+    }
+    _anchor_steady_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now().time_since_epoch()).count();
+    _anchor_real_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count();
     _dirname = dirname;
     _filename = filename;
+    _flush_interval_ms = flush_interval_ms > 0 ? flush_interval_ms : 1000;
+    _sync_interval_ms = sync_interval_ms;
     // C API获取当前相对时间
-    time_t t = time(nullptr);
-    tm* now = localtime(&t);
-    auto& n = *now;
-    char path[_LOG_PATH_LEN];
-    snprintf(path, _LOG_PATH_LEN-1, "%s/%04d_%02d_%02d_%s",
-            _dirname, n.tm_year + 1900, n.tm_mon + 1, n.tm_mday, _filename);
-    _today = n.tm_mday;
-    // 打开目标文件，双检锁保证多线程只init一次?
-    // if (_fp == nullptr) 
+    tm n = LogClock::localTime(time(nullptr));
+    // 打开目标文件，必须在后端线程启动之前完成
     {
     // why lock? 多线程只能有一个线程操作_fp
-        std::lock_guard<std::mutex> locker(_m);
-        if (_fp != nullptr) {
-            flush();
-            fclose(_fp);
-        }
-        // "a" means "append"
-        _fp = fopen(path, "a");
-        assert(_fp != nullptr);
+        std::lock_guard<ServerMutex> locker(_m);
+        _openFile(n, 0);
     }
+    if (_policy.compress) {
+        _compress_que = std::make_unique<BlockQueue<std::string>>(64);
+        _compress_thread = std::make_unique<std::thread>(compressLogThread);
+    }
+    // 积压上限大于零，说明使用了异步写入
+    if (maxsize > 0) {
+        _is_async = true;
+        _is_running = true;
+        _max_pending = static_cast<size_t>(maxsize);
+        _write_thread = std::make_unique<std::thread>(flushLogThread);
+    }
+    _is_open = true;
+    _threshold.store(_level, std::memory_order_relaxed);
+}
+
+void Log::setRotatePolicy(const LogRotatePolicy& policy) {
+    assert(!_is_open);
+    _policy = policy;
 }
 
 void Log::write(int level, const char* format, ...) {
+    AllocScope scope(AllocStats::LOG);
     // gettimeofday获取到微秒级的时间，用于具体日志信息时间记录
+    // 日期部分由LogClock按秒缓存，不再每条日志调用localtime
     timeval t = {0, 0};
     gettimeofday(&t, nullptr);
-    time_t sec = t.tv_sec;
-    tm* now = localtime(&sec);
-    auto& n = *now;
+
+    ThreadBuffer& tb = _threadBuffer();
+    std::lock_guard<std::mutex> locker(tb.m);
+    if (tb.cur->avail() < _MIN_LINE_SPACE) {
+        _handOff(tb);
+    }
+
     va_list valist;
+    va_start(valist, format);
+    va_list retry;
+    va_copy(retry, valist);
+    size_t len = _formatLine(tb.cur->current(), tb.cur->avail(), t, level, format, valist);
+    if (len > tb.cur->avail() and !tb.cur->empty()) {
+        // 剩余空间放不下这一行，换一块空缓冲区重新格式化
+        _handOff(tb);
+        len = _formatLine(tb.cur->current(), tb.cur->avail(), t, level, format, retry);
+    }
+    va_end(retry);
+    va_end(valist);
+    if (len > tb.cur->avail()) {
+        // 单行比整块缓冲区还大，截断
+        len = tb.cur->avail();
+        tb.cur->current()[len - 1] = '\n';
+    }
+    tb.cur->add(len);
 
-    // 处理日志日期变动和当前日志写满的情况
-    if (n.tm_mday != _today or (_line_count != 0 and (_line_count % _MAX_LINES == 0))) {
-        char newpath[_LOG_PATH_LEN];
-        char tail[16];
-        snprintf(tail, 16, "%04d_%02d_%02d", n.tm_year + 1900, n.tm_mon + 1, n.tm_mday);
-        if (n.tm_mday != _today) {
-            snprintf(newpath, _LOG_PATH_LEN - 1, "%s/%s%s", _dirname, tail, _filename);
-            _today = n.tm_mday;
-            _line_count = 0;
-        } else {
-            // 加后缀 -1,-2,-3,...
-            snprintf(newpath, _LOG_PATH_LEN - 1, "%s/%s%s-%d", _dirname, tail, _filename, (_line_count / _MAX_LINES));
-        }
+    // 同步：直接写入文件
+    if (!_is_async) {
+        std::lock_guard<ServerMutex> locker(_m);
+        // 滚动检查复用本线程缓存的日期
+        _writeBuffer(*tb.cur, LogClock::localTime(t.tv_sec));
+        tb.cur->reset();
+    }
+}
 
-        {
-            std::lock_guard<std::mutex> locker(_m);
-            flush();
-            fclose(_fp);
-            _fp = fopen(newpath, "a");
-            assert(_fp != nullptr);
-        }
+uint32_t Log::registerFormat(int level, const char* format) {
+    std::lock_guard<ServerMutex> locker(_m);
+    uint32_t count = _format_count.load(std::memory_order_relaxed);
+    if (count >= _MAX_FORMATS) {
+        // 返回一个永远不会登记的编号，这类记录在解码时被丢弃
+        return LOG_RECORD_FIRST_ID + _MAX_FORMATS;
     }
-    // 写入单条日志
-    {
-        std::lock_guard<std::mutex> locker(_m);
-        ++_line_count;
-
-        // 写入日期
-        int slen = snprintf(_buf.getWritePos(), 48, "%04d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    n.tm_year + 1900, n.tm_mon + 1, n.tm_mday, n.tm_hour,
-                    n.tm_min, n.tm_sec, t.tv_usec);
-        _buf.hasWritten(slen);
-        
-        // 写入日志等级
-        _appendLogLevelTitle(level);
-        
-        // 从...读出参数到valist，根据format指定的格式写入_buf
-        va_start(valist, format);
-        int vlen = vsnprintf(_buf.getWritePos(), _buf.getWritableBytes(), format, valist);
-        va_end(valist); // 结束读出
-        _buf.hasWritten(vlen);
-        _buf.append("\n\0");
-
-        // 异步：加入队列 同步：直接写入
-        if (_is_async and _que != nullptr and !_que->full()) {
-            _que->push(_buf.retrieveAllTOString());
-        } else {
-            fputs(_buf.getReadPos(), _fp);
-        }
-        _buf.retrieveAll();
-    } 
+    _formats[count].level = level;
+    _formats[count].format = format;
+    _format_count.store(count + 1, std::memory_order_release);
+    if (_recorder != nullptr) {
+        _recorder->addFormat(LOG_RECORD_FIRST_ID + count, level, format);
+    }
+    return LOG_RECORD_FIRST_ID + count;
+}
+
+bool Log::enableFlightRecorder(const char* path, size_t size) {
+    auto recorder = std::make_unique<FlightRecorder>();
+    if (!recorder->open(path, size, _anchor_steady_ns, _anchor_real_ns)) {
+        return false;
+    }
+    std::lock_guard<ServerMutex> locker(_m);
+    // 补登之前已经登记过的格式串
+    uint32_t count = _format_count.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < count; ++i) {
+        recorder->addFormat(LOG_RECORD_FIRST_ID + i, _formats[i].level, _formats[i].format);
+    }
+    _recorder = std::move(recorder);
+    return true;
+}
+
+bool Log::isDeferred() const {
+    return _mode != MODE::TEXT;
+}
+
+bool Log::usesFormatId() const {
+    return _mode != MODE::TEXT or _recorder != nullptr;
 }
 
 void Log::flush() {
     if (_is_async) {
-        _que->flush();
+        // 把当前线程的缓冲区交给后端，由后端统一写入
+        ThreadBuffer& tb = _threadBuffer();
+        {
+            std::lock_guard<std::mutex> locker(tb.m);
+            if (!tb.cur->empty()) {
+                _handOff(tb);
+            }
+        }
+        _cond.notify_one();
+        return;
+    }
+    std::lock_guard<ServerMutex> locker(_m);
+    if (_fp != nullptr) {
+        fflush(_fp);
     }
-    fflush(_fp);
 }
 
 // get set isopen等方法是否需要加锁？
@@ -130,58 +235,457 @@ int Log::getLevel() const {
 }
 
 void Log::setLevel(int level) {
-    std::lock_guard<std::mutex> locker(_m);
+    std::lock_guard<ServerMutex> locker(_m);
     _level = level;
+    if (_is_open) {
+        _threshold.store(level, std::memory_order_relaxed);
+    }
 }
 
 bool Log::isOpen() const {
     return _is_open;
 }
 
+size_t Log::getDroppedLines() const {
+    return _dropped_lines.load(std::memory_order_relaxed);
+}
+
+size_t Log::getPendingBuffers() {
+    std::lock_guard<ServerMutex> locker(_m);
+    return _full_bufs.size();
+}
+
 void Log::flushLogThread() {
     Log::instance()._asyncWrite();
 }
 
+void Log::compressLogThread() {
+    Log::instance()._compressFiles();
+}
+
 // private methods
 Log::Log()
-    : _line_count(0), _today(0), _is_open(false), 
-    _level(0), _is_async(false), _que(nullptr),
-    _write_thread(nullptr), _fp(nullptr) {}
+    : _policy{LogRotatePolicy::DAILY, 50000, 0, false},
+    _line_count(0), _file_bytes(0), _period_key(-1), _file_index(0),
+    _next_fp(nullptr), _next_key(-1), _is_open(false),
+    _level(0), _is_async(false), _is_running(false), _mode(MODE::TEXT),
+    _max_pending(0), _flush_interval_ms(1000), _sync_interval_ms(3000),
+    _dropped_lines(0), _format_count(0), _dict_written(0),
+    _anchor_steady_ns(0), _anchor_real_ns(0), _decode_buf(nullptr), _recorder(nullptr),
+    _fp(nullptr), _write_thread(nullptr), _compress_que(nullptr),
+    _compress_thread(nullptr) {}
 
 Log::~Log() {
+    // 先关掉宏入口，析构期间的日志直接丢弃
+    _threshold.store(INT_MAX, std::memory_order_relaxed);
     if (_write_thread != nullptr && _write_thread->joinable()) {
-        while (!_que->empty()) {
-            _que->flush();
+        {
+            std::lock_guard<ServerMutex> locker(_m);
+            _is_running = false;
         }
-        _que->close();
+        _cond.notify_one();
         _write_thread->join();
     }
-    if (_fp != nullptr) {
-        std::lock_guard<std::mutex> locker(_m);
+    {
+        std::lock_guard<ServerMutex> locker(_m);
+        _discardNext();
         if (_fp != nullptr) {
-            flush();
+            fflush(_fp);
             fclose(_fp);
+            _fp = nullptr;
         }
     }
+    // 等待已滚动的文件压缩完
+    if (_compress_thread != nullptr && _compress_thread->joinable()) {
+        _compress_que->close();
+        _compress_thread->join();
+    }
+}
+
+/**
+ * @brief 在p处格式化一整行日志
+ *
+ * @return 完整一行需要的字节数（含换行），大于avail说明被截断，由调用方处理
+ */
+size_t Log::_formatLine(char* p, size_t avail, const timeval& t,
+                        int level, const char* format, va_list valist) {
+    // 调用方保证avail >= _MIN_LINE_SPACE，日期和等级一定放得下
+    size_t slen = LogClock::formatPrefix(p, t);
+    const char* title = logrec::levelTitle(level);
+    size_t tlen = strlen(title);
+    memcpy(p + slen, title, tlen);
+    slen += tlen;
+    // 从...读出参数到valist，根据format指定的格式写入缓冲区
+    int vlen = vsnprintf(p + slen, avail - slen, format, valist);
+    if (vlen < 0) {
+        vlen = 0;
+    }
+    size_t len = static_cast<size_t>(slen) + vlen + 1;
+    if (len <= avail) {
+        p[len - 1] = '\n';
+    }
+    return len;
+}
+
+Log::ThreadBuffer& Log::_threadBuffer() {
+    // 缓冲区归Log所有，线程退出后残留的内容仍会被后端定期收走
+    thread_local ThreadBuffer* tb = nullptr;
+    if (tb == nullptr) {
+        auto owned = std::make_unique<ThreadBuffer>();
+        owned->cur = _takeFreeBuffer();
+        tb = owned.get();
+        std::lock_guard<ServerMutex> locker(_m);
+        _thread_bufs.push_back(std::move(owned));
+    }
+    return *tb;
 }
 
-void Log::_appendLogLevelTitle(int level) {
-    std::string title = [&]() {
-        switch (level) {
-            case 0: return "[DEBUG]: ";
-            case 1: return "[INFO] : ";
-            case 2: return "[WARN] : ";
-            case 3: return "[ERROR]: ";
-            default: return "[INFO] : ";
+// 调用方持有tb.m，加锁顺序固定为 tb.m -> _m
+void Log::_handOff(ThreadBuffer& tb) {
+    if (!_is_async) {
+        std::lock_guard<ServerMutex> locker(_m);
+        _writeBuffer(*tb.cur, LogClock::localTime(time(nullptr)));
+        tb.cur->reset();
+        return;
+    }
+    {
+        std::lock_guard<ServerMutex> locker(_m);
+        if (_full_bufs.size() >= _max_pending) {
+            // 后端跟不上，丢弃这一块而不是阻塞请求线程
+            _dropped_lines.fetch_add(tb.cur->lines(), std::memory_order_relaxed);
+            tb.cur->reset();
+            return;
+        }
+        _full_bufs.push_back(std::move(tb.cur));
+    }
+    _cond.notify_one();
+    tb.cur = _takeFreeBuffer();
+}
+
+std::unique_ptr<LogBuffer> Log::_takeFreeBuffer() {
+    {
+        std::lock_guard<ServerMutex> locker(_m);
+        if (!_free_bufs.empty()) {
+            auto buf = std::move(_free_bufs.back());
+            _free_bufs.pop_back();
+            return buf;
+        }
+    }
+    return std::make_unique<LogBuffer>();
+}
+
+// 后端调用：收走各线程未写满的缓冲区，保证低频日志也能按周期落盘
+void Log::_collectThreadBuffers(std::vector<std::unique_ptr<LogBuffer>>& out) {
+    std::vector<ThreadBuffer*> tbs;
+    {
+        std::lock_guard<ServerMutex> locker(_m);
+        for (auto& tb : _thread_bufs) {
+            tbs.push_back(tb.get());
+        }
+    }
+    for (ThreadBuffer* tb : tbs) {
+        std::lock_guard<std::mutex> locker(tb->m);
+        if (tb->cur->empty()) {
+            continue;
+        }
+        auto spare = _takeFreeBuffer();
+        std::swap(spare, tb->cur);
+        out.push_back(std::move(spare));
+    }
+}
+
+int Log::_periodKey(const tm& n) const {
+    if (_policy.period == LogRotatePolicy::HOURLY) {
+        return n.tm_yday * 24 + n.tm_hour;
+    }
+    return n.tm_yday;
+}
+
+void Log::_makePath(char* path, const tm& n, int index) const {
+    const char* ext = _mode == MODE::BINARY ? ".bin" : "";
+    int len = snprintf(path, _LOG_PATH_LEN - 1, "%s/%04d_%02d_%02d",
+                _dirname, n.tm_year + 1900, n.tm_mon + 1, n.tm_mday);
+    if (_policy.period == LogRotatePolicy::HOURLY) {
+        len += snprintf(path + len, _LOG_PATH_LEN - 1 - len, "_%02d", n.tm_hour);
+    }
+    if (index == 0) {
+        snprintf(path + len, _LOG_PATH_LEN - 1 - len, "%s%s", _filename, ext);
+    } else {
+        // 加后缀 -1,-2,-3,...
+        snprintf(path + len, _LOG_PATH_LEN - 1 - len, "%s-%d%s", _filename, index, ext);
+    }
+}
+
+int Log::_resumeIndex(const tm& n) const {
+    // 编号从0起连续使用，找到第一个既没有原文件也没有.gz的编号
+    char path[_LOG_PATH_LEN];
+    int index = 0;
+    bool plain = false;
+    while (true) {
+        _makePath(path, n, index);
+        bool exists = access(path, F_OK) == 0;
+        if (!exists and access((std::string(path) + ".gz").c_str(), F_OK) != 0) {
+            break;
         }
-    }();
-    _buf.append(title);
+        plain = exists;
+        ++index;
+    }
+    // 最后一个还没压缩，说明是上次运行正在写的文件，接着写
+    return index > 0 and plain ? index - 1 : index;
+}
+
+// 调用方需独占_fp：异步模式为后端线程，同步模式为持有_m者
+void Log::_openFile(const tm& n, int index) {
+    int key = _periodKey(n);
+    _closeFile();
+    int line_count = 0;
+    if (_next_fp != nullptr and _next_key == key and index == _file_index + 1) {
+        // 提前打开的文件正好是下一个，直接切换
+        _fp = _next_fp;
+        _cur_path.swap(_next_path);
+        _next_fp = nullptr;
+        _next_key = -1;
+        _file_bytes = 0;
+    } else {
+        _discardNext();
+        // 新周期的第一个文件：重启后同名文件可能已经存在或已压缩，接在它们后面，不覆盖
+        if (index == 0) {
+            index = _resumeIndex(n);
+        }
+        char path[_LOG_PATH_LEN];
+        _makePath(path, n, index);
+        // "a" means "append"
+        _fp = fopen(path, "a");
+        if (_fp == nullptr) {
+            // 首次运行日志目录可能还不存在
+            mkdir(_dirname, 0777);
+            _fp = fopen(path, "a");
+        }
+        assert(_fp != nullptr);
+        _cur_path = path;
+        // 重启后续写同一个文件，按已有大小和行数计算；二进制文件按记录计数，续写时从0算起
+        struct stat st;
+        _file_bytes = fstat(fileno(_fp), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+        if (_file_bytes > 0 and _mode != MODE::BINARY) {
+            line_count = countLines(path);
+        }
+    }
+    _period_key = key;
+    _file_index = index;
+    _line_count = line_count;
+
+    if (_mode == MODE::BINARY) {
+        // 每个二进制文件以时间锚点开头，字典在写入记录前重新补齐，保证单个文件可独立解码
+        char rec[sizeof(LogRecordHeader) + 2 * sizeof(int64_t)];
+        LogRecordHeader header{sizeof rec, LOG_RECORD_ANCHOR, 0};
+        memcpy(rec, &header, sizeof header);
+        memcpy(rec + sizeof header, &_anchor_steady_ns, sizeof(int64_t));
+        memcpy(rec + sizeof header + sizeof(int64_t), &_anchor_real_ns, sizeof(int64_t));
+        _put(rec, sizeof rec);
+        _dict_written = 0;
+    }
+}
+
+// 当前文件用掉3/4时打开下一个编号的文件，真正滚动时不再等待open
+void Log::_preopenNext(const tm& n) {
+    if (_next_fp != nullptr) {
+        return;
+    }
+    bool near_lines = _policy.max_lines > 0 and _line_count >= _policy.max_lines / 4 * 3;
+    bool near_bytes = _policy.max_bytes > 0 and _file_bytes >= _policy.max_bytes / 4 * 3;
+    if (!near_lines and !near_bytes) {
+        return;
+    }
+    char path[_LOG_PATH_LEN];
+    _makePath(path, n, _file_index + 1);
+    _next_fp = fopen(path, "a");
+    if (_next_fp != nullptr) {
+        _next_path = path;
+        _next_key = _period_key;
+    }
+}
+
+// 时间滚动时提前打开的文件用不上了，没写过内容就删掉
+void Log::_discardNext() {
+    if (_next_fp == nullptr) {
+        return;
+    }
+    bool empty = ftell(_next_fp) == 0;
+    fclose(_next_fp);
+    if (empty) {
+        unlink(_next_path.c_str());
+    }
+    _next_fp = nullptr;
+    _next_key = -1;
+    _next_path.clear();
+}
+
+void Log::_closeFile() {
+    if (_fp == nullptr) {
+        return;
+    }
+    fflush(_fp);
+    fclose(_fp);
+    _fp = nullptr;
+    // 压缩队列满了就放弃压缩，不能让写日志的线程等
+    if (_compress_que != nullptr and !_cur_path.empty() and !_compress_que->full()) {
+        _compress_que->push(_cur_path);
+    }
+    _cur_path.clear();
+}
+
+void Log::_put(const void* data, size_t len) {
+    fwrite(data, 1, len, _fp);
+    _file_bytes += len;
+}
+
+void Log::_writeBuffer(const LogBuffer& buf, const tm& n) {
+    // 处理时间周期变动和当前日志写满的情况
+    if (_periodKey(n) != _period_key) {
+        _openFile(n, 0);
+    } else if ((_policy.max_lines > 0 and _line_count > 0
+                    and _line_count + buf.lines() > _policy.max_lines)
+                or (_policy.max_bytes > 0 and _file_bytes > 0
+                    and _file_bytes + buf.length() > _policy.max_bytes)) {
+        _openFile(n, _file_index + 1);
+    }
+    _line_count += buf.lines();
+    switch (_mode) {
+        case MODE::DEFERRED:
+            _writeRecords(buf);
+            break;
+        case MODE::BINARY:
+            _writeDictionary();
+            _put(buf.data(), buf.length());
+            break;
+        default:
+            _put(buf.data(), buf.length());
+            break;
+    }
+    _preopenNext(n);
+}
+
+// 后端解码：把二进制记录还原成文本行，攒满一块再写入
+void Log::_writeRecords(const LogBuffer& buf) {
+    LogBuffer& out = *_decode_buf;
+    uint32_t count = _format_count.load(std::memory_order_acquire);
+    const char* p = buf.data();
+    const char* end = p + buf.length();
+    while (p + sizeof(LogRecordHeader) <= end) {
+        LogRecordHeader header;
+        memcpy(&header, p, sizeof header);
+        if (header.size < sizeof header or p + header.size > end) {
+            break;
+        }
+        const char* args = p + sizeof header;
+        const char* next = p + header.size;
+        p = next;
+        uint32_t i = header.fmt_id - LOG_RECORD_FIRST_ID;
+        if (header.fmt_id < LOG_RECORD_FIRST_ID or i >= count) {
+            continue;
+        }
+        if (out.avail() < _DECODE_LINE_SPACE) {
+            _put(out.data(), out.length());
+            out.reset();
+        }
+        size_t len = logrec::formatLine(out.current(), out.avail(), _formats[i].level,
+                        _formats[i].format, args, next, _toWallTime(header.ts));
+        out.add(len);
+    }
+    if (!out.empty()) {
+        _put(out.data(), out.length());
+        out.reset();
+    }
+}
+
+// 把新登记的格式串以字典记录的形式补写到当前文件
+void Log::_writeDictionary() {
+    uint32_t count = _format_count.load(std::memory_order_acquire);
+    for (; _dict_written < count; ++_dict_written) {
+        const LogFormat& f = _formats[_dict_written];
+        uint32_t id = LOG_RECORD_FIRST_ID + _dict_written;
+        uint32_t level = static_cast<uint32_t>(f.level);
+        size_t flen = strlen(f.format);
+        LogRecordHeader header;
+        header.size = static_cast<uint32_t>(sizeof header + 2 * sizeof(uint32_t) + flen);
+        header.fmt_id = LOG_RECORD_DICT;
+        header.ts = 0;
+        _put(&header, sizeof header);
+        _put(&id, sizeof id);
+        _put(&level, sizeof level);
+        _put(f.format, flen);
+    }
+}
+
+timeval Log::_toWallTime(int64_t steady_ns) const {
+    int64_t ns = _anchor_real_ns + (steady_ns - _anchor_steady_ns);
+    timeval tv;
+    tv.tv_sec = static_cast<time_t>(ns / 1000000000);
+    tv.tv_usec = static_cast<suseconds_t>(ns % 1000000000 / 1000);
+    return tv;
 }
 
 void Log::_asyncWrite() {
-    std::string str;
-    while (_que->pop(str)) {
-        std::lock_guard<std::mutex> locker(_m);
-        fputs(str.data(), _fp);
+    using std::chrono::steady_clock;
+    const auto flush_interval = std::chrono::milliseconds(_flush_interval_ms);
+    const auto sync_interval = std::chrono::milliseconds(_sync_interval_ms);
+    auto last_collect = steady_clock::now();
+    auto last_sync = last_collect;
+    // 已fflush但还没fdatasync的数据
+    bool dirty = false;
+    std::vector<std::unique_ptr<LogBuffer>> writing;
+    bool running = true;
+    while (running) {
+        {
+            ServerLock locker(_m);
+            if (_full_bufs.empty() and _is_running) {
+                _cond.wait_for(locker, flush_interval);
+            }
+            writing.swap(_full_bufs);
+            running = _is_running;
+        }
+        auto now = steady_clock::now();
+        if (!running or now - last_collect >= flush_interval) {
+            _collectThreadBuffers(writing);
+            last_collect = now;
+        }
+        if (!writing.empty()) {
+            // 一批缓冲区只取一次时间，整块顺序写入，最后统一fflush
+            tm n = LogClock::localTime(time(nullptr));
+            for (auto& buf : writing) {
+                _writeBuffer(*buf, n);
+            }
+            fflush(_fp);
+            dirty = true;
+        }
+        // 没有新日志时也要检查：最后一批没赶上同步周期的数据，到期后照样落盘
+        if (dirty and (!running or now - last_sync >= sync_interval)) {
+            fdatasync(fileno(_fp));
+            last_sync = now;
+            dirty = false;
+        }
+        if (writing.empty()) {
+            continue;
+        }
+
+        // 归还缓冲区，多余的直接释放
+        std::lock_guard<ServerMutex> locker(_m);
+        for (auto& buf : writing) {
+            if (_free_bufs.size() >= _MAX_FREE_BUFS) {
+                break;
+            }
+            buf->reset();
+            _free_bufs.push_back(std::move(buf));
+        }
+        writing.clear();
     }
-}
\ No newline at end of file
+}
+
+void Log::_compressFiles() {
+    // 压缩只是锦上添花，降到最低优先级，不和请求线程抢CPU
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+    std::string path;
+    while (_compress_que->pop(path)) {
+        gzipFile(path);
+    }
+}
@@ -1,12 +1,12 @@
 /**
  * @file log.h
  * @author weilai
- * @brief 
+ * @brief
  * @version 0.1
  * @date 2023-08-03
- * 
+ *
  * @copyright Copyleft Apache 2.0
- * 
+ *
  */
 
 #ifndef LOG_H
@@ -15,36 +15,154 @@
 #include <string>
 #include <thread>
 #include <mutex>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <climits>
 
 #include "block_queue.hpp"
-#include "buffer/buffer.h"
+#include "log_buffer.hpp"
+#include "log_record.h"
+#include "log_clock.h"
+#include "flight_recorder.h"
+#include "metrics/alloc_stats.h"
+#include "metrics/profiled_mutex.h"
+
+#include "sys/time.h"
+#include "time.h"
+#include "stdarg.h"
+
+// 日志滚动策略，按时间和按大小可同时生效
+struct LogRotatePolicy {
+    enum PERIOD {
+        DAILY,
+        HOURLY
+    };
+    PERIOD period;
+    int max_lines;     // 单文件行数上限，0表示不限
+    size_t max_bytes;  // 单文件字节数上限，0表示不限
+    bool compress;     // 滚动出去的文件在低优先级线程中gzip压缩
+};
 
 class Log {
+public:
+    // TEXT: 请求线程格式化文本
+    // DEFERRED: 请求线程只写二进制记录，后端线程格式化成文本
+    // BINARY: 二进制记录原样落盘（.bin），用tools/log_decode离线解码
+    enum class MODE {
+        TEXT,
+        DEFERRED,
+        BINARY
+    };
+
 public:
     /**
      * @brief Singleton Lazy create Log object
-     * 
-     * @return Log& 
+     *
+     * @return Log&
      */
     static Log& instance();
-    
-    void init(int level = 1, const char* dirname = "./log", 
-                const char* filename = ".log", int maxsize = 1024);
-    
+
+    /**
+     * @param maxsize 异步模式下最多积压的满缓冲区个数，<=0表示同步写入
+     * @param flush_interval_ms 后端收集各线程未写满缓冲区的周期
+     * @param sync_interval_ms fdatasync落盘周期，决定宕机时最多丢失多久的日志
+     * @param mode 二进制模式依赖后端线程，同步写入时退化为TEXT
+     */
+    void init(int level = 1, const char* dirname = "./log",
+                const char* filename = ".log", int maxsize = 16,
+                int flush_interval_ms = 1000, int sync_interval_ms = 3000,
+                MODE mode = MODE::TEXT);
+
+    // 需在init之前调用
+    void setRotatePolicy(const LogRotatePolicy& policy);
+
     void write(int level, const char* format, ...);
+
+    /**
+     * @brief 登记一个调用点的格式串，format必须是静态生命周期的字符串字面量
+     *
+     * @return 格式串编号，写入二进制记录时使用
+     */
+    uint32_t registerFormat(int level, const char* format);
+
+    // 热路径只拷贝编号、时间戳和原始参数，不做任何格式化
+    template<class... Args>
+    void writeRecord(uint32_t fmt_id, Args... args);
+
+    // 已登记格式串的调用点入口：同时写黑匣子和常规日志
+    template<class... Args>
+    void writeFormatted(uint32_t fmt_id, int level, const char* format, Args... args);
+
+    /**
+     * @brief 打开黑匣子环形文件，需在init之后、其他线程开始写日志之前调用
+     *
+     * @param size 文件大小，决定能保留多少条最近的日志
+     */
+    bool enableFlightRecorder(const char* path, size_t size = 64 * 1024 * 1024);
+
+    bool isDeferred() const;
+    // 是否需要调用点登记格式串：二进制模式或开启了黑匣子
+    bool usesFormatId() const;
     void flush();
 
     int getLevel() const;
     void setLevel(int level);
     bool isOpen() const;
 
-    void flushLogThread();
+    // 宏里的第一道判断：不构造单例，只读一个原子量
+    static bool isEnabled(int level) {
+        return level >= _threshold.load(std::memory_order_relaxed);
+    }
+
+    // 因缓冲区积压被丢弃的日志行数
+    size_t getDroppedLines() const;
+
+    // 等待后端写出的满缓冲区个数
+    size_t getPendingBuffers();
+
+    static void flushLogThread();
+    static void compressLogThread();
 
 private:
+    // 每个线程独占一块前端缓冲区，m只在交换缓冲区时与后端竞争
+    struct ThreadBuffer {
+        std::mutex m;
+        std::unique_ptr<LogBuffer> cur;
+    };
+
+    struct LogFormat {
+        int level;
+        const char* format;
+    };
+
     Log();
     virtual ~Log();
-    void _appendLogLevelTitle(int level);
+    size_t _formatLine(char* p, size_t avail, const timeval& t,
+                        int level, const char* format, va_list valist);
+
+    ThreadBuffer& _threadBuffer();
+    void _handOff(ThreadBuffer& tb);
+    std::unique_ptr<LogBuffer> _takeFreeBuffer();
+    void _collectThreadBuffers(std::vector<std::unique_ptr<LogBuffer>>& out);
+
+    int _periodKey(const tm& n) const;
+    void _makePath(char* path, const tm& n, int index) const;
+    void _openFile(const tm& n, int index);
+    // 本周期内还没用过的编号：已有文件（含压缩后的.gz）之后的下一个，最后一个未压缩时续写它
+    int _resumeIndex(const tm& n) const;
+    void _preopenNext(const tm& n);
+    void _discardNext();
+    void _closeFile();
+    void _put(const void* data, size_t len);
+    void _writeBuffer(const LogBuffer& buf, const tm& n);
+    void _writeRecords(const LogBuffer& buf);
+    void _writeDictionary();
+    timeval _toWallTime(int64_t steady_ns) const;
     void _asyncWrite();
+    void _compressFiles();
 
 private:
     // 为什么用const char*而不用const string？
@@ -53,36 +171,189 @@ private:
     const char* _dirname;
     const char* _filename;
 
-    const int _MAX_LINES = 50000;
-    const int _LOG_PATH_LEN = 256;
+    static const int _LOG_PATH_LEN = 256;
+    // 单行日志预留空间，不足时先换缓冲区再格式化
+    const size_t _MIN_LINE_SPACE = 1024;
+    // 空闲缓冲区最多缓存的块数，多余的直接释放
+    const size_t _MAX_FREE_BUFS = 8;
+    // 后端解码一条记录预留的空间
+    const size_t _DECODE_LINE_SPACE = 4096;
+    // 最多登记的调用点个数，定长数组保证后端无锁读取
+    static const uint32_t _MAX_FORMATS = 4096;
 
+    LogRotatePolicy _policy;
+    // 以下文件状态只由持有文件的线程访问（异步为后端线程，同步为持有_m者）
     int _line_count;
-    int _today;
+    size_t _file_bytes;
+    int _period_key;
+    int _file_index;
+    std::string _cur_path;
+    // 接近大小上限时提前打开的下一个文件，滚动时直接切换
+    FILE* _next_fp;
+    std::string _next_path;
+    int _next_key;
 
     bool _is_open;
     int _level;
     bool _is_async;
+    bool _is_running;
+    MODE _mode;
+
+    size_t _max_pending;
+    int _flush_interval_ms;
+    int _sync_interval_ms;
+    std::atomic<size_t> _dropped_lines;
+
+    // 格式串字典，登记时持有_m，读取只依赖_format_count的acquire
+    LogFormat _formats[_MAX_FORMATS];
+    std::atomic<uint32_t> _format_count;
+    // 当前二进制文件中已写入的字典项个数，换文件时清零
+    uint32_t _dict_written;
+    // 时间锚点：init时同时取单调时间和墙上时间
+    int64_t _anchor_steady_ns;
+    int64_t _anchor_real_ns;
+    std::unique_ptr<LogBuffer> _decode_buf;
+    std::unique_ptr<FlightRecorder> _recorder;
 
-    Buffer _buf;
     FILE* _fp;
-    std::unique_ptr<BlockQueue<std::string>> _que;
+    std::vector<std::unique_ptr<ThreadBuffer>> _thread_bufs;
+    std::vector<std::unique_ptr<LogBuffer>> _full_bufs;
+    std::vector<std::unique_ptr<LogBuffer>> _free_bufs;
     std::unique_ptr<std::thread> _write_thread;
-    std::mutex _m;
+    std::unique_ptr<BlockQueue<std::string>> _compress_que;
+    std::unique_ptr<std::thread> _compress_thread;
+    ServerCondVar _cond;
+    ServerMutex _m{"log"};
+
+    // 未打开时为INT_MAX，打开后等于_level
+    static std::atomic<int> _threshold;
+};
+
+template<class... Args>
+void Log::writeFormatted(uint32_t fmt_id, int level, const char* format, Args... args) {
+    if (_recorder != nullptr) {
+        _recorder->record(fmt_id, args...);
+    }
+    if (_mode == MODE::TEXT) {
+        write(level, format, args...);
+    } else {
+        writeRecord(fmt_id, args...);
+    }
+}
+
+// 按秒限流：每个调用点每秒最多放行k次
+class LogRateLimiter {
+public:
+    explicit LogRateLimiter(int k): _k(k), _sec(0), _count(0) {}
+
+    bool allow() {
+        timespec ts;
+        // COARSE时钟走vDSO且不读硬件计数器，精度到毫秒级足够
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        int64_t sec = ts.tv_sec;
+        int64_t old = _sec.load(std::memory_order_relaxed);
+        if (sec != old and _sec.compare_exchange_strong(old, sec, std::memory_order_relaxed)) {
+            _count.store(0, std::memory_order_relaxed);
+        }
+        return _count.fetch_add(1, std::memory_order_relaxed) < _k;
+    }
+
+private:
+    const int _k;
+    std::atomic<int64_t> _sec;
+    std::atomic<int> _count;
 };
 
+template<class... Args>
+void Log::writeRecord(uint32_t fmt_id, Args... args) {
+    AllocScope scope(AllocStats::LOG);
+    size_t len = sizeof(LogRecordHeader) + logrec::encodedSize(args...);
+    LogRecordHeader header;
+    header.size = static_cast<uint32_t>(len);
+    header.fmt_id = fmt_id;
+    header.ts = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    ThreadBuffer& tb = _threadBuffer();
+    std::lock_guard<std::mutex> locker(tb.m);
+    if (tb.cur->avail() < len) {
+        _handOff(tb);
+    }
+    char* p = tb.cur->current();
+    memcpy(p, &header, sizeof header);
+    logrec::encodeArgs(p + sizeof header, args...);
+    tb.cur->add(len);
+}
+
 // 可变参数宏提供写日志接口，优先级更高的日志会被写入
+// 不再逐条flush，由后端线程批量写入并按周期落盘
+// 二进制模式或开启黑匣子时，每个调用点只在第一次执行时登记格式串
 #define LOG_BASE(level, format, ...) \
     do { \
-        Log& log = Log::instance(); \
-        if (log.isOpen() and log.getLevel() <= level) { \
-            log.write(level, format, ##__VA_ARGS__); \
-            log.flush(); \
+        if (Log::isEnabled(level)) { \
+            Log& log = Log::instance(); \
+            if (log.usesFormatId()) { \
+                static const uint32_t _log_fmt_id = log.registerFormat(level, format); \
+                log.writeFormatted(_log_fmt_id, level, format, ##__VA_ARGS__); \
+            } else { \
+                log.write(level, format, ##__VA_ARGS__); \
+            } \
         } \
     } while(0); // 注意这里的分号
+// 采样：每个调用点每n次只记录1次
+#define LOG_BASE_EVERY_N(level, n, format, ...) \
+    do { \
+        static std::atomic<unsigned> _log_occurrences(0); \
+        if (Log::isEnabled(level) and \
+                _log_occurrences.fetch_add(1, std::memory_order_relaxed) % (n) == 0) { \
+            LOG_BASE(level, format, ##__VA_ARGS__) \
+        } \
+    } while(0);
+// 限流：每个调用点每秒最多记录k次
+#define LOG_BASE_RATE(level, k, format, ...) \
+    do { \
+        static LogRateLimiter _log_limiter(k); \
+        if (Log::isEnabled(level) and _log_limiter.allow()) { \
+            LOG_BASE(level, format, ##__VA_ARGS__) \
+        } \
+    } while(0);
+
+// 编译期最低日志等级，低于它的调用点在预处理阶段整个删除，例如 -DLOG_MIN_LEVEL=1 去掉全部DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 // 日志分级，注意结尾的分号，宏替换时是不做语法检查的
+#if LOG_MIN_LEVEL <= 0
 #define LOG_DEBUG(format, ...) do { LOG_BASE(0, format, ##__VA_ARGS__) } while(0);
+#define LOG_DEBUG_EVERY_N(n, format, ...) do { LOG_BASE_EVERY_N(0, n, format, ##__VA_ARGS__) } while(0);
+#define LOG_DEBUG_RATE(k, format, ...) do { LOG_BASE_RATE(0, k, format, ##__VA_ARGS__) } while(0);
+#else
+#define LOG_DEBUG(format, ...) do {} while(0);
+#define LOG_DEBUG_EVERY_N(n, format, ...) do {} while(0);
+#define LOG_DEBUG_RATE(k, format, ...) do {} while(0);
+#endif
+
+#if LOG_MIN_LEVEL <= 1
 #define LOG_INFO(format, ...) do { LOG_BASE(1, format, ##__VA_ARGS__) } while(0);
+#define LOG_INFO_EVERY_N(n, format, ...) do { LOG_BASE_EVERY_N(1, n, format, ##__VA_ARGS__) } while(0);
+#define LOG_INFO_RATE(k, format, ...) do { LOG_BASE_RATE(1, k, format, ##__VA_ARGS__) } while(0);
+#else
+#define LOG_INFO(format, ...) do {} while(0);
+#define LOG_INFO_EVERY_N(n, format, ...) do {} while(0);
+#define LOG_INFO_RATE(k, format, ...) do {} while(0);
+#endif
+
+#if LOG_MIN_LEVEL <= 2
 #define LOG_WARN(format, ...) do { LOG_BASE(2, format, ##__VA_ARGS__) } while(0);
+#define LOG_WARN_RATE(k, format, ...) do { LOG_BASE_RATE(2, k, format, ##__VA_ARGS__) } while(0);
+#else
+#define LOG_WARN(format, ...) do {} while(0);
+#define LOG_WARN_RATE(k, format, ...) do {} while(0);
+#endif
+
+// ERROR永远保留
 #define LOG_ERROR(format, ...) do { LOG_BASE(3, format, ##__VA_ARGS__) } while(0);
+#define LOG_ERROR_RATE(k, format, ...) do { LOG_BASE_RATE(3, k, format, ##__VA_ARGS__) } while(0);
 
-#endif // LOG_H
\ No newline at end of file
+#endif // LOG_H
@@ -0,0 +1,73 @@
+/**
+ * @file log_buffer.hpp
+ * @author weilai
+ * @brief 日志前端使用的定长缓冲区，每个线程持有一块，写满或定时交给后端线程，
+ *        后端整块fwrite到文件，避免每条日志一次系统调用（muduo双缓冲思路）
+ * @version 0.1
+ * @date 2023-08-20
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef LOG_BUFFER_HPP
+#define LOG_BUFFER_HPP
+
+#include <cstddef>
+
+#include "assert.h"
+
+class LogBuffer {
+public:
+    // 单块256KB，线程数有限，总占用可控
+    static const size_t CAPACITY = 256 * 1024;
+
+    LogBuffer(): _len(0), _lines(0) {}
+
+    // 禁止拷贝，缓冲区只在前后端之间移动所有权
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    char* current() {
+        return _data + _len;
+    }
+
+    size_t avail() const {
+        return CAPACITY - _len;
+    }
+
+    // 一次写入一整行，顺便记录行数，供后端按行数滚动日志
+    void add(size_t len) {
+        assert(len <= avail());
+        _len += len;
+        ++_lines;
+    }
+
+    const char* data() const {
+        return _data;
+    }
+
+    size_t length() const {
+        return _len;
+    }
+
+    int lines() const {
+        return _lines;
+    }
+
+    bool empty() const {
+        return _len == 0;
+    }
+
+    void reset() {
+        _len = 0;
+        _lines = 0;
+    }
+
+private:
+    char _data[CAPACITY];
+    size_t _len;
+    int _lines;
+};
+
+#endif // LOG_BUFFER_HPP
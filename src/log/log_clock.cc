@@ -0,0 +1,47 @@
+/**
+ * @file log_clock.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-22
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "log_clock.h"
+
+#include <cstdio>
+#include <cstring>
+
+size_t LogClock::formatPrefix(char* out, const timeval& tv) {
+    const Cache& c = _cache(tv.tv_sec);
+    // 前20字节"YYYY-MM-DD HH:MM:SS."整秒内不变
+    memcpy(out, c.prefix, 20);
+    long us = static_cast<long>(tv.tv_usec);
+    for (int i = 25; i >= 20; --i) {
+        out[i] = static_cast<char>('0' + us % 10);
+        us /= 10;
+    }
+    out[26] = ' ';
+    return PREFIX_LEN;
+}
+
+tm LogClock::localTime(time_t sec) {
+    return _cache(sec).n;
+}
+
+LogClock::Cache& LogClock::_cache(time_t sec) {
+    thread_local Cache c = {-1, {}, {}};
+    if (c.sec != sec) {
+        c.sec = sec;
+        localtime_r(&sec, &c.n);
+        // 编译器无法限定各int字段的位数，按最坏情况留足空间
+        char buf[64];
+        snprintf(buf, sizeof buf, "%04d-%02d-%02d %02d:%02d:%02d.",
+                c.n.tm_year + 1900, c.n.tm_mon + 1, c.n.tm_mday,
+                c.n.tm_hour, c.n.tm_min, c.n.tm_sec);
+        memcpy(c.prefix, buf, 20);
+    }
+    return c;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file log_clock.h
+ * @author weilai
+ * @brief 每线程缓存"YYYY-MM-DD HH:MM:SS."日期前缀，秒数变化时才调用localtime_r重建，
+ *        同一秒内只改写微秒字段，避免每条日志都进glibc时区全局锁
+ * @version 0.1
+ * @date 2023-08-22
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef LOG_CLOCK_H
+#define LOG_CLOCK_H
+
+#include <cstddef>
+
+#include "sys/time.h"
+#include "time.h"
+
+class LogClock {
+public:
+    // "YYYY-MM-DD HH:MM:SS.uuuuuu " 定长27字节
+    static const size_t PREFIX_LEN = 27;
+
+    /**
+     * @brief 在out处写入日期前缀，out至少要有PREFIX_LEN字节
+     *
+     * @return 写入的字节数
+     */
+    static size_t formatPrefix(char* out, const timeval& tv);
+
+    // 当前线程缓存的分解时间，日志滚动的日期检查直接复用
+    // 按值返回：同一线程里formatPrefix会按每条记录自己的秒数重建缓存，引用会被悄悄改掉
+    static tm localTime(time_t sec);
+
+private:
+    struct Cache {
+        time_t sec;
+        tm n;
+        char prefix[PREFIX_LEN];
+    };
+
+    static Cache& _cache(time_t sec);
+};
+
+#endif // LOG_CLOCK_H
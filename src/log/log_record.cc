@@ -0,0 +1,151 @@
+/**
+ * @file log_record.cc
+ * @author weilai
+ * @brief 二进制日志记录的解码，后端线程和离线解码工具共用
+ * @version 0.1
+ * @date 2023-08-21
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "log_record.h"
+#include "log_clock.h"
+
+#include <cstdio>
+
+namespace logrec {
+
+const char* levelTitle(int level) {
+    switch (level) {
+        case 0: return "[DEBUG]: ";
+        case 1: return "[INFO] : ";
+        case 2: return "[WARN] : ";
+        case 3: return "[ERROR]: ";
+        default: return "[INFO] : ";
+    }
+}
+
+size_t formatArgs(char* out, size_t cap, const char* format, const char* args, const char* end) {
+    if (cap == 0) {
+        return 0;
+    }
+    size_t len = 0;
+    const char* p = format;
+    while (*p != '\0' and len + 1 < cap) {
+        if (*p != '%') {
+            out[len++] = *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+        // 取出flag、宽度和精度，丢弃长度修饰，按记录中的真实类型重建说明符
+        char spec[40];
+        size_t sn = 0;
+        spec[sn++] = *p++;
+        while (*p != '\0' and strchr("-+ #0123456789.", *p) != nullptr and sn < 24) {
+            spec[sn++] = *p++;
+        }
+        while (*p != '\0' and strchr("hlLqjzt", *p) != nullptr) {
+            ++p;
+        }
+        char conv = *p != '\0' ? *p++ : 's';
+        if (args >= end) {
+            // 参数不够，和printf一样不做猜测
+            continue;
+        }
+
+        int n = 0;
+        size_t room = cap - len;
+        uint8_t tag = static_cast<uint8_t>(*args++);
+        // 每种类型的定长部分都是8字节（字符串为4字节长度），不够说明记录被截断
+        size_t need = tag == ARG_STRING ? sizeof(uint32_t) : sizeof(int64_t);
+        if (args + need > end) {
+            break;
+        }
+        switch (tag) {
+            case ARG_INT:
+            case ARG_UINT: {
+                int64_t v;
+                memcpy(&v, args, sizeof v);
+                args += sizeof v;
+                if (conv == 'c') {
+                    spec[sn++] = 'c';
+                    spec[sn] = '\0';
+                    n = snprintf(out + len, room, spec, static_cast<int>(v));
+                    break;
+                }
+                if (strchr("diouxX", conv) == nullptr) {
+                    conv = tag == ARG_INT ? 'd' : 'u';
+                }
+                spec[sn++] = 'l';
+                spec[sn++] = 'l';
+                spec[sn++] = conv;
+                spec[sn] = '\0';
+                n = snprintf(out + len, room, spec, static_cast<long long>(v));
+                break;
+            }
+            case ARG_DOUBLE: {
+                double v;
+                memcpy(&v, args, sizeof v);
+                args += sizeof v;
+                spec[sn++] = strchr("eEfFgGaA", conv) != nullptr ? conv : 'g';
+                spec[sn] = '\0';
+                n = snprintf(out + len, room, spec, v);
+                break;
+            }
+            case ARG_STRING: {
+                uint32_t slen;
+                memcpy(&slen, args, sizeof slen);
+                args += sizeof slen;
+                if (slen > MAX_STRING or args + slen > end) {
+                    args = end;
+                    break;
+                }
+                char tmp[MAX_STRING + 1];
+                memcpy(tmp, args, slen);
+                tmp[slen] = '\0';
+                args += slen;
+                spec[sn++] = 's';
+                spec[sn] = '\0';
+                n = snprintf(out + len, room, spec, tmp);
+                break;
+            }
+            case ARG_POINTER: {
+                uint64_t v;
+                memcpy(&v, args, sizeof v);
+                args += sizeof v;
+                n = snprintf(out + len, room, "%p", reinterpret_cast<void*>(v));
+                break;
+            }
+            default:
+                // 未知标签说明记录已损坏，后面的参数无法再对齐
+                args = end;
+                break;
+        }
+        if (n > 0) {
+            len += static_cast<size_t>(n) < room ? n : room - 1;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+size_t formatLine(char* out, size_t cap, int level, const char* format,
+                    const char* args, const char* end, const timeval& tv) {
+    const char* title = levelTitle(level);
+    size_t slen = LogClock::PREFIX_LEN + strlen(title);
+    if (slen + 1 >= cap) {
+        return 0;
+    }
+    LogClock::formatPrefix(out, tv);
+    memcpy(out + LogClock::PREFIX_LEN, title, slen - LogClock::PREFIX_LEN);
+    size_t len = slen + formatArgs(out + slen, cap - slen - 1, format, args, end);
+    out[len++] = '\n';
+    return len;
+}
+
+} // namespace logrec
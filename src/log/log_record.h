@@ -0,0 +1,154 @@
+/**
+ * @file log_record.h
+ * @author weilai
+ * @brief 延迟格式化的二进制日志记录：请求线程只拷贝格式串编号、单调时间戳和原始参数，
+ *        格式化交给后端线程或离线解码工具（tools/log_decode.cc）完成。
+ *        记录布局：LogRecordHeader | [类型标签 + 参数值] * N
+ * @version 0.1
+ * @date 2023-08-21
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+#include "sys/time.h"
+
+struct LogRecordHeader {
+    uint32_t size;   // 整条记录的字节数，含头部
+    uint32_t fmt_id; // 格式串编号，小于LOG_RECORD_FIRST_ID的为保留记录
+    int64_t ts;      // steady_clock纳秒，借助锚点记录换算成墙上时间
+};
+
+// 保留记录：格式串字典项与时间锚点，二进制日志文件靠它们自描述
+const uint32_t LOG_RECORD_DICT = 0;   // 负载：uint32 id | uint32 level | 格式串（不含'\0'）
+const uint32_t LOG_RECORD_ANCHOR = 1; // 负载：int64 steady_ns | int64 realtime_ns
+const uint32_t LOG_RECORD_FIRST_ID = 2;
+
+namespace logrec {
+
+enum ArgType : uint8_t {
+    ARG_INT = 1,
+    ARG_UINT,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER
+};
+
+// 字符串参数最多拷贝的长度，超出部分截断
+const uint32_t MAX_STRING = 1024;
+
+inline uint32_t stringLen(const char* s) {
+    return s == nullptr ? 0 : static_cast<uint32_t>(strnlen(s, MAX_STRING));
+}
+
+// 计算参数编码后的长度
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value, size_t>::type argSize(T) {
+    return 1 + sizeof(int64_t);
+}
+
+template<class T>
+inline typename std::enable_if<std::is_floating_point<T>::value, size_t>::type argSize(T) {
+    return 1 + sizeof(double);
+}
+
+template<class T>
+inline size_t argSize(const T*) {
+    return 1 + sizeof(uint64_t);
+}
+
+inline size_t argSize(const char* s) {
+    return 1 + sizeof(uint32_t) + stringLen(s);
+}
+
+inline size_t argSize(char* s) {
+    return argSize(static_cast<const char*>(s));
+}
+
+inline size_t encodedSize() {
+    return 0;
+}
+
+// 按值传参，字符数组自动退化为指针
+template<class T, class... Args>
+inline size_t encodedSize(T v, Args... rest) {
+    return argSize(v) + encodedSize(rest...);
+}
+
+// 逐个写入参数，返回写入后的位置；用memcpy避免非对齐访问
+template<class T>
+inline typename std::enable_if<std::is_integral<T>::value, char*>::type encodeArg(char* p, T v) {
+    *p++ = std::is_signed<T>::value ? ARG_INT : ARG_UINT;
+    int64_t x = static_cast<int64_t>(v);
+    memcpy(p, &x, sizeof x);
+    return p + sizeof x;
+}
+
+template<class T>
+inline typename std::enable_if<std::is_floating_point<T>::value, char*>::type encodeArg(char* p, T v) {
+    *p++ = ARG_DOUBLE;
+    double x = static_cast<double>(v);
+    memcpy(p, &x, sizeof x);
+    return p + sizeof x;
+}
+
+template<class T>
+inline char* encodeArg(char* p, const T* v) {
+    *p++ = ARG_POINTER;
+    uint64_t x = reinterpret_cast<uintptr_t>(v);
+    memcpy(p, &x, sizeof x);
+    return p + sizeof x;
+}
+
+inline char* encodeArg(char* p, const char* s) {
+    *p++ = ARG_STRING;
+    uint32_t len = stringLen(s);
+    memcpy(p, &len, sizeof len);
+    p += sizeof len;
+    if (len > 0) {
+        memcpy(p, s, len);
+    }
+    return p + len;
+}
+
+inline char* encodeArg(char* p, char* s) {
+    return encodeArg(p, static_cast<const char*>(s));
+}
+
+inline char* encodeArgs(char* p) {
+    return p;
+}
+
+template<class T, class... Args>
+inline char* encodeArgs(char* p, T v, Args... rest) {
+    return encodeArgs(encodeArg(p, v), rest...);
+}
+
+const char* levelTitle(int level);
+
+/**
+ * @brief 按格式串还原参数，类型以记录中的标签为准，与格式串不符时按实际类型输出
+ *
+ * @return 写入out的字节数，不超过cap - 1，结尾补'\0'
+ */
+size_t formatArgs(char* out, size_t cap, const char* format, const char* args, const char* end);
+
+/**
+ * @brief 还原成与文本日志相同格式的一整行（含换行）
+ *
+ * @return 写入out的字节数
+ */
+size_t formatLine(char* out, size_t cap, int level, const char* format,
+                    const char* args, const char* end, const timeval& tv);
+
+} // namespace logrec
+
+#endif // LOG_RECORD_H
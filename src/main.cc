@@ -9,7 +9,11 @@ int main() {
     Server server(
         9006, 3, 60000, true,
         3306, "weilai", "", "mydb",
-        12, 12, true, 1
+        12, 12, true, 1,
+        {}, 9007, 1024, true,
+        Log::MODE::DEFERRED, {LogRotatePolicy::DAILY, 50000, 0, true},
+        "./log/flight.rec", 64 * 1024 * 1024,
+        100, 0.99
     );
     server.start();
 }
\ No newline at end of file
@@ -0,0 +1,137 @@
+/**
+ * @file alloc_stats.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-09-03
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "alloc_stats.h"
+
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef TRACK_ALLOCS
+
+static const char* const PHASE_NAME[AllocStats::PHASE_NUM] = {
+    "other", "read", "parse", "route", "respond", "write", "log", "sql"
+};
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+}
+
+// 不同阶段的计数分开缓存行；全是静态零初始化，分配函数在任何构造函数之前就可能被调用
+struct alignas(64) PhaseCounter {
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes;
+};
+
+static PhaseCounter g_counters[AllocStats::PHASE_NUM];
+static std::atomic<uint64_t> g_requests;
+static thread_local AllocStats::PHASE tl_phase = AllocStats::OTHER;
+
+static inline void record(size_t size) {
+    PhaseCounter& c = g_counters[tl_phase];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+// operator new默认实现调用malloc，这里一并统计；free不影响计数，沿用glibc的实现
+extern "C" void* malloc(size_t size) {
+    record(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+    record(n * size);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* p, size_t size) {
+    record(size);
+    return __libc_realloc(p, size);
+}
+
+AllocStats::PHASE AllocStats::swapPhase(PHASE phase) {
+    PHASE prev = tl_phase;
+    tl_phase = phase;
+    return prev;
+}
+
+void AllocStats::_countRequest() {
+    g_requests.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AllocStats::render(std::string& out) {
+    // 先取快照，拼接输出本身的分配不影响本次结果
+    uint64_t count[PHASE_NUM], bytes[PHASE_NUM];
+    for (int i = 0; i < PHASE_NUM; ++i) {
+        count[i] = g_counters[i].count.load(std::memory_order_relaxed);
+        bytes[i] = g_counters[i].bytes.load(std::memory_order_relaxed);
+    }
+    uint64_t requests = g_requests.load(std::memory_order_relaxed);
+    char line[160];
+    out += "# HELP webserver_alloc_total Heap allocations by request phase\n";
+    out += "# TYPE webserver_alloc_total counter\n";
+    for (int i = 0; i < PHASE_NUM; ++i) {
+        snprintf(line, sizeof line, "webserver_alloc_total{phase=\"%s\"} %" PRIu64 "\n", PHASE_NAME[i], count[i]);
+        out += line;
+    }
+    out += "# HELP webserver_alloc_bytes_total Heap bytes requested by request phase\n";
+    out += "# TYPE webserver_alloc_bytes_total counter\n";
+    for (int i = 0; i < PHASE_NUM; ++i) {
+        snprintf(line, sizeof line, "webserver_alloc_bytes_total{phase=\"%s\"} %" PRIu64 "\n", PHASE_NAME[i], bytes[i]);
+        out += line;
+    }
+    out += "# HELP webserver_alloc_requests_total Requests completed while tracking allocations\n";
+    out += "# TYPE webserver_alloc_requests_total counter\n";
+    snprintf(line, sizeof line, "webserver_alloc_requests_total %" PRIu64 "\n", requests);
+    out += line;
+    out += "# HELP webserver_alloc_per_request Average heap allocations per completed request since start\n";
+    out += "# TYPE webserver_alloc_per_request gauge\n";
+    for (int i = 0; i < PHASE_NUM; ++i) {
+        snprintf(line, sizeof line, "webserver_alloc_per_request{phase=\"%s\"} %.2f\n", PHASE_NAME[i],
+                    requests > 0 ? static_cast<double>(count[i]) / requests : 0.0);
+        out += line;
+    }
+}
+
+std::string AllocStats::summary() {
+    uint64_t requests = g_requests.load(std::memory_order_relaxed);
+    char line[96];
+    snprintf(line, sizeof line, "%" PRIu64 " requests, per request:", requests);
+    std::string out = line;
+    for (int i = 0; i < PHASE_NUM; ++i) {
+        uint64_t count = g_counters[i].count.load(std::memory_order_relaxed);
+        uint64_t bytes = g_counters[i].bytes.load(std::memory_order_relaxed);
+        snprintf(line, sizeof line, " %s %.1f/%.0fB", PHASE_NAME[i],
+                    requests > 0 ? static_cast<double>(count) / requests : 0.0,
+                    requests > 0 ? static_cast<double>(bytes) / requests : 0.0);
+        out += line;
+    }
+    return out;
+}
+
+#else
+
+AllocStats::PHASE AllocStats::swapPhase(PHASE) {
+    return OTHER;
+}
+
+void AllocStats::_countRequest() {}
+
+void AllocStats::render(std::string&) {}
+
+std::string AllocStats::summary() {
+    return "";
+}
+
+#endif // TRACK_ALLOCS
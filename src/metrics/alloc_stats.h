@@ -0,0 +1,75 @@
+/**
+ * @file alloc_stats.h
+ * @author weilai
+ * @brief 分配统计：编译时定义TRACK_ALLOCS后接管malloc/calloc/realloc（operator new也经由malloc），
+ *        按当前线程所处的请求阶段累计分配次数和字节数，通过/metrics输出总量和每个请求的平均值，
+ *        服务器退出时写一行汇总日志。阶段由HttpConn/Server/Log用AllocScope标记，嵌套时内层优先。
+ *        未定义TRACK_ALLOCS时AllocScope和requestDone都是空操作。
+ * @version 0.1
+ * @date 2023-09-03
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <cstdint>
+#include <string>
+
+class AllocStats {
+public:
+    enum PHASE {
+        OTHER,
+        READ,
+        PARSE,
+        ROUTE,
+        RESPOND,
+        WRITE,
+        LOG,
+        SQL,
+        PHASE_NUM
+    };
+
+    // 返回原来的阶段
+    static PHASE swapPhase(PHASE phase);
+
+    // 在一个请求完整写出时调用，用于计算每请求的平均值
+    static void requestDone() {
+#ifdef TRACK_ALLOCS
+        _countRequest();
+#endif
+    }
+
+    static void render(std::string& out);
+
+    // 形如"parse 12.0/1.3KB, respond 8.0/412B, ..."，未启用时为空
+    static std::string summary();
+
+private:
+    static void _countRequest();
+};
+
+// 作用域内的分配记到phase，离开时恢复外层阶段
+class AllocScope {
+public:
+#ifdef TRACK_ALLOCS
+    explicit AllocScope(AllocStats::PHASE phase): _prev(AllocStats::swapPhase(phase)) {}
+    ~AllocScope() {
+        AllocStats::swapPhase(_prev);
+    }
+#else
+    explicit AllocScope(AllocStats::PHASE) {}
+#endif
+
+    AllocScope(const AllocScope&) = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+#ifdef TRACK_ALLOCS
+private:
+    AllocStats::PHASE _prev;
+#endif
+};
+
+#endif // ALLOC_STATS_H
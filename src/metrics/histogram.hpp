@@ -0,0 +1,98 @@
+/**
+ * @file histogram.hpp
+ * @author weilai
+ * @brief 对数-线性直方图（HDR风格）：每个2的幂区间再等分16个子桶，相对误差不超过1/16，
+ *        单位由使用方决定（微秒时覆盖约19小时）。多线程并发记录，只有relaxed原子加。
+ * @version 0.1
+ * @date 2023-08-29
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+
+class Histogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    // 最高位超过这个值的样本都计入最后一桶
+    static const int MAX_MSB = 36;
+    static const int BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB_COUNT;
+
+    Histogram(): _sum(0) {
+        for (int i = 0; i < BUCKETS; ++i) {
+            _counts[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(uint64_t v) {
+        _counts[index(v)].fetch_add(1, std::memory_order_relaxed);
+        _sum.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    // 小于16的值一一对应，之后每个2的幂区间16个桶
+    static int index(uint64_t v) {
+        if (v < SUB_COUNT) {
+            return static_cast<int>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        if (msb > MAX_MSB) {
+            return BUCKETS - 1;
+        }
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + static_cast<int>((v >> shift) - SUB_COUNT);
+    }
+
+    // 桶内样本的上界（不含）
+    static uint64_t upperBound(int i) {
+        if (i < SUB_COUNT) {
+            return static_cast<uint64_t>(i) + 1;
+        }
+        int shift = i / SUB_COUNT - 1;
+        return (static_cast<uint64_t>(SUB_COUNT + i % SUB_COUNT) + 1) << shift;
+    }
+
+    uint64_t count() const {
+        uint64_t n = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            n += _counts[i].load(std::memory_order_relaxed);
+        }
+        return n;
+    }
+
+    uint64_t sum() const {
+        return _sum.load(std::memory_order_relaxed);
+    }
+
+    // q取(0, 1]，返回所在桶的上界；没有样本时返回0
+    uint64_t percentile(double q) const {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+        rank = rank > 0 ? rank : 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += _counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return upperBound(i);
+            }
+        }
+        return upperBound(BUCKETS - 1);
+    }
+
+private:
+    std::atomic<uint64_t> _counts[BUCKETS];
+    std::atomic<uint64_t> _sum;
+};
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,128 @@
+/**
+ * @file latency_stats.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-29
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "latency_stats.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include "assert.h"
+
+static const char* STAGE_NAME[LatencyStats::STAGE_NUM] = {
+    "wait", "queue", "parse", "handle", "write", "total"
+};
+
+static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+LatencyStats& LatencyStats::instance() {
+    static LatencyStats stats;
+    return stats;
+}
+
+void LatencyStats::init(const std::vector<std::string>& routes) {
+    _routes.assign(1, "other");
+    for (const std::string& r : routes) {
+        if (std::find(_routes.begin() + 1, _routes.end(), r) == _routes.end()) {
+            _routes.push_back(r);
+        }
+    }
+    _hists.reset(new Histogram[_routes.size() * STAGE_NUM]);
+}
+
+int LatencyStats::routeIndex(const char* path) const {
+    // 路由只有几个，线性比较比哈希查找快，也不用为查找键构造string
+    for (size_t i = 1; i < _routes.size(); ++i) {
+        if (_routes[i] == path) {
+            return static_cast<int>(i);
+        }
+    }
+    return 0;
+}
+
+uint64_t LatencyStats::finish(int route, const RequestTiming& timing) {
+    const int64_t* t = timing.t;
+    if (t[RequestTiming::WRITTEN] == 0) {
+        return 0;
+    }
+    // 相邻两个时间戳都在才计入对应阶段
+    static const RequestTiming::MARK FROM[] = {
+        RequestTiming::ACCEPT, RequestTiming::DISPATCH, RequestTiming::WORKER,
+        RequestTiming::PARSED, RequestTiming::BUILT
+    };
+    for (int s = WAIT; s < TOTAL; ++s) {
+        int64_t begin = t[FROM[s]], end = t[FROM[s] + 1];
+        if (begin != 0 and end >= begin) {
+            _hist(route, static_cast<STAGE>(s)).record(static_cast<uint64_t>(end - begin) / 1000);
+        }
+    }
+    for (int m = RequestTiming::DISPATCH; m < RequestTiming::WRITTEN; ++m) {
+        if (t[m] != 0) {
+            uint64_t total = static_cast<uint64_t>(t[RequestTiming::WRITTEN] - t[m]) / 1000;
+            _hist(route, TOTAL).record(total);
+            return total;
+        }
+    }
+    return 0;
+}
+
+uint64_t LatencyStats::percentile(int route, STAGE stage, double q) const {
+    return _hist(route, stage).percentile(q);
+}
+
+uint64_t LatencyStats::count(int route, STAGE stage) const {
+    return _hist(route, stage).count();
+}
+
+int LatencyStats::getRouteCount() const {
+    return static_cast<int>(_routes.size());
+}
+
+void LatencyStats::render(std::string& out) const {
+    if (_hists == nullptr) {
+        return;
+    }
+    out += "# HELP webserver_request_stage_seconds Request latency by stage and route\n";
+    out += "# TYPE webserver_request_stage_seconds summary\n";
+    char line[256];
+    for (size_t r = 0; r < _routes.size(); ++r) {
+        for (int s = 0; s < STAGE_NUM; ++s) {
+            const Histogram& h = _hist(static_cast<int>(r), static_cast<STAGE>(s));
+            uint64_t n = h.count();
+            if (n == 0) {
+                continue;
+            }
+            const char* route = _routes[r].c_str();
+            for (double q : QUANTILES) {
+                snprintf(line, sizeof line,
+                            "webserver_request_stage_seconds{stage=\"%s\",route=\"%s\",quantile=\"%g\"} %.6f\n",
+                            STAGE_NAME[s], route, q, h.percentile(q) / 1e6);
+                out += line;
+            }
+            snprintf(line, sizeof line, "webserver_request_stage_seconds_sum{stage=\"%s\",route=\"%s\"} %.6f\n",
+                        STAGE_NAME[s], route, h.sum() / 1e6);
+            out += line;
+            snprintf(line, sizeof line, "webserver_request_stage_seconds_count{stage=\"%s\",route=\"%s\"} %" PRIu64 "\n",
+                        STAGE_NAME[s], route, n);
+            out += line;
+        }
+    }
+}
+
+// private methods
+LatencyStats::LatencyStats() {
+    init({});
+}
+
+Histogram& LatencyStats::_hist(int route, STAGE stage) const {
+    assert(route >= 0 and route < static_cast<int>(_routes.size()));
+    return _hists[route * STAGE_NUM + stage];
+}
@@ -0,0 +1,109 @@
+/**
+ * @file latency_stats.h
+ * @author weilai
+ * @brief 请求各阶段耗时：HttpConn在每个阶段打时间戳，响应最后一个字节写出后按路由和阶段计入直方图，
+ *        用来判断尾延迟来自线程池排队、解析、数据库还是写socket。
+ * @version 0.1
+ * @date 2023-08-29
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef LATENCY_STATS_H
+#define LATENCY_STATS_H
+
+#include "histogram.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+// 单个请求的时间戳，0表示这个阶段没有经过（如keep-alive连接上的后续请求没有ACCEPT）
+struct RequestTiming {
+    enum MARK {
+        ACCEPT = 0,     // 连接建立，或上一个响应写完
+        DISPATCH,       // 主线程收到EPOLLIN，投递给线程池
+        WORKER,         // 工作线程开始读
+        PARSED,         // 请求解析完成
+        BUILT,          // 响应头生成
+        WRITTEN,        // 最后一个字节写出
+        // 以下不参与阶段统计，只用于慢请求追踪
+        DB_START,       // DB线程开始执行
+        DB_END,         // 数据库操作完成
+        MARK_NUM
+    };
+
+    int64_t t[MARK_NUM];
+
+    RequestTiming() {
+        reset();
+    }
+
+    void reset() {
+        for (int i = 0; i < MARK_NUM; ++i) {
+            t[i] = 0;
+        }
+    }
+
+    void mark(MARK m) {
+        t[m] = now();
+    }
+
+    // 单调时钟，纳秒
+    static int64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+};
+
+class LatencyStats {
+public:
+    enum STAGE {
+        WAIT = 0,   // ACCEPT -> DISPATCH，等客户端发来请求
+        QUEUE,      // DISPATCH -> WORKER，线程池排队
+        PARSE,      // WORKER -> PARSED，读socket和解析
+        HANDLE,     // PARSED -> BUILT，查库（含DB线程池排队）或准备文件
+        WRITE,      // BUILT -> WRITTEN，写socket
+        TOTAL,      // 最早的时间戳（不含WAIT）-> WRITTEN
+        STAGE_NUM
+    };
+
+    static LatencyStats& instance();
+
+    // 登记需要单独统计的路由，其余路径归入other；之后只读，记录时不加锁
+    void init(const std::vector<std::string>& routes);
+
+    int routeIndex(const char* path) const;
+
+    // 响应写完后调用，返回总耗时（微秒）
+    uint64_t finish(int route, const RequestTiming& timing);
+
+    uint64_t percentile(int route, STAGE stage, double q) const;
+
+    uint64_t count(int route, STAGE stage) const;
+
+    int getRouteCount() const;
+
+    // 以Prometheus summary格式追加到out
+    void render(std::string& out) const;
+
+private:
+    LatencyStats();
+    ~LatencyStats() = default;
+
+    LatencyStats(const LatencyStats&) = delete;
+    LatencyStats& operator=(const LatencyStats&) = delete;
+
+    Histogram& _hist(int route, STAGE stage) const;
+
+    // 下标0为other
+    std::vector<std::string> _routes;
+    std::unique_ptr<Histogram[]> _hists;
+};
+
+#endif // LATENCY_STATS_H
@@ -0,0 +1,136 @@
+/**
+ * @file metrics.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-29
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "metrics.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unordered_set>
+
+struct CounterSpec {
+    const char* name;
+    const char* labels;
+    const char* help;
+};
+
+// 与Metrics::COUNTER一一对应
+static const CounterSpec COUNTER_SPEC[Metrics::COUNTER_NUM] = {
+    { "webserver_connections_accepted_total", "", "Accepted client connections" },
+    { "webserver_connections_closed_total", "", "Closed client connections" },
+    { "webserver_requests_total", "{code=\"200\"}", "Responses by status code" },
+    { "webserver_requests_total", "{code=\"400\"}", "Responses by status code" },
+    { "webserver_requests_total", "{code=\"403\"}", "Responses by status code" },
+    { "webserver_requests_total", "{code=\"404\"}", "Responses by status code" },
+    { "webserver_requests_total", "{code=\"503\"}", "Responses by status code" },
+    { "webserver_requests_total", "{code=\"other\"}", "Responses by status code" },
+    { "webserver_bytes_in_total", "", "Bytes read from client sockets" },
+    { "webserver_bytes_out_total", "", "Bytes written to client sockets" },
+};
+
+thread_local Metrics::ThreadCounters* Metrics::_tl_counters = nullptr;
+
+Metrics& Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::COUNTER Metrics::requestCounter(int code) {
+    switch (code) {
+        case 200: return REQ_200;
+        case 400: return REQ_400;
+        case 403: return REQ_403;
+        case 404: return REQ_404;
+        case 503: return REQ_503;
+        default: return REQ_OTHER;
+    }
+}
+
+void Metrics::addSampler(const std::string& name, const char* help, const char* type, Sampler sampler) {
+    std::lock_guard<std::mutex> locker(_m);
+    _samplers.push_back(SamplerEntry{name, help, type, std::move(sampler)});
+}
+
+void Metrics::addCollector(Collector collector) {
+    std::lock_guard<std::mutex> locker(_m);
+    _collectors.push_back(std::move(collector));
+}
+
+uint64_t Metrics::get(COUNTER id) {
+    std::lock_guard<std::mutex> locker(_m);
+    uint64_t sum = 0;
+    for (ThreadCounters* tc : _threads) {
+        sum += tc->v[id].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::string Metrics::render() {
+    uint64_t sums[COUNTER_NUM] = {0};
+    std::vector<SamplerEntry> samplers;
+    std::vector<Collector> collectors;
+    {
+        std::lock_guard<std::mutex> locker(_m);
+        for (ThreadCounters* tc : _threads) {
+            for (int i = 0; i < COUNTER_NUM; ++i) {
+                sums[i] += tc->v[i].load(std::memory_order_relaxed);
+            }
+        }
+        // 采样函数可能要加别的锁，拷出来后在锁外调用
+        samplers = _samplers;
+        collectors = _collectors;
+    }
+
+    std::string out;
+    std::unordered_set<std::string> described;
+    char line[256];
+    auto describe = [&](const std::string& base, const char* help, const char* type) {
+        if (described.insert(base).second) {
+            snprintf(line, sizeof line, "# HELP %s %s\n# TYPE %s %s\n", base.c_str(), help, base.c_str(), type);
+            out += line;
+        }
+    };
+    for (int i = 0; i < COUNTER_NUM; ++i) {
+        const CounterSpec& spec = COUNTER_SPEC[i];
+        describe(spec.name, spec.help, "counter");
+        snprintf(line, sizeof line, "%s%s %" PRIu64 "\n", spec.name, spec.labels, sums[i]);
+        out += line;
+    }
+    for (const SamplerEntry& s : samplers) {
+        describe(s.name.substr(0, s.name.find('{')), s.help, s.type);
+        snprintf(line, sizeof line, "%s %.17g\n", s.name.c_str(), s.sampler());
+        out += line;
+    }
+    for (const Collector& c : collectors) {
+        c(out);
+    }
+    return out;
+}
+
+// private methods
+Metrics::ThreadCounters* Metrics::_registerThread() {
+    // C++14的new不保证超过16字节的对齐
+    void* p = nullptr;
+    if (posix_memalign(&p, alignof(ThreadCounters), sizeof(ThreadCounters)) != 0) {
+        throw std::bad_alloc();
+    }
+    ThreadCounters* tc = new (p) ThreadCounters;
+    for (int i = 0; i < COUNTER_NUM; ++i) {
+        tc->v[i].store(0, std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> locker(_m);
+        _threads.push_back(tc);
+    }
+    _tl_counters = tc;
+    return tc;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file metrics.h
+ * @author weilai
+ * @brief 进程内指标：每个线程独占一块按缓存行对齐的计数器，热路径只有一次relaxed读写；
+ *        抓取时汇总所有线程的计数，再加上按需采样的仪表值，输出Prometheus文本格式。
+ * @version 0.1
+ * @date 2023-08-29
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Metrics {
+public:
+    // 计数器编号，名字和说明见metrics.cc中的COUNTER_SPEC
+    enum COUNTER {
+        CONN_ACCEPTED = 0,
+        CONN_CLOSED,
+        REQ_200,
+        REQ_400,
+        REQ_403,
+        REQ_404,
+        REQ_503,
+        REQ_OTHER,
+        BYTES_IN,
+        BYTES_OUT,
+        COUNTER_NUM
+    };
+
+    // 抓取时调用，返回当前值
+    typedef std::function<double()> Sampler;
+    // 抓取时调用，自行追加完整的指标文本（含HELP/TYPE），用于直方图等多行指标
+    typedef std::function<void(std::string&)> Collector;
+
+    static Metrics& instance();
+
+    // 只由当前线程写自己的计数块，不需要原子读改写
+    static void add(COUNTER id, uint64_t n = 1) {
+        ThreadCounters* tc = _tl_counters;
+        if (tc == nullptr) {
+            tc = instance()._registerThread();
+        }
+        std::atomic<uint64_t>& c = tc->v[id];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static COUNTER requestCounter(int code);
+
+    /**
+     * @brief 登记一个抓取时采样的指标
+     *
+     * @param name 指标名，可以带标签，如 webserver_threadpool_queue_depth{pool="db"}
+     * @param type gauge或counter，同名不同标签的指标只输出一次HELP/TYPE
+     */
+    void addSampler(const std::string& name, const char* help, const char* type, Sampler sampler);
+
+    void addCollector(Collector collector);
+
+    // 汇总所有线程的计数
+    uint64_t get(COUNTER id);
+
+    std::string render();
+
+private:
+    Metrics() = default;
+    ~Metrics() = default;
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // 对齐到缓存行，不同线程的计数块不会共享缓存行
+    struct alignas(64) ThreadCounters {
+        std::atomic<uint64_t> v[COUNTER_NUM];
+    };
+
+    struct SamplerEntry {
+        std::string name;
+        const char* help;
+        const char* type;
+        Sampler sampler;
+    };
+
+    ThreadCounters* _registerThread();
+
+    // 线程退出后计数块保留，累计值不会丢失
+    std::mutex _m;
+    std::vector<ThreadCounters*> _threads;
+    std::vector<SamplerEntry> _samplers;
+    std::vector<Collector> _collectors;
+
+    static thread_local ThreadCounters* _tl_counters;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,51 @@
+/**
+ * @file probes.h
+ * @author weilai
+ * @brief USDT静态探针，provider为webserver。有sys/sdt.h（systemtap-sdt-dev）时编译成一条nop加
+ *        .note.stapsdt描述，未挂载时没有开销；bpftrace/perf/stap可以直接按名字挂载，不用重新编译。
+ *        没有sys/sdt.h或定义了NO_USDT时展开为空，参数不会被求值。
+ *        例：bpftrace -e 'usdt:./server:webserver:sql_query_end { @[str(arg0)] = count(); }'
+ * @version 0.1
+ * @date 2023-08-31
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef PROBES_H
+#define PROBES_H
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#define PROBE0(name) DTRACE_PROBE(webserver, name)
+#define PROBE1(name, a1) DTRACE_PROBE1(webserver, name, a1)
+#define PROBE2(name, a1, a2) DTRACE_PROBE2(webserver, name, a1, a2)
+#define PROBE3(name, a1, a2, a3) DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#else
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a1) do {} while (0)
+#define PROBE2(name, a1, a2) do {} while (0)
+#define PROBE3(name, a1, a2, a3) do {} while (0)
+#endif
+
+/*
+ * 探针一览（参数依次为arg0, arg1, ...）：
+ *   conn_accept(fd, ip, port)          Server::_addClient，ip/port为网络字节序
+ *   conn_close(fd)                     Server::_closeConn
+ *   task_enqueue(pool, queue_size)     ThreadPool::addTask，入队后的队列长度
+ *   task_dequeue(pool, queue_size)     工作线程取出任务后，剩余的队列长度
+ *   parse_begin(request, bytes)        HttpRequest::parse，待解析的字节数
+ *   parse_end(request, ok)
+ *   file_open(path, fd)                HttpResponse::_addContent，fd < 0表示打开失败
+ *   file_mmap(path, addr, size)        addr为MAP_FAILED表示映射失败
+ *   sql_query_begin(sql)               MysqlConn每次执行语句
+ *   sql_query_end(sql, ret)            ret为影响/返回行数，-1表示失败
+ */
+
+#endif // PROBES_H
@@ -0,0 +1,83 @@
+/**
+ * @file profiled_mutex.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-30
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "profiled_mutex.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+static const double QUANTILES[] = { 0.5, 0.99, 0.999 };
+
+// 锁可能在静态对象中构造，注册表用函数内静态变量保证先于它们初始化
+static std::mutex& registryMutex() {
+    static std::mutex m;
+    return m;
+}
+
+static std::vector<std::unique_ptr<LockStats>>& registry() {
+    static std::vector<std::unique_ptr<LockStats>> stats;
+    return stats;
+}
+
+ProfiledMutex::ProfiledMutex(const char* name): _stats(nullptr), _hold_begin(0) {
+    std::lock_guard<std::mutex> locker(registryMutex());
+    for (auto& s : registry()) {
+        if (s->name == name) {
+            _stats = s.get();
+            return;
+        }
+    }
+    registry().emplace_back(new LockStats(name));
+    _stats = registry().back().get();
+}
+
+void ProfiledMutex::render(std::string& out) {
+    std::lock_guard<std::mutex> locker(registryMutex());
+    if (registry().empty()) {
+        return;
+    }
+    char line[256];
+    out += "# HELP webserver_lock_acquisitions_total Lock acquisitions\n";
+    out += "# TYPE webserver_lock_acquisitions_total counter\n";
+    for (auto& s : registry()) {
+        snprintf(line, sizeof line, "webserver_lock_acquisitions_total{lock=\"%s\"} %" PRIu64 "\n",
+                    s->name.c_str(), s->acquired.load(std::memory_order_relaxed));
+        out += line;
+    }
+    out += "# HELP webserver_lock_contended_total Lock acquisitions that had to wait\n";
+    out += "# TYPE webserver_lock_contended_total counter\n";
+    for (auto& s : registry()) {
+        snprintf(line, sizeof line, "webserver_lock_contended_total{lock=\"%s\"} %" PRIu64 "\n",
+                    s->name.c_str(), s->contended.load(std::memory_order_relaxed));
+        out += line;
+    }
+    const char* names[] = { "webserver_lock_wait_seconds", "webserver_lock_hold_seconds" };
+    const char* helps[] = { "Time spent waiting for contended locks", "Time locks were held" };
+    for (int k = 0; k < 2; ++k) {
+        snprintf(line, sizeof line, "# HELP %s %s\n# TYPE %s summary\n", names[k], helps[k], names[k]);
+        out += line;
+        for (auto& s : registry()) {
+            const Histogram& h = k == 0 ? s->wait_ns : s->hold_ns;
+            for (double q : QUANTILES) {
+                snprintf(line, sizeof line, "%s{lock=\"%s\",quantile=\"%g\"} %.9f\n",
+                            names[k], s->name.c_str(), q, h.percentile(q) / 1e9);
+                out += line;
+            }
+            snprintf(line, sizeof line, "%s_sum{lock=\"%s\"} %.9f\n", names[k], s->name.c_str(), h.sum() / 1e9);
+            out += line;
+            snprintf(line, sizeof line, "%s_count{lock=\"%s\"} %" PRIu64 "\n", names[k], s->name.c_str(), h.count());
+            out += line;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+/**
+ * @file profiled_mutex.h
+ * @author weilai
+ * @brief 锁竞争分析：ProfiledMutex按名字统计获取次数、发生竞争的次数、等锁时间和持锁时间分布，
+ *        通过/metrics输出。编译时定义PROFILE_LOCKS才启用，否则ServerMutex就是std::mutex，没有任何开销。
+ *        服务器的热点锁（线程池、日志、SQL连接池、阻塞队列）统一使用ServerMutex/ServerCondVar/ServerLock。
+ * @version 0.1
+ * @date 2023-08-30
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef PROFILED_MUTEX_H
+#define PROFILED_MUTEX_H
+
+#include "histogram.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <time.h>
+
+// 同名的锁合并统计；线程池、SQL连接池等按实例传入各自的名字
+struct LockStats {
+    std::string name;
+    std::atomic<uint64_t> acquired;
+    std::atomic<uint64_t> contended;
+    // 单位纳秒
+    Histogram wait_ns;
+    Histogram hold_ns;
+    explicit LockStats(const char* lock_name): name(lock_name), acquired(0), contended(0) {}
+};
+
+class ProfiledMutex {
+public:
+    explicit ProfiledMutex(const char* name);
+
+    ProfiledMutex(const ProfiledMutex&) = delete;
+    ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+    void lock() {
+        if (!_m.try_lock()) {
+            int64_t begin = _now();
+            _m.lock();
+            _hold_begin = _now();
+            _stats->contended.fetch_add(1, std::memory_order_relaxed);
+            _stats->wait_ns.record(static_cast<uint64_t>(_hold_begin - begin));
+        } else {
+            _hold_begin = _now();
+        }
+        _stats->acquired.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if (!_m.try_lock()) {
+            return false;
+        }
+        _hold_begin = _now();
+        _stats->acquired.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        // _hold_begin只由持锁线程读写
+        _stats->hold_ns.record(static_cast<uint64_t>(_now() - _hold_begin));
+        _m.unlock();
+    }
+
+    // 以Prometheus格式追加所有锁的统计
+    static void render(std::string& out);
+
+private:
+    static int64_t _now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    std::mutex _m;
+    LockStats* _stats;
+    int64_t _hold_begin;
+};
+
+// 不做统计时用的锁：名字只是为了和ProfiledMutex的构造方式一致
+class NamedMutex: public std::mutex {
+public:
+    explicit NamedMutex(const char*) {}
+};
+
+#ifdef PROFILE_LOCKS
+typedef ProfiledMutex ServerMutex;
+typedef std::condition_variable_any ServerCondVar;
+typedef std::unique_lock<ProfiledMutex> ServerLock;
+#else
+typedef NamedMutex ServerMutex;
+typedef std::condition_variable ServerCondVar;
+typedef std::unique_lock<std::mutex> ServerLock;
+#endif
+
+#endif // PROFILED_MUTEX_H
@@ -0,0 +1,129 @@
+/**
+ * @file trace_ring.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-30
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "trace_ring.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include <time.h>
+
+volatile sig_atomic_t TraceRing::_dump_requested = 0;
+
+// 两个时间戳都在时返回间隔（毫秒），否则返回-1
+static double spanMs(const RequestTrace& r, RequestTiming::MARK from, RequestTiming::MARK to) {
+    if (r.t[from] == 0 or r.t[to] == 0 or r.t[to] < r.t[from]) {
+        return -1;
+    }
+    return (r.t[to] - r.t[from]) / 1e6;
+}
+
+TraceRing& TraceRing::instance() {
+    static TraceRing ring;
+    return ring;
+}
+
+void TraceRing::init(size_t capacity, int threshold_ms, double percentile) {
+    std::lock_guard<std::mutex> locker(_m);
+    _ring.assign(std::max<size_t>(capacity, 1), RequestTrace());
+    _next = 0;
+    _captured = 0;
+    _threshold_us = static_cast<uint64_t>(threshold_ms) * 1000;
+    _percentile = percentile;
+    // 路由表在LatencyStats::init之后固定，这里按当时的路由数分配
+    _route_num = LatencyStats::instance().getRouteCount();
+    _thresholds.reset(new std::atomic<uint64_t>[_route_num]);
+    for (int i = 0; i < _route_num; ++i) {
+        _thresholds[i].store(_threshold_us, std::memory_order_relaxed);
+    }
+}
+
+void TraceRing::capture(const RequestTrace& trace) {
+    std::lock_guard<std::mutex> locker(_m);
+    _ring[_next] = trace;
+    _next = (_next + 1) % _ring.size();
+    ++_captured;
+}
+
+void TraceRing::refresh() {
+    if (_percentile <= 0) {
+        return;
+    }
+    LatencyStats& stats = LatencyStats::instance();
+    for (int i = 0; i < _route_num; ++i) {
+        uint64_t threshold = _threshold_us;
+        if (stats.count(i, LatencyStats::TOTAL) >= MIN_SAMPLES) {
+            threshold = stats.percentile(i, LatencyStats::TOTAL, _percentile);
+        }
+        _thresholds[i].store(threshold, std::memory_order_relaxed);
+    }
+}
+
+std::string TraceRing::dump() {
+    std::vector<RequestTrace> traces;
+    uint64_t captured;
+    {
+        std::lock_guard<std::mutex> locker(_m);
+        // 从最旧的一条开始
+        for (size_t i = 0; i < _ring.size(); ++i) {
+            const RequestTrace& r = _ring[(_next + i) % _ring.size()];
+            if (r.t[RequestTiming::WRITTEN] != 0) {
+                traces.push_back(r);
+            }
+        }
+        captured = _captured;
+    }
+    std::string out;
+    char line[512];
+    snprintf(line, sizeof line, "# slow requests: %" PRIu64 " captured, %zu kept\n", captured, traces.size());
+    out += line;
+    for (const RequestTrace& r : traces) {
+        time_t sec = static_cast<time_t>(r.wall_ms / 1000);
+        struct tm tm_buf;
+        localtime_r(&sec, &tm_buf);
+        char ts[32];
+        strftime(ts, sizeof ts, "%F %T", &tm_buf);
+        // 起点取最早的时间戳（不含等待请求的ACCEPT）
+        RequestTiming::MARK start = RequestTiming::DISPATCH;
+        while (start < RequestTiming::WRITTEN and r.t[start] == 0) {
+            start = static_cast<RequestTiming::MARK>(start + 1);
+        }
+        snprintf(line, sizeof line,
+                    "%s.%03d fd=%d %s %s -> %s %d in=%" PRIu64 " out=%" PRIu64 " total=%.3fms"
+                    " queue=%.3f parse=%.3f db_queue=%.3f db=%.3f handle=%.3f write=%.3f\n",
+                    ts, static_cast<int>(r.wall_ms % 1000), r.fd, r.method, r.route, r.path, r.code,
+                    r.bytes_in, r.bytes_out, spanMs(r, start, RequestTiming::WRITTEN),
+                    spanMs(r, RequestTiming::DISPATCH, RequestTiming::WORKER),
+                    spanMs(r, RequestTiming::WORKER, RequestTiming::PARSED),
+                    spanMs(r, RequestTiming::PARSED, RequestTiming::DB_START),
+                    spanMs(r, RequestTiming::DB_START, RequestTiming::DB_END),
+                    spanMs(r, RequestTiming::PARSED, RequestTiming::BUILT),
+                    spanMs(r, RequestTiming::BUILT, RequestTiming::WRITTEN));
+        out += line;
+    }
+    return out;
+}
+
+void TraceRing::requestDump() {
+    _dump_requested = 1;
+}
+
+bool TraceRing::takeDumpRequest() {
+    if (_dump_requested == 0) {
+        return false;
+    }
+    _dump_requested = 0;
+    return true;
+}
+
+// private methods
+TraceRing::TraceRing(): _threshold_us(100000), _percentile(0), _route_num(0), _next(0), _captured(0) {}
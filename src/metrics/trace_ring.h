@@ -0,0 +1,94 @@
+/**
+ * @file trace_ring.h
+ * @author weilai
+ * @brief 慢请求采样：总耗时超过阈值的请求把完整的阶段时间戳和请求信息存进定长环形缓冲区，
+ *        通过管理端口/traces或SIGUSR2（写入日志）随时导出，不影响服务。
+ *        快请求只多一次比较；阈值可以是固定值，也可以是各路由总耗时的某个分位数（周期刷新）。
+ * @version 0.1
+ * @date 2023-08-30
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef TRACE_RING_H
+#define TRACE_RING_H
+
+#include "latency_stats.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct RequestTrace {
+    int64_t t[RequestTiming::MARK_NUM];
+    // 采样时的墙上时间，便于和日志对照
+    int64_t wall_ms;
+    int fd;
+    int code;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    char method[8];
+    // 原始路径和最终返回的页面，超长截断
+    char route[64];
+    char path[64];
+};
+
+class TraceRing {
+public:
+    static TraceRing& instance();
+
+    /**
+     * @brief
+     *
+     * @param capacity 最多保留的慢请求条数，满了覆盖最旧的
+     * @param threshold_ms 固定阈值，总耗时不低于它的请求被采样
+     * @param percentile 大于0时改用各路由总耗时的这个分位数作为阈值，样本不足时仍用固定阈值
+     */
+    void init(size_t capacity = 256, int threshold_ms = 100, double percentile = 0);
+
+    // 热路径：只读一个原子量
+    bool isSlow(int route, uint64_t total_us) const {
+        return route < _route_num and total_us >= _thresholds[route].load(std::memory_order_relaxed);
+    }
+
+    void capture(const RequestTrace& trace);
+
+    // 按分位数重算阈值，由Server的定时器周期调用
+    void refresh();
+
+    std::string dump();
+
+    // 信号处理函数里调用，只设置标志
+    static void requestDump();
+    // 主循环检查并清除导出请求
+    static bool takeDumpRequest();
+
+private:
+    TraceRing();
+    ~TraceRing() = default;
+
+    TraceRing(const TraceRing&) = delete;
+    TraceRing& operator=(const TraceRing&) = delete;
+
+    // 分位数阈值生效所需的最少样本数
+    static const uint64_t MIN_SAMPLES = 100;
+
+    uint64_t _threshold_us;
+    double _percentile;
+    int _route_num;
+    std::unique_ptr<std::atomic<uint64_t>[]> _thresholds;
+
+    std::mutex _m;
+    std::vector<RequestTrace> _ring;
+    size_t _next;
+    uint64_t _captured;
+
+    static volatile sig_atomic_t _dump_requested;
+};
+
+#endif // TRACE_RING_H
@@ -0,0 +1,118 @@
+/**
+ * @file circuit_breaker.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-28
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "circuit_breaker.h"
+#include "log/log.h"
+
+#include <chrono>
+
+#include "assert.h"
+
+CircuitBreaker& CircuitBreaker::instance() {
+    static CircuitBreaker breaker;
+    return breaker;
+}
+
+void CircuitBreaker::init(Probe probe, int failure_threshold, int slow_ms, int open_ms) {
+    assert(probe and failure_threshold > 0 and slow_ms > 0 and open_ms > 0);
+    assert(!_prober.joinable());
+    _probe = std::move(probe);
+    _failure_threshold = failure_threshold;
+    _slow_ms = slow_ms;
+    _open_ms = open_ms;
+    _is_closed = false;
+    _prober = std::thread(&CircuitBreaker::_probeLoop, this);
+}
+
+void CircuitBreaker::close() {
+    {
+        std::lock_guard<std::mutex> locker(_m);
+        if (_is_closed) {
+            return;
+        }
+        _is_closed = true;
+    }
+    _cond.notify_all();
+    if (_prober.joinable()) {
+        _prober.join();
+    }
+}
+
+bool CircuitBreaker::allow() const {
+    return _state.load(std::memory_order_relaxed) == CLOSED;
+}
+
+void CircuitBreaker::onSuccess(int64_t latency_ms) {
+    if (latency_ms >= _slow_ms) {
+        LOG_WARN_RATE(10, "Slow DB call: %lld ms", (long long)latency_ms)
+        onFailure();
+        return;
+    }
+    if (_failures.load(std::memory_order_relaxed) != 0) {
+        _failures.store(0, std::memory_order_relaxed);
+    }
+}
+
+void CircuitBreaker::onFailure() {
+    if (_failures.fetch_add(1, std::memory_order_relaxed) + 1 >= _failure_threshold) {
+        _trip();
+    }
+}
+
+CircuitBreaker::STATE CircuitBreaker::getState() const {
+    return static_cast<STATE>(_state.load(std::memory_order_relaxed));
+}
+
+// private methods
+CircuitBreaker::CircuitBreaker()
+    : _failure_threshold(5), _slow_ms(1000), _open_ms(2000),
+    _state(CLOSED), _failures(0), _is_closed(true) {}
+
+CircuitBreaker::~CircuitBreaker() {
+    close();
+}
+
+void CircuitBreaker::_trip() {
+    int st = CLOSED;
+    if (_state.compare_exchange_strong(st, OPEN)) {
+        LOG_ERROR("CircuitBreaker open after %d consecutive DB failures", _failures.load())
+        // 试探线程在锁内检查状态，先过一下锁再通知，避免丢失唤醒
+        { std::lock_guard<std::mutex> locker(_m); }
+        _cond.notify_all();
+    }
+}
+
+void CircuitBreaker::_probeLoop() {
+    std::unique_lock<std::mutex> locker(_m);
+    while (!_is_closed) {
+        // 闭合时只等熔断通知，断开后每隔_open_ms试探一次
+        if (_state.load() == CLOSED) {
+            _cond.wait(locker, [this] { return _is_closed or _state.load() != CLOSED; });
+            continue;
+        }
+        _cond.wait_for(locker, std::chrono::milliseconds(_open_ms), [this] { return _is_closed; });
+        if (_is_closed) {
+            break;
+        }
+        _state.store(HALF_OPEN);
+        locker.unlock();
+        bool ok = _probe();
+        locker.lock();
+        if (ok) {
+            _failures.store(0);
+            _state.store(CLOSED);
+            LOG_INFO("CircuitBreaker closed, DB recovered")
+        } else {
+            _state.store(OPEN);
+            LOG_WARN("CircuitBreaker probe failed, stay open")
+        }
+    }
+}
@@ -0,0 +1,80 @@
+/**
+ * @file circuit_breaker.h
+ * @author weilai
+ * @brief 数据库熔断器
+ *        连续失败（超过慢调用阈值也算失败）达到次数后断开，依赖数据库的请求直接返回503，
+ *        不再排队占住DB线程。断开期间由后台线程定期试探，试探成功才恢复放行。
+ * @version 0.1
+ * @date 2023-08-28
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef CIRCUIT_BREAKER_H
+#define CIRCUIT_BREAKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class CircuitBreaker {
+public:
+    enum STATE {
+        CLOSED = 0,     // 正常放行
+        OPEN,           // 熔断，拒绝请求
+        HALF_OPEN       // 后台试探中，仍拒绝请求
+    };
+
+    // 试探数据库是否恢复，在后台线程中调用，可以阻塞
+    typedef std::function<bool()> Probe;
+
+    static CircuitBreaker& instance();
+
+    /**
+     * @brief 启动后台试探线程
+     *
+     * @param failure_threshold 连续失败多少次后熔断
+     * @param slow_ms 耗时超过这个值的调用按失败计
+     * @param open_ms 熔断后多久开始试探，试探失败后同样间隔再试
+     */
+    void init(Probe probe, int failure_threshold = 5, int slow_ms = 1000, int open_ms = 2000);
+
+    void close();
+
+    // 熔断期间返回false，调用方应立即失败
+    bool allow() const;
+
+    void onSuccess(int64_t latency_ms);
+    void onFailure();
+
+    STATE getState() const;
+
+private:
+    CircuitBreaker();
+    ~CircuitBreaker();
+
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    void _trip();
+    void _probeLoop();
+
+    Probe _probe;
+    int _failure_threshold;
+    int _slow_ms;
+    int _open_ms;
+
+    std::atomic<int> _state;
+    std::atomic<int> _failures;
+
+    bool _is_closed;
+    std::mutex _m;
+    std::condition_variable _cond;
+    std::thread _prober;
+};
+
+#endif // CIRCUIT_BREAKER_H
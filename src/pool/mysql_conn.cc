@@ -0,0 +1,366 @@
+/**
+ * @file mysql_conn.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-25
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "mysql_conn.h"
+#include "log/log.h"
+#include "metrics/probes.h"
+
+#include <mysql/errmsg.h>
+#include <mysql/mysqld_error.h>
+#include <cstring>
+
+#include "assert.h"
+
+// 与STMT编号一一对应
+static const char* const STMT_SQL[MysqlConn::STMT_COUNT] = {
+    "SELECT username, password FROM user WHERE username = ? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?, ?)",
+    "SELECT COUNT(*) FROM user",
+    "SELECT username FROM user"
+};
+
+// 断线后能否重新执行：INSERT可能在断线前已经提交，重试会得到主键冲突
+static const bool STMT_IDEMPOTENT[MysqlConn::STMT_COUNT] = {
+    true,
+    false,
+    true,
+    true
+};
+
+// 结果列的初始缓冲，超长时用mysql_stmt_fetch_column补取
+static const unsigned long FIELD_BUF_LEN = 256;
+
+MysqlConn::MysqlConn(const MysqlParam& mp): _param(mp), _mysql(nullptr), _in_txn(false), _errno(0) {}
+
+MysqlConn::~MysqlConn() {
+    disconnect();
+}
+
+bool MysqlConn::connect() {
+    assert(_mysql == nullptr);
+    // mysql_init可以直接传入nullptr来初始化
+    // 但此时mysql_init自己创建的对象将在第一次
+    // 调用mysql_close时被释放，后续调用mysql_close
+    // 会访问到野指针；手动创建的指针则没有这个问题
+    MYSQL* mysql = mysql_init(nullptr);
+    if (mysql == nullptr) {
+        LOG_ERROR("MySQL init failed!")
+        return false;
+    }
+    // 每次读写都有上限，数据库卡住时查询报错返回，而不是永远阻塞DB线程
+    if (_param.connect_timeout_sec > 0) {
+        mysql_options(mysql, MYSQL_OPT_CONNECT_TIMEOUT, &_param.connect_timeout_sec);
+    }
+    if (_param.read_timeout_sec > 0) {
+        mysql_options(mysql, MYSQL_OPT_READ_TIMEOUT, &_param.read_timeout_sec);
+    }
+    if (_param.write_timeout_sec > 0) {
+        mysql_options(mysql, MYSQL_OPT_WRITE_TIMEOUT, &_param.write_timeout_sec);
+    }
+    if (mysql_real_connect(mysql, _param.host, _param.user, _param.password,
+                            _param.db_name, _param.port, nullptr, 0) == nullptr) {
+        LOG_ERROR("MySQL connect failed: %s", mysql_error(mysql))
+        mysql_close(mysql);
+        return false;
+    }
+    _mysql = mysql;
+    return true;
+}
+
+bool MysqlConn::reconnect() {
+    disconnect();
+    return connect();
+}
+
+void MysqlConn::disconnect() {
+    _closeStmts();
+    if (_mysql != nullptr) {
+        mysql_close(_mysql);
+        _mysql = nullptr;
+    }
+}
+
+bool MysqlConn::ping() {
+    if (_mysql == nullptr) {
+        return false;
+    }
+    if (mysql_ping(_mysql) != 0) {
+        _errno = mysql_errno(_mysql);
+        return false;
+    }
+    return true;
+}
+
+bool MysqlConn::isConnected() const {
+    return _mysql != nullptr;
+}
+
+MYSQL* MysqlConn::get() {
+    return _mysql;
+}
+
+int MysqlConn::execute(STMT id, const std::vector<std::string>& params, std::vector<std::string>* row) {
+    assert(id >= 0 and id < STMT_COUNT);
+    long n = _run(STMT_SQL[id], _stmts[id], STMT_IDEMPOTENT[id], params, [row](const std::vector<std::string>& r) {
+        if (row != nullptr) {
+            *row = r;
+        }
+        return false;
+    });
+    return n < 0 ? -1 : (n > 0 ? 1 : 0);
+}
+
+long MysqlConn::executeEach(STMT id, const std::vector<std::string>& params, const RowCallback& on_row) {
+    assert(id >= 0 and id < STMT_COUNT);
+    return _run(STMT_SQL[id], _stmts[id], STMT_IDEMPOTENT[id], params, on_row);
+}
+
+long MysqlConn::executeSql(const std::string& sql, const std::vector<std::string>& params,
+                            const RowCallback& on_row) {
+    auto it = _adhoc.find(sql);
+    if (it == _adhoc.end()) {
+        if (_adhoc.size() >= ADHOC_MAX) {
+            for (auto& kv : _adhoc) {
+                _closeStmt(kv.second);
+            }
+            _adhoc.clear();
+        }
+        it = _adhoc.emplace(sql, Stmt()).first;
+    }
+    // unordered_map的节点地址在插入后保持不变，重连只会把句柄置空
+    bool idempotent = sql.compare(0, 6, "SELECT") == 0;
+    return _run(it->first.c_str(), it->second, idempotent, params,
+                on_row ? on_row : [](const std::vector<std::string>&) { return true; });
+}
+
+bool MysqlConn::begin() {
+    if (_mysql == nullptr and !connect()) {
+        return false;
+    }
+    _in_txn = _query("START TRANSACTION");
+    return _in_txn;
+}
+
+bool MysqlConn::commit() {
+    bool ok = _in_txn and _query("COMMIT");
+    _in_txn = false;
+    return ok;
+}
+
+void MysqlConn::rollback() {
+    if (_in_txn) {
+        _query("ROLLBACK");
+    }
+    _in_txn = false;
+}
+
+unsigned int MysqlConn::getErrno() const {
+    return _errno;
+}
+
+// private methods
+long MysqlConn::_run(const char* sql, Stmt& slot, bool idempotent,
+                        const std::vector<std::string>& params, const RowCallback& on_row) {
+    // 断线或语句失效时最多重试一次
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (_mysql == nullptr and !connect()) {
+            _errno = CR_SERVER_GONE_ERROR;
+            return -1;
+        }
+        MYSQL_STMT* stmt = _prepare(sql, slot);
+        long ret = -1;
+        if (stmt == nullptr) {
+            _errno = mysql_errno(_mysql);
+        } else {
+            PROBE1(sql_query_begin, sql);
+            ret = _executeOnce(slot, params, on_row);
+            PROBE2(sql_query_end, sql, ret);
+        }
+        if (ret >= 0 or attempt > 0) {
+            return ret;
+        }
+        if (_isConnLost(_errno)) {
+            reconnect();
+            if (_in_txn) {
+                // 事务随旧连接一起丢失，重试只会在事务外执行
+                _in_txn = false;
+                return -1;
+            }
+            if (!idempotent) {
+                // 语句可能已经生效，保留断线错误码，由调用方按结果未知处理
+                LOG_WARN("MySQL connection lost, non-idempotent statement not retried")
+                return -1;
+            }
+            LOG_WARN("MySQL connection lost, reconnect and retry")
+        } else if (stmt != nullptr and _needReprepare(_errno)) {
+            _closeStmt(slot);
+        } else {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+MYSQL_STMT* MysqlConn::_prepare(const char* sql, Stmt& slot) {
+    if (slot.handle != nullptr) {
+        return slot.handle;
+    }
+    MYSQL_STMT* stmt = mysql_stmt_init(_mysql);
+    if (stmt == nullptr) {
+        return nullptr;
+    }
+    if (mysql_stmt_prepare(stmt, sql, strlen(sql)) != 0) {
+        LOG_ERROR("MySQL prepare failed: %s", mysql_stmt_error(stmt))
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    // 参数和结果列都按字符串绑定，缓冲区地址在语句的生命周期内不变
+    unsigned long param_count = mysql_stmt_param_count(stmt);
+    slot.params.assign(param_count, MYSQL_BIND());
+    slot.param_lengths.assign(param_count, 0);
+    memset(slot.params.data(), 0, sizeof(MYSQL_BIND) * param_count);
+    for (unsigned long i = 0; i < param_count; ++i) {
+        slot.params[i].buffer_type = MYSQL_TYPE_STRING;
+        slot.params[i].length = &slot.param_lengths[i];
+    }
+    unsigned int field_count = mysql_stmt_field_count(stmt);
+    slot.results.assign(field_count, MYSQL_BIND());
+    slot.bufs.assign(field_count, std::vector<char>(FIELD_BUF_LEN));
+    slot.lengths.assign(field_count, 0);
+    slot.is_null.reset(new BindFlag[field_count]());
+    slot.errors.reset(new BindFlag[field_count]());
+    memset(slot.results.data(), 0, sizeof(MYSQL_BIND) * field_count);
+    for (unsigned int i = 0; i < field_count; ++i) {
+        slot.results[i].buffer_type = MYSQL_TYPE_STRING;
+        slot.results[i].buffer = slot.bufs[i].data();
+        slot.results[i].buffer_length = FIELD_BUF_LEN;
+        slot.results[i].length = &slot.lengths[i];
+        slot.results[i].is_null = &slot.is_null[i];
+        slot.results[i].error = &slot.errors[i];
+    }
+    slot.handle = stmt;
+    return stmt;
+}
+
+bool MysqlConn::_query(const char* sql) {
+    PROBE1(sql_query_begin, sql);
+    if (_mysql == nullptr or mysql_query(_mysql, sql) != 0) {
+        _errno = _mysql != nullptr ? mysql_errno(_mysql) : CR_SERVER_GONE_ERROR;
+        PROBE2(sql_query_end, sql, -1);
+        return false;
+    }
+    PROBE2(sql_query_end, sql, 0);
+    return true;
+}
+
+long MysqlConn::_executeOnce(Stmt& slot, const std::vector<std::string>& params, const RowCallback& on_row) {
+    MYSQL_STMT* stmt = slot.handle;
+    if (params.size() != slot.params.size()) {
+        LOG_ERROR("MySQL stmt param count mismatch: %d", static_cast<int>(params.size()))
+        _errno = 0;
+        return -1;
+    }
+    std::vector<MYSQL_BIND>& binds = slot.params;
+    for (size_t i = 0; i < params.size(); ++i) {
+        binds[i].buffer = const_cast<char*>(params[i].data());
+        binds[i].buffer_length = params[i].size();
+        slot.param_lengths[i] = params[i].size();
+    }
+    if ((!binds.empty() and mysql_stmt_bind_param(stmt, binds.data())) or mysql_stmt_execute(stmt) != 0) {
+        _errno = mysql_stmt_errno(stmt);
+        LOG_ERROR("MySQL stmt execute failed: %s", mysql_stmt_error(stmt))
+        return -1;
+    }
+    unsigned int field_count = mysql_stmt_field_count(stmt);
+    if (field_count == 0) {
+        // INSERT等没有结果集
+        return 0;
+    }
+
+    // 每列先用定长缓冲接收，列值以二进制协议原样传回，无需再解析文本
+    std::vector<MYSQL_BIND>& results = slot.results;
+    if (field_count != results.size()) {
+        LOG_ERROR("MySQL stmt field count changed: %u", field_count)
+        _errno = 0;
+        mysql_stmt_free_result(stmt);
+        return -1;
+    }
+    if (mysql_stmt_bind_result(stmt, results.data())) {
+        _errno = mysql_stmt_errno(stmt);
+        mysql_stmt_free_result(stmt);
+        return -1;
+    }
+    long rows = 0;
+    std::vector<std::string> row(field_count);
+    while (true) {
+        int ret = mysql_stmt_fetch(stmt);
+        if (ret == 1) {
+            _errno = mysql_stmt_errno(stmt);
+            mysql_stmt_free_result(stmt);
+            return -1;
+        }
+        if (ret == MYSQL_NO_DATA) {
+            break;
+        }
+        ++rows;
+        for (unsigned int i = 0; i < field_count; ++i) {
+            if (slot.is_null[i]) {
+                row[i].clear();
+                continue;
+            }
+            unsigned long len = slot.lengths[i];
+            if (len > FIELD_BUF_LEN) {
+                // MYSQL_DATA_TRUNCATED：按真实长度补取这一列，之后恢复定长缓冲
+                std::vector<char> big(len);
+                MYSQL_BIND b = results[i];
+                b.buffer = big.data();
+                b.buffer_length = len;
+                mysql_stmt_fetch_column(stmt, &b, i, 0);
+                row[i].assign(big.data(), len);
+                continue;
+            }
+            row[i].assign(slot.bufs[i].data(), len);
+        }
+        if (!on_row(row)) {
+            break;
+        }
+    }
+    // 剩余结果丢弃，语句可复用
+    mysql_stmt_free_result(stmt);
+    mysql_stmt_reset(stmt);
+    return rows;
+}
+
+void MysqlConn::_closeStmt(Stmt& slot) {
+    // 绑定数组留到下次prepare时按新句柄重建
+    if (slot.handle != nullptr) {
+        mysql_stmt_close(slot.handle);
+        slot.handle = nullptr;
+    }
+}
+
+void MysqlConn::_closeStmts() {
+    for (int i = 0; i < STMT_COUNT; ++i) {
+        _closeStmt(_stmts[i]);
+    }
+    for (auto& kv : _adhoc) {
+        _closeStmt(kv.second);
+    }
+    _in_txn = false;
+}
+
+bool MysqlConn::_isConnLost(unsigned int err) {
+    return err == CR_SERVER_GONE_ERROR or err == CR_SERVER_LOST;
+}
+
+bool MysqlConn::_needReprepare(unsigned int err) {
+    return err == ER_UNKNOWN_STMT_HANDLER or err == ER_NEED_REPREPARE;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file mysql_conn.h
+ * @author weilai
+ * @brief 连接池中的单条MySQL连接，附带按需预编译的语句
+ *        登录/注册走二进制协议，服务端不必每次重新解析SQL，也杜绝了拼接SQL带来的注入
+ * @version 0.1
+ * @date 2023-08-25
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef MYSQL_CONN_H
+#define MYSQL_CONN_H
+
+#include <mysql/mysql.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// 数据库连接初始化参数封装
+typedef struct MysqlConnInitParam {
+    const char* host;
+    const char* user;
+    const char* password;
+    const char* db_name;
+    int port;
+    // 单位秒，0表示使用客户端库默认值（不超时）
+    // 注意读超时在客户端库内部最多会重试三次
+    unsigned int connect_timeout_sec = 2;
+    unsigned int read_timeout_sec = 2;
+    unsigned int write_timeout_sec = 2;
+} MysqlParam;
+
+class MysqlConn {
+public:
+    // 预编译语句编号，SQL文本见mysql_conn.cc
+    enum STMT {
+        STMT_VERIFY = 0,
+        STMT_REGISTER,
+        STMT_USER_COUNT,
+        STMT_ALL_USERS,
+        STMT_COUNT
+    };
+
+    explicit MysqlConn(const MysqlParam& mp);
+    ~MysqlConn();
+
+    MysqlConn(const MysqlConn&) = delete;
+    MysqlConn& operator=(const MysqlConn&) = delete;
+
+    bool connect();
+
+    // 断开后重新建立连接，旧连接上的语句全部作废，下次使用时重新prepare
+    bool reconnect();
+
+    // 关闭连接并作废语句，连接池收缩时使用
+    void disconnect();
+
+    // 探活，失败不自动重连，由调用方决定
+    bool ping();
+
+    bool isConnected() const;
+
+    MYSQL* get();
+
+    /**
+     * @brief 执行预编译语句，参数都按字符串绑定
+     *
+     * @param row 非空时取结果集第一行
+     * @return -1: 执行失败
+     *          0: 没有结果行（或无结果集）
+     *          1: 取到一行，写入row
+     */
+    int execute(STMT id, const std::vector<std::string>& params, std::vector<std::string>* row = nullptr);
+
+    // 逐行流式读取结果集，on_row返回false时提前结束；返回读取的行数，失败返回-1
+    typedef std::function<bool(const std::vector<std::string>&)> RowCallback;
+    long executeEach(STMT id, const std::vector<std::string>& params, const RowCallback& on_row);
+
+    // 执行不在STMT表里的语句（如占位符个数随批量变化的多行INSERT），按SQL文本缓存预编译句柄
+    // 断线后只有SELECT会重试，其余语句可能已经生效，返回-1由调用方判断
+    long executeSql(const std::string& sql, const std::vector<std::string>& params,
+                    const RowCallback& on_row = nullptr);
+
+    // 事务内断线不重试：重连后事务已丢失，由调用方回滚重来
+    // 事务外断线只重试幂等语句；INSERT等失败时getErrno()为CR_SERVER_LOST/CR_SERVER_GONE_ERROR，结果未知
+    bool begin();
+    bool commit();
+    void rollback();
+
+    // 最近一次失败的错误码，调用方据此区分主键冲突等情况
+    unsigned int getErrno() const;
+
+private:
+    // MYSQL_BIND::is_null/error的指向类型：MySQL 8为bool，5.7和MariaDB为my_bool
+    typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type BindFlag;
+
+    // 预编译句柄和它的绑定数组，prepare时按参数和结果列数分配，之后每次执行复用
+    // 长度、NULL和截断标志放在自己的数组里，MYSQL_BIND中的*_value字段属于客户端库内部
+    struct Stmt {
+        MYSQL_STMT* handle = nullptr;
+        std::vector<MYSQL_BIND> params;
+        std::vector<unsigned long> param_lengths;
+        std::vector<MYSQL_BIND> results;
+        std::vector<std::vector<char>> bufs;
+        std::vector<unsigned long> lengths;
+        std::unique_ptr<BindFlag[]> is_null;
+        std::unique_ptr<BindFlag[]> errors;
+    };
+
+    MYSQL_STMT* _prepare(const char* sql, Stmt& slot);
+    long _run(const char* sql, Stmt& slot, bool idempotent,
+                const std::vector<std::string>& params, const RowCallback& on_row);
+    bool _query(const char* sql);
+    long _executeOnce(Stmt& slot, const std::vector<std::string>& params, const RowCallback& on_row);
+    static void _closeStmt(Stmt& slot);
+    void _closeStmts();
+
+    // 连接断开或语句句柄失效
+    static bool _isConnLost(unsigned int err);
+    static bool _needReprepare(unsigned int err);
+
+    MysqlParam _param;
+    MYSQL* _mysql;
+    Stmt _stmts[STMT_COUNT];
+    // 临时语句缓存上限，超过后整体清空
+    static const size_t ADHOC_MAX = 128;
+    std::unordered_map<std::string, Stmt> _adhoc;
+    bool _in_txn;
+    unsigned int _errno;
+};
+
+#endif // MYSQL_CONN_H
@@ -1,88 +1,328 @@
 #include "sql_conn_pool.h"
 #include "log/log.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include "assert.h"
 
-SqlConnPool& SqlConnPool::instance(int max_size = 12) {
-    assert(max_size > 10);
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 本线程最近使用的槽位，DB线程数与连接数相当时几乎总能命中
+thread_local SqlConnPool::Slot* SqlConnPool::_tl_slot = nullptr;
+
+SqlConnPool& SqlConnPool::instance(int max_size) {
+    assert(max_size > 0);
     static SqlConnPool scp(max_size);
     return scp;
 }
 
-void SqlConnPool::init(const MysqlParam& mp) {
+void SqlConnPool::init(const MysqlParam& mp, int min_size, int health_interval_ms, int idle_timeout_ms) {
+    assert(_slots.empty());
+    _host = mp.host;
+    _user = mp.user;
+    _password = mp.password;
+    _db_name = mp.db_name;
+    _param = mp;
+    _param.host = _host.c_str();
+    _param.user = _user.c_str();
+    _param.password = _password.c_str();
+    _param.db_name = _db_name.c_str();
+    _min_conn = std::max(0, std::min(min_size, _MAX_CONN));
+    _health_interval_ms = health_interval_ms;
+    _idle_timeout_ms = idle_timeout_ms;
+
+    // 槽位一次性按上限创建，连接本身按需建立
     for (int i = 0; i < _MAX_CONN; ++i) {
-        MYSQL* mysql = nullptr;
-        // mysql_init可以直接传入nullptr来初始化
-        // 但此时mysql_init自己创建的对象将在第一次
-        // 调用mysql_close时被释放，后续调用mysql_close
-        // 会访问到野指针；手动创建的指针则没有这个问题
-        mysql = mysql_init(mysql);
-        if(mysql == nullptr) {
-            // 宏风格的调用
-            LOG_ERROR("MySQL init failed!")
-            assert(mysql != nullptr);
-        }
-        mysql = mysql_real_connect(mysql, mp.host, mp.user, mp.password,
-                            mp.db_name, mp.port, nullptr, 0);
-        // 这里是否可以重连？
-        if (mysql == nullptr) {
-            LOG_ERROR("MySQL connect failed!")
+        _slots.emplace_back(new Slot(this, _param));
+    }
+    for (int i = 0; i < _min_conn; ++i) {
+        Slot* slot = _slots[i].get();
+        slot->state = BUSY;
+        if (slot->conn.connect()) {
+            ++_size;
+            slot->last_used_ms = slot->last_check_ms = nowMs();
+            slot->state = IDLE;
+        } else {
+            // 启动时连不上也不退出，交给健康检查线程继续尝试
+            slot->state = CLOSED;
         }
-        _conn_que.push(mysql);
     }
+    LOG_INFO("SqlConnPool init %s:%d: %d/%d connected, max %d",
+                _host.c_str(), _param.port, _size.load(), _min_conn, _MAX_CONN)
+    _health = std::thread(_healthThread, this);
 }
 
 void SqlConnPool::close() {
-    std::lock_guard<std::mutex> locker(_m);
-    while (!_conn_que.empty()) {
-        auto conn = std::move(_conn_que.front());
-        _conn_que.pop();
-        // TODO: mysql连接可以用RAII封装吗？
-        mysql_close(conn);
+    {
+        std::lock_guard<ServerMutex> locker(_m);
+        if (_is_closed) {
+            return;
+        }
+        _is_closed = true;
+    }
+    _cond.notify_all();
+    _health_cond.notify_all();
+    if (_health.joinable()) {
+        _health.join();
     }
+    for (auto& slot : _slots) {
+        slot->conn.disconnect();
+        slot->state = CLOSED;
+    }
+    _size = 0;
 }
 
-MYSQL* SqlConnPool::getConn() {
-    // 这里需要外部工作线程自己控制是否继续连接！
-    // 如果出现大量连接池为空说明连接池开小了
-    if (_conn_que.empty()) {
-        LOG_WARN("Get SqlConn failed! Empty SqlConnPool!")
-        return nullptr;
+MysqlConn* SqlConnPool::getConn(int timeout_ms) {
+    // 快速路径：不读时钟，不加锁
+    MysqlConn* conn = _tryAcquire();
+    if (conn != nullptr) {
+        _acquired.fetch_add(1, std::memory_order_relaxed);
+        _wait_hist[0].fetch_add(1, std::memory_order_relaxed);
+        return conn;
     }
-    bool f = _s.wait();
-    if (f == false) {
-        LOG_ERROR("Function sem_wait() failed!")
-        assert(f);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(timeout_ms);
+    // 没有空闲连接，先尝试扩容；已达上限或连接失败再等待归还
+    conn = _tryGrow();
+    if (conn == nullptr and _size.load() == 0) {
+        // 一条连接都没有且连不上，等下去也不会有连接归还
+        _timeouts.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN_RATE(10, "Get SqlConn failed: %s:%d unreachable", _host.c_str(), _param.port)
+        return nullptr;
+    } else if (conn == nullptr) {
+        ServerLock locker(_m);
+        ++_waiters;
+        // 登记等待后再检查一次，归还方看到_waiters才会通知，不会漏掉唤醒
+        while (!_is_closed and (conn = _tryAcquire()) == nullptr) {
+            if (_cond.wait_until(locker, deadline) == std::cv_status::timeout) {
+                conn = _tryAcquire();
+                break;
+            }
+        }
+        --_waiters;
     }
-    MYSQL* conn = nullptr;
-    {
-        std::lock_guard<std::mutex> locker(_m);
-        conn = _conn_que.front();
-        _conn_que.pop();
+    _recordWait(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count());
+    if (conn == nullptr) {
+        _timeouts.fetch_add(1, std::memory_order_relaxed);
+        LOG_WARN_RATE(10, "Get SqlConn timeout after %d ms! size: %d", timeout_ms, _size.load())
+        return nullptr;
     }
+    _acquired.fetch_add(1, std::memory_order_relaxed);
     return conn;
 }
 
-void SqlConnPool::freeConn(MYSQL* conn) {
+void SqlConnPool::freeConn(MysqlConn* conn) {
     assert(conn != nullptr);
-    std::lock_guard<std::mutex> locker(_m);
-    _conn_que.push(conn);
-    _s.post();
+    Slot* slot = _tl_slot;
+    if (slot == nullptr or slot->owner != this or &slot->conn != conn) {
+        // 借出与归还不在同一线程，退化为扫描
+        slot = nullptr;
+        for (auto& s : _slots) {
+            if (&s->conn == conn) {
+                slot = s.get();
+                break;
+            }
+        }
+        assert(slot != nullptr);
+        _tl_slot = slot;
+    }
+    slot->last_used_ms.store(nowMs(), std::memory_order_relaxed);
+    _release(slot, IDLE);
 }
 
 int SqlConnPool::getFreeConnCount() {
-    std::lock_guard<std::mutex> locker(_m);
-    return _conn_que.size();
+    int n = 0;
+    for (auto& slot : _slots) {
+        n += slot->state.load(std::memory_order_relaxed) == IDLE;
+    }
+    return n;
 }
 
 int SqlConnPool::getMaxSize() const {
     return _MAX_CONN;
 }
 
-// private methods
-SqlConnPool::SqlConnPool(int size): _used_conn(0), _free_conn(0), 
-                            _MAX_CONN(size), _s(_MAX_CONN) {}
+int SqlConnPool::getSize() const {
+    return _size.load(std::memory_order_relaxed);
+}
+
+void SqlConnPool::getStats(SqlPoolStats* stats) const {
+    assert(stats != nullptr);
+    stats->size = getSize();
+    stats->idle = 0;
+    for (auto& slot : _slots) {
+        stats->idle += slot->state.load(std::memory_order_relaxed) == IDLE;
+    }
+    stats->acquired = _acquired.load(std::memory_order_relaxed);
+    stats->timeouts = _timeouts.load(std::memory_order_relaxed);
+    stats->reconnects = _reconnects.load(std::memory_order_relaxed);
+    for (int i = 0; i < SQL_WAIT_BUCKETS; ++i) {
+        stats->wait_hist[i] = _wait_hist[i].load(std::memory_order_relaxed);
+    }
+}
+
+SqlConnPool::SqlConnPool(int max_size, const char* name)
+    : _MAX_CONN(max_size), _min_conn(0), _health_interval_ms(0), _idle_timeout_ms(0), _param(),
+    _size(0), _is_closed(false), _m(name), _waiters(0), _acquired(0), _timeouts(0), _reconnects(0) {
+    for (int i = 0; i < SQL_WAIT_BUCKETS; ++i) {
+        _wait_hist[i] = 0;
+    }
+}
 
 SqlConnPool::~SqlConnPool() {
     close();
-}
\ No newline at end of file
+}
+
+// private methods
+MysqlConn* SqlConnPool::_tryAcquire() {
+    Slot* last = _tl_slot;
+    int st = IDLE;
+    if (last != nullptr and last->owner == this and last->state.compare_exchange_strong(st, IN_USE)) {
+        return &last->conn;
+    }
+    for (auto& slot : _slots) {
+        st = IDLE;
+        if (slot->state.load(std::memory_order_relaxed) == IDLE
+                and slot->state.compare_exchange_strong(st, IN_USE)) {
+            _tl_slot = slot.get();
+            return &slot->conn;
+        }
+    }
+    return nullptr;
+}
+
+MysqlConn* SqlConnPool::_tryGrow() {
+    if (_size.load(std::memory_order_relaxed) >= _MAX_CONN) {
+        return nullptr;
+    }
+    for (auto& slot : _slots) {
+        int st = CLOSED;
+        if (!slot->state.compare_exchange_strong(st, BUSY)) {
+            continue;
+        }
+        // 建立连接期间槽位为BUSY，其他线程不会重复使用
+        if (!slot->conn.connect()) {
+            slot->state = CLOSED;
+            return nullptr;
+        }
+        ++_size;
+        slot->last_check_ms = nowMs();
+        slot->state = IN_USE;
+        _tl_slot = slot.get();
+        LOG_INFO_RATE(10, "SqlConnPool grow to %d", _size.load())
+        return &slot->conn;
+    }
+    return nullptr;
+}
+
+void SqlConnPool::_release(Slot* slot, int state) {
+    slot->state.store(state);
+    // 没有等待者时不碰互斥锁
+    if (_waiters.load() > 0) {
+        { std::lock_guard<ServerMutex> locker(_m); }
+        _cond.notify_one();
+    }
+}
+
+void SqlConnPool::_recordWait(int64_t us) {
+    int i = 0;
+    if (us > 0) {
+        i = 64 - __builtin_clzll(static_cast<unsigned long long>(us));
+    }
+    _wait_hist[std::min(i, SQL_WAIT_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+// 健康检查：ping长时间未用的空闲连接，断开的重连，多余的关闭，不足的补齐
+void SqlConnPool::_healthCheck() {
+    int64_t now = nowMs();
+    for (auto& slot : _slots) {
+        int st = IDLE;
+        // 检查期间槽位为BUSY，不会被借出
+        if (!slot->state.compare_exchange_strong(st, BUSY)) {
+            continue;
+        }
+        int64_t last_used = slot->last_used_ms.load(std::memory_order_relaxed);
+        if (now - last_used >= _idle_timeout_ms and _size.load() > _min_conn) {
+            slot->conn.disconnect();
+            --_size;
+            _release(slot.get(), CLOSED);
+            LOG_INFO("SqlConnPool shrink to %d", _size.load())
+            continue;
+        }
+        if (now - std::max(last_used, slot->last_check_ms) >= _health_interval_ms) {
+            slot->last_check_ms = now;
+            if (!slot->conn.ping()) {
+                LOG_WARN("MySQL connection dead (errno %u), reconnecting", slot->conn.getErrno())
+                _reconnects.fetch_add(1, std::memory_order_relaxed);
+                if (!slot->conn.reconnect()) {
+                    --_size;
+                    _release(slot.get(), CLOSED);
+                    continue;
+                }
+            }
+        }
+        _release(slot.get(), IDLE);
+    }
+    // 补足常驻连接，数据库恢复后自动回到min_size
+    for (auto& slot : _slots) {
+        if (_size.load() >= _min_conn) {
+            break;
+        }
+        int st = CLOSED;
+        if (!slot->state.compare_exchange_strong(st, BUSY)) {
+            continue;
+        }
+        if (!slot->conn.connect()) {
+            slot->state = CLOSED;
+            break;
+        }
+        ++_size;
+        slot->last_used_ms = slot->last_check_ms = now;
+        _release(slot.get(), IDLE);
+    }
+}
+
+void SqlConnPool::_healthThread(SqlConnPool* pool) {
+    int64_t period = std::max<int64_t>(100, std::min<int64_t>(5000, pool->_health_interval_ms / 2));
+    uint64_t reported = 0;
+    ServerLock locker(pool->_m);
+    while (!pool->_is_closed) {
+        pool->_health_cond.wait_for(locker, std::chrono::milliseconds(period));
+        if (pool->_is_closed) {
+            break;
+        }
+        locker.unlock();
+        pool->_healthCheck();
+
+        // 有新的借用时输出一次等待分布
+        SqlPoolStats st;
+        pool->getStats(&st);
+        if (st.acquired + st.timeouts != reported) {
+            reported = st.acquired + st.timeouts;
+            uint64_t total = 0, seen = 0, p50 = 0, p99 = 0;
+            for (int i = 0; i < SQL_WAIT_BUCKETS; ++i) {
+                total += st.wait_hist[i];
+            }
+            for (int i = 0; i < SQL_WAIT_BUCKETS; ++i) {
+                seen += st.wait_hist[i];
+                uint64_t upper = i == 0 ? 1 : 1ULL << i;
+                if (p50 == 0 and seen * 2 >= total) {
+                    p50 = upper;
+                }
+                if (p99 == 0 and seen * 100 >= total * 99) {
+                    p99 = upper;
+                }
+            }
+            LOG_INFO("SqlConnPool size: %d, idle: %d, acquired: %llu, timeouts: %llu, reconnects: %llu, "
+                        "wait p50 < %lluus, p99 < %lluus",
+                        st.size, st.idle, (unsigned long long)st.acquired, (unsigned long long)st.timeouts,
+                        (unsigned long long)st.reconnects, (unsigned long long)p50, (unsigned long long)p99)
+        }
+        locker.lock();
+    }
+}
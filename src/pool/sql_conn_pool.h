@@ -1,72 +1,142 @@
 /**
  * @file sql_conn_pool.h
  * @author weilai
- * @brief 
+ * @brief 弹性、自愈的MySQL连接池
+ *        连接数在[min, max]之间伸缩：不够用时按需建立新连接，空闲过久的连接由后台线程关闭；
+ *        后台线程定期ping空闲连接，断开的自动重连。
+ *        获取连接先尝试本线程上次归还的连接，再无锁扫描全部槽位，只有需要等待时才加锁。
+ *        instance()是主库连接池，只读副本的连接池由SqlRouter另行创建。
  * @version 0.1
  * @date 2023-08-08
- * 
+ *
  * @copyright Copyleft Apache 2.0
- * 
+ *
  */
 
 #ifndef SQL_CONN_POOL_H
 #define SQL_CONN_POOL_H
 
-#include "RAIIs/sem_RAII.hpp"
+#include "mysql_conn.h"
+#include "metrics/profiled_mutex.h"
 
-#include <mysql/mysql.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <queue>
-/**
- * @todo C++20
- */
-// #include <semaphore>
-
-#include <semaphore.h>
-
-// 数据库连接初始化参数封装
-typedef struct MysqlConnInitParam {
-    const char* host;
-    const char* user;
-    const char* password;
-    const char* db_name;
-    int port;
-} MysqlParam;
+#include <string>
+#include <thread>
+#include <vector>
+
+// 等待时间直方图：第0桶为<1us，第i桶为[2^(i-1), 2^i)us，最后一桶收纳更长的等待
+const int SQL_WAIT_BUCKETS = 24;
+
+struct SqlPoolStats {
+    int size;
+    int idle;
+    uint64_t acquired;
+    uint64_t timeouts;
+    uint64_t reconnects;
+    uint64_t wait_hist[SQL_WAIT_BUCKETS];
+};
 
 class SqlConnPool {
 public:
     // 单例传参，用于初始化列初始化const成员
     static SqlConnPool& instance(int max_size = 12);
 
-    void init(const MysqlParam& mp);
+    // name是等待锁在锁统计中的名字，主库和各副本分开统计
+    explicit SqlConnPool(int max_size, const char* name = "sql_primary");
+    ~SqlConnPool();
+
+    /**
+     * @brief 建立min_size条连接并启动健康检查线程
+     *
+     * @param min_size 常驻连接数，健康检查会补足到这个数
+     * @param health_interval_ms 空闲连接超过这个时间未使用就ping一次
+     * @param idle_timeout_ms 超过min_size的连接空闲这么久后关闭
+     */
+    void init(const MysqlParam& mp, int min_size,
+                int health_interval_ms = 30000, int idle_timeout_ms = 300000);
 
     void close();
 
-    MYSQL* getConn();
+    /**
+     * @brief 获取一条连接
+     *
+     * @param timeout_ms 最长等待时间，超时返回nullptr
+     */
+    MysqlConn* getConn(int timeout_ms = 1000);
 
-    void freeConn(MYSQL* conn);
+    void freeConn(MysqlConn* conn);
 
     int getFreeConnCount();
 
     int getMaxSize() const;
 
-private:
-    SqlConnPool(int size);
-    ~SqlConnPool();
+    // 当前已建立的连接数
+    int getSize() const;
 
-    // 是否需要将这些拷贝复制操作全部删除呢？
-    // SqlConnPool(const SqlConnPool&) = delete;
-    // SqlConnPool(const SqlConnPool&&) = delete;
-    // SqlConnPool& operator=(const SqlConnPool&) = delete;
+    void getStats(SqlPoolStats* stats) const;
 
 private:
-    const int _MAX_CONN;
-    int _used_conn;
-    int _free_conn;
+    SqlConnPool(const SqlConnPool&) = delete;
+    SqlConnPool& operator=(const SqlConnPool&) = delete;
+
+    // 槽位状态，状态转换全部用CAS完成
+    enum STATE {
+        CLOSED = 0,     // 没有连接，可以在此建立新连接
+        IDLE,           // 空闲可取
+        IN_USE,         // 已被借出
+        BUSY            // 正在建立连接或做健康检查
+    };
+
+    // 槽位在连接池生命周期内不会释放，线程缓存的指针始终有效
+    struct Slot {
+        // 线程缓存的槽位可能来自另一个连接池，取用前先核对
+        SqlConnPool* owner;
+        MysqlConn conn;
+        std::atomic<int> state;
+        std::atomic<int64_t> last_used_ms;
+        // 只由持有该槽位（IN_USE或BUSY）的线程读写
+        int64_t last_check_ms;
+        Slot(SqlConnPool* pool, const MysqlParam& mp): owner(pool), conn(mp), state(CLOSED), last_used_ms(0), last_check_ms(0) {}
+    };
+
+    MysqlConn* _tryAcquire();
+    MysqlConn* _tryGrow();
+    void _release(Slot* slot, int state);
+    void _recordWait(int64_t us);
+    void _healthCheck();
+    static void _healthThread(SqlConnPool* pool);
 
-    std::queue<MYSQL*> _conn_que;
-    std::mutex _m;
-    sem _s;
+private:
+    const int _MAX_CONN;
+    int _min_conn;
+    int64_t _health_interval_ms;
+    int64_t _idle_timeout_ms;
+
+    // 连接参数的副本，MysqlConn重连时使用
+    std::string _host, _user, _password, _db_name;
+    MysqlParam _param;
+
+    std::vector<std::unique_ptr<Slot>> _slots;
+    std::atomic<int> _size;
+    bool _is_closed;
+
+    // 只在等待空闲连接和健康检查线程休眠时使用
+    ServerMutex _m;
+    ServerCondVar _cond;
+    std::atomic<int> _waiters;
+    ServerCondVar _health_cond;
+    std::thread _health;
+
+    static thread_local Slot* _tl_slot;
+
+    std::atomic<uint64_t> _acquired;
+    std::atomic<uint64_t> _timeouts;
+    std::atomic<uint64_t> _reconnects;
+    std::atomic<uint64_t> _wait_hist[SQL_WAIT_BUCKETS];
 };
 
-#endif // SQL_CONN_POOL_H
\ No newline at end of file
+#endif // SQL_CONN_POOL_H
@@ -0,0 +1,139 @@
+/**
+ * @file sql_router.cc
+ * @author weilai
+ * @brief
+ * @version 0.1
+ * @date 2023-08-28
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "sql_router.h"
+#include "log/log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "assert.h"
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SqlRouter& SqlRouter::instance() {
+    static SqlRouter router;
+    return router;
+}
+
+void SqlRouter::init(SqlConnPool* primary, const std::vector<MysqlParam>& replicas, int replica_size) {
+    assert(primary != nullptr and replica_size > 0);
+    assert(_replicas.empty());
+    _primary = primary;
+    for (const MysqlParam& mp : replicas) {
+        std::string name = "sql_replica_" + std::to_string(_replicas.size());
+        _replicas.emplace_back(new Replica(replica_size, name.c_str()));
+        _replicas.back()->pool->init(mp, (replica_size + 1) / 2);
+    }
+    LOG_INFO("SqlRouter init: %d replicas", static_cast<int>(_replicas.size()))
+}
+
+void SqlRouter::close() {
+    for (auto& r : _replicas) {
+        r->pool->close();
+    }
+}
+
+MysqlConn* SqlRouter::acquire(ROUTE route, int timeout_ms, int* endpoint) {
+    assert(_primary != nullptr and endpoint != nullptr);
+    if (route == READ) {
+        int i = _pickReplica();
+        if (i != PRIMARY) {
+            Replica& r = *_replicas[i];
+            r.outstanding.fetch_add(1, std::memory_order_relaxed);
+            MysqlConn* conn = r.pool->getConn(timeout_ms);
+            if (conn != nullptr) {
+                *endpoint = i;
+                return conn;
+            }
+            r.outstanding.fetch_sub(1, std::memory_order_relaxed);
+            _onResult(i, false);
+        }
+    }
+    *endpoint = PRIMARY;
+    return _primary->getConn(timeout_ms);
+}
+
+void SqlRouter::release(int endpoint, MysqlConn* conn, bool ok) {
+    assert(conn != nullptr);
+    if (endpoint == PRIMARY) {
+        _primary->freeConn(conn);
+        return;
+    }
+    assert(endpoint >= 0 and endpoint < static_cast<int>(_replicas.size()));
+    Replica& r = *_replicas[endpoint];
+    r.pool->freeConn(conn);
+    r.outstanding.fetch_sub(1, std::memory_order_relaxed);
+    _onResult(endpoint, ok);
+}
+
+int SqlRouter::getReplicaCount() const {
+    return static_cast<int>(_replicas.size());
+}
+
+// private methods
+SqlRouter::SqlRouter(): _primary(nullptr), _next(0) {}
+
+int SqlRouter::_pickReplica() {
+    int best = PRIMARY, best_outstanding = 0;
+    int64_t now = 0;
+    int n = static_cast<int>(_replicas.size());
+    // 起点轮转，在途数相同时不总是落在第一个副本上
+    int start = n > 0 ? static_cast<int>(_next.fetch_add(1, std::memory_order_relaxed) % n) : 0;
+    for (int k = 0; k < n; ++k) {
+        int i = (start + k) % n;
+        Replica& r = *_replicas[i];
+        int64_t retry = r.retry_ms.load(std::memory_order_relaxed);
+        if (retry != 0) {
+            now = now != 0 ? now : nowMs();
+            // 退避期满后只放一个试探请求：抢到的线程把下次试探时间往后推
+            if (now < retry or !r.retry_ms.compare_exchange_strong(retry,
+                                    now + r.backoff_ms.load(std::memory_order_relaxed))) {
+                continue;
+            }
+            return i;
+        }
+        int outstanding = r.outstanding.load(std::memory_order_relaxed);
+        if (best == PRIMARY or outstanding < best_outstanding) {
+            best = i;
+            best_outstanding = outstanding;
+        }
+    }
+    return best;
+}
+
+void SqlRouter::_onResult(int endpoint, bool ok) {
+    Replica& r = *_replicas[endpoint];
+    if (ok) {
+        r.failures.store(0, std::memory_order_relaxed);
+        if (r.retry_ms.exchange(0) != 0) {
+            r.backoff_ms.store(EJECT_MIN_MS, std::memory_order_relaxed);
+            LOG_INFO("SqlRouter: replica %d readmitted", endpoint)
+        }
+        return;
+    }
+    if (r.failures.fetch_add(1, std::memory_order_relaxed) + 1 < EJECT_FAILURES) {
+        return;
+    }
+    int backoff = r.backoff_ms.load(std::memory_order_relaxed);
+    if (r.retry_ms.load(std::memory_order_relaxed) != 0) {
+        // 已摘除时又失败说明试探没通过，退避加倍
+        backoff = std::min(backoff * 2, static_cast<int>(EJECT_MAX_MS));
+        r.backoff_ms.store(backoff, std::memory_order_relaxed);
+    }
+    if (r.retry_ms.exchange(nowMs() + backoff) == 0) {
+        LOG_WARN("SqlRouter: replica %d ejected for %d ms", endpoint, backoff)
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file sql_router.h
+ * @author weilai
+ * @brief 读写分离：写请求走主库连接池，读请求在只读副本间按在途请求数最少分配
+ *        副本连续失败后被摘除，退避一段时间后放一个请求试探，成功即重新加入，失败则退避加倍。
+ *        没有可用副本时读请求回落到主库。
+ * @version 0.1
+ * @date 2023-08-28
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#ifndef SQL_ROUTER_H
+#define SQL_ROUTER_H
+
+#include "sql_conn_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class SqlRouter {
+public:
+    enum ROUTE {
+        READ,
+        WRITE,
+    };
+
+    // 主库连接的端点编号，副本从0开始编号
+    static const int PRIMARY = -1;
+
+    static SqlRouter& instance();
+
+    /**
+     * @brief 为每个副本建立独立的连接池
+     *
+     * @param primary 主库连接池
+     * @param replicas 只读副本，为空时读写都走主库
+     * @param replica_size 每个副本连接池的连接上限
+     */
+    void init(SqlConnPool* primary, const std::vector<MysqlParam>& replicas, int replica_size);
+
+    void close();
+
+    /**
+     * @brief 按路由取一条连接
+     *
+     * @param endpoint 传出连接所属的端点，归还时原样传回
+     * @return 超时或无可用连接时返回nullptr
+     */
+    MysqlConn* acquire(ROUTE route, int timeout_ms, int* endpoint);
+
+    // ok为false表示这次请求因数据库故障失败，计入副本的连续失败次数
+    void release(int endpoint, MysqlConn* conn, bool ok);
+
+    int getReplicaCount() const;
+
+private:
+    SqlRouter();
+    ~SqlRouter() = default;
+
+    SqlRouter(const SqlRouter&) = delete;
+    SqlRouter& operator=(const SqlRouter&) = delete;
+
+    // 连续失败这么多次后摘除
+    static const int EJECT_FAILURES = 3;
+    static const int EJECT_MIN_MS = 1000;
+    static const int EJECT_MAX_MS = 30000;
+
+    struct Replica {
+        std::unique_ptr<SqlConnPool> pool;
+        std::atomic<int> outstanding;
+        std::atomic<int> failures;
+        // 非0表示已摘除，到这个时间后允许一个试探请求
+        std::atomic<int64_t> retry_ms;
+        std::atomic<int> backoff_ms;
+        Replica(int size, const char* name): pool(new SqlConnPool(size, name)), outstanding(0), failures(0),
+                                    retry_ms(0), backoff_ms(EJECT_MIN_MS) {}
+    };
+
+    int _pickReplica();
+    void _onResult(int endpoint, bool ok);
+
+    SqlConnPool* _primary;
+    std::vector<std::unique_ptr<Replica>> _replicas;
+    std::atomic<unsigned> _next;
+};
+
+#endif // SQL_ROUTER_H
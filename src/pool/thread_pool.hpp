@@ -18,18 +18,23 @@
 #include <thread>
 #include <functional>
 
+#include "metrics/probes.h"
+#include "metrics/profiled_mutex.h"
+
 #include "assert.h"
 
 class ThreadPool {
 public:
     // 常规单参数构造explicit避免语义混乱
-    explicit ThreadPool(size_t thread_count = 8): _MAX_SIZE(thread_count), _pool(std::make_shared<Pool>()) {
+    // name是队列锁在锁统计中的名字，每个池各用一个，才能看出是哪个池的锁在争用
+    explicit ThreadPool(size_t thread_count = 8, const char* name = "thread_pool")
+        : _MAX_SIZE(thread_count), _pool(std::make_shared<Pool>(name)) {
         assert(thread_count > 0);
         for (size_t i = 0; i < thread_count; ++i) {
             // 创建一个线程，执行lambda指定的函数，然后detach
             std::thread(
                 [pool = _pool] {
-                    std::unique_lock<std::mutex> locker(pool->m);
+                    ServerLock locker(pool->m);
                     // 无限循环，竞争任务队列中的具体任务
                     while(true) {
                         if(!pool->task_que.empty()) {
@@ -40,6 +45,7 @@ public:
                             // 随着作用域结束，task生命结束，原front对象生命随之结束
                             auto task = std::move(pool->task_que.front());
                             pool->task_que.pop();
+                            PROBE2(task_dequeue, pool.get(), pool->task_que.size());
                             locker.unlock();
                             // 其他线程在等待任务队列的锁，先解锁再执行任务
                             task();
@@ -57,7 +63,7 @@ public:
     ~ThreadPool() {
         if (_pool != nullptr) {
             {
-                std::lock_guard<std::mutex> locker(_pool->m);
+                std::lock_guard<ServerMutex> locker(_pool->m);
                 _pool->is_closed = true;
             }
             _pool->cond.notify_all();
@@ -67,11 +73,12 @@ public:
     template<class T>
     void addTask(T&& task) {
         {
-            std::lock_guard<std::mutex> locker(_pool->m);
+            std::lock_guard<ServerMutex> locker(_pool->m);
             // forward实现完美转发（为什么要完美转发？因为task应该是一个
             // 一路被传递到工作线程的临时函数对象，如果不用完美转发，
             // 在emplace时其会被解释为一个左值，从而占用内存）
             _pool->task_que.emplace(std::forward<T>(task));
+            PROBE2(task_enqueue, _pool.get(), _pool->task_que.size());
         }
         _pool->cond.notify_one();
     }
@@ -80,13 +87,20 @@ public:
         return _MAX_SIZE;
     }
 
+    // 排队等待执行的任务数
+    size_t getQueueSize() {
+        std::lock_guard<ServerMutex> locker(_pool->m);
+        return _pool->task_que.size();
+    }
+
 private:
     const int _MAX_SIZE;
 
     struct Pool {
-        std::mutex m;
-        std::condition_variable cond;
-        bool is_closed;
+        explicit Pool(const char* name): m(name) {}
+        ServerMutex m;
+        ServerCondVar cond;
+        bool is_closed = false;
         // 直接使用queue没有任何限制是否会出现队列无限加长的问题呢？
         std::queue<std::function<void()>> task_que; 
     };
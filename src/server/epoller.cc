@@ -4,7 +4,7 @@
 #include <sys/epoll.h>
 #include <unistd.h>
 
-Epoller::Epoller(int max_event = 1024)
+Epoller::Epoller(int max_event)
     // EPOLL_CLOEXEC 会在fork()后，即将exec()前，关闭子进程持有的所有父进程fd
     : _epoll_fd(epoll_create1(EPOLL_CLOEXEC)), _events(max_event) {}
 
@@ -40,7 +40,7 @@ bool Epoller::delFd(int fd) {
     return 0 == epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, &st_ev);
 }
 
-int Epoller::wait(int timeout_ms = -1) {
+int Epoller::wait(int timeout_ms) {
     // 注意_events是vector，首元素地址为&_events[0]
     return epoll_wait(_epoll_fd, &_events[0], static_cast<int>(_events.size()), timeout_ms);
 }
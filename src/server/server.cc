@@ -1,6 +1,18 @@
 #include "server/server.h"
 #include "http/http_conn.h"
-#include "pool/sql_conn_pool.h"
+#include "pool/circuit_breaker.h"
+#include "pool/sql_router.h"
+#include "RAIIs/sql_conn_RAII.hpp"
+#include "metrics/alloc_stats.h"
+#include "metrics/metrics.h"
+#include "metrics/latency_stats.h"
+#include "metrics/trace_ring.h"
+#include "metrics/probes.h"
+#include "metrics/profiled_mutex.h"
+#include "auth/auth_cache.h"
+#include "auth/register_writer.h"
+#include "auth/session_store.h"
+#include "auth/user_filter.h"
 
 #include <unistd.h>
 #include <assert.h>
@@ -9,44 +21,100 @@
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <chrono>
+#include <signal.h>
 
 Server::Server(
     int port, int trigger_mode, int timeout_ms, bool opt_linger,
-    int sql_port, const char* sql_username, const char* sql_password, const char* sql_dbname)
-    : _port(port), _timeout_ms(timeout_ms), _opt_linger(opt_linger), _is_close(false), _src_dir(getcwd(nullptr, 256))
+    int sql_port, const char* sql_username, const char* sql_password, const char* sql_dbname,
+    int conn_pool_num, int thread_num, bool use_log, int log_level,
+    const std::vector<MysqlParam>& sql_replicas, int admin_port, int conn_prewarm, bool huge_pages,
+    Log::MODE log_mode, const LogRotatePolicy& log_rotate,
+    const char* flight_recorder, size_t flight_recorder_size,
+    int trace_threshold_ms, double trace_percentile)
+    : _port(port), _timeout_ms(timeout_ms), _opt_linger(opt_linger), _is_close(false),
+    _listen_fd(-1), _admin_fd(-1), _admin_stop(false),
+    _thread_pool(new ThreadPool(thread_num, "worker_pool")), _db_pool(new ThreadPool(conn_pool_num, "db_pool")),
+    _epoller(new Epoller()), _timer(new Timer())
     {
-    Log::instance().init();
-    assert(!_src_dir.empty());
+    if (use_log) {
+        Log::instance().setRotatePolicy(log_rotate);
+        Log::instance().init(log_level, "./log", ".log", 16, 1000, 3000, log_mode);
+        // 必须在init之后、工作线程开始写日志之前打开
+        if (flight_recorder != nullptr and !Log::instance().enableFlightRecorder(flight_recorder, flight_recorder_size)) {
+            LOG_ERROR("Flight recorder open failed! path:[%s]", flight_recorder)
+        }
+    }
+    char cwd[256];
+    _src_dir = getcwd(cwd, sizeof cwd) != nullptr ? cwd : ".";
     _src_dir += "/resources/"; // 这样加载资源路径？
     HttpConn::user_count = 0;
     HttpConn::src_dir = _src_dir.c_str();
+    // 在Reactor线程里建池写页，内存留在本节点
+    _users.reset(new HttpConnPool(conn_prewarm < MAX_FD ? conn_prewarm : MAX_FD, huge_pages));
     MysqlParam mp {
         "localhost", sql_username, sql_password,
         sql_dbname,sql_port
     };
-    SqlConnPool::instance().init(mp);
+    // 常驻一半连接，高峰时扩到conn_pool_num
+    SqlConnPool::instance(conn_pool_num).init(mp, (conn_pool_num + 1) / 2);
+    SqlRouter::instance().init(&SqlConnPool::instance(), sql_replicas, conn_pool_num);
+    // 熔断后用主库的一条连接试探，ping不通就重连一次
+    CircuitBreaker::instance().init([] {
+        SqlConn sql(&SqlConnPool::instance(), 500);
+        return sql and (sql->ping() or sql->reconnect());
+    });
+    UserFilter::instance().load(SqlConnPool::instance());
+    RegisterWriter::instance().init(&SqlConnPool::instance());
+    AuthCache::instance().init();
+    SessionStore::instance().init();
 
+    // 对端关闭后再writev会收到SIGPIPE，默认动作是退出进程；流水线请求的响应常在客户端断开时还没写完
+    struct sigaction ign;
+    memset(&ign, 0, sizeof ign);
+    ign.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ign, nullptr);
     _initEventMode(trigger_mode);
     if (!_initSocket()) {
         LOG_ERROR("######## Server init failed! ########")
         _is_close = true;
         assert(!_is_close);
     }
+    _initMetrics(trace_threshold_ms, trace_percentile);
+    if (admin_port > 0 and !_initAdminSocket(admin_port)) {
+        LOG_ERROR("Admin socket init failed! port:[%d]", admin_port)
+    }
     LOG_INFO("######## Server init done! ########")
     LOG_INFO("Port: %d", _port)
     LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                 _listen_event & EPOLLET ? "ET" : "LT",
                 _conn_event & EPOLLET ? "ET" : "LT")
-    LOG_INFO("Open Linger: %d", _opt_linger ? "true" : "false")
+    LOG_INFO("Open Linger: %s", _opt_linger ? "true" : "false")
     LOG_INFO("Src Dir: %s", HttpConn::src_dir)
-    LOG_INFO("SqlConnPool size: %d, ThreadPool size: %d",
-            SqlConnPool::instance().getMaxSize(), _thread_pool->getMaxSize())
+    LOG_INFO("SqlConnPool size: %d, ThreadPool size: %d, DbPool size: %d",
+            SqlConnPool::instance().getMaxSize(), _thread_pool->getMaxSize(), _db_pool->getMaxSize())
 }
 
 Server::~Server() {
     close(_listen_fd);
+    // 先停管理线程，它生成指标时会读下面要关闭的各个池
+    _admin_stop = true;
+    if (_admin_thread.joinable()) {
+        _admin_thread.join();
+    }
+    if (_admin_fd >= 0) {
+        close(_admin_fd);
+    }
     _is_close = true;
-    free((void*)_src_dir.c_str());
+    std::string allocs = AllocStats::summary();
+    if (!allocs.empty()) {
+        LOG_INFO("Allocations: %s", allocs.c_str())
+    }
+    RegisterWriter::instance().close();
+    CircuitBreaker::instance().close();
+    SqlRouter::instance().close();
     SqlConnPool::instance().close();
 }
 
@@ -55,10 +123,14 @@ void Server::start() {
     if (!_is_close) {
         LOG_INFO("######## Server start! ########")
     }
+    // 连接超时和服务器内部的周期任务共用一个定时器
+    _sweepSessions();
+    _refreshTraceThreshold();
     while (!_is_close) {
-        if (_timeout_ms > 0) {
-            time_ms = _timer->getNextTick();
+        if (TraceRing::takeDumpRequest()) {
+            _dumpTraces();
         }
+        time_ms = _timer->getNextTick();
         int event_count = _epoller->wait(time_ms);
         for (int i = 0; i < event_count; ++i) {
             int fd = _epoller->getEventFd(i);
@@ -69,11 +141,11 @@ void Server::start() {
                 continue;
             }
             // 如果既不是监听也不是连接socket，报错
-            if (_users.find(fd) == _users.end()) {
+            HttpConn* conn = _users->find(fd);
+            if (conn == nullptr) {
                 LOG_ERROR("Bad fd when dealing events!")
-                assert(_users.find(fd) != _users.end());
+                assert(conn != nullptr);
             }
-            HttpConn* conn = &_users[fd];
             // 连接socket，处理不同事件
             // 客户端结束读 | 客户端结束读写 | 客户端错误
             if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -96,14 +168,16 @@ void Server::start() {
 //private methods
 void Server::_addClient(int fd, sockaddr_in addr) {
     assert(fd > 0);
-    _users[fd].init(fd, addr);
+    PROBE3(conn_accept, fd, addr.sin_addr.s_addr, addr.sin_port);
+    HttpConn* conn = _users->get(fd);
+    conn->init(fd, addr);
     if (_timeout_ms > 0) {
-        // bind绑定成员函数和对象以及函数参数，返回function对象供调用
-        _timer->add(fd, _timeout_ms, std::bind(&Server::_closeConn, this, &_users[fd]));
+        // 和任务队列一样用只捕获两个指针的lambda，接入连接时不为回调分配内存
+        _timer->add(fd, _timeout_ms, [this, conn] { _closeConn(conn); });
     }
     _epoller->addFd(fd, EPOLLIN | _conn_event);
     _setFdNonblock(fd);
-    LOG_INFO("Add new client! fd:[%s]", _users[fd].getFd());
+    LOG_INFO_RATE(10, "Add new client! fd:[%d]", conn->getFd())
 }
 
 void Server::_dealListen() {
@@ -118,29 +192,134 @@ void Server::_dealListen() {
         if (HttpConn::user_count >= MAX_FD) {
             _sendError(fd, "Server busy!");
             close(fd);
-            LOG_WARN("Too many clients!")
+            LOG_WARN_RATE(1, "Too many clients!")
             return;
         }
         _addClient(fd, addr);
     } while (_listen_event & EPOLLET);
 }
 
+void Server::_adminLoop() {
+    // 带超时等待，以便析构时能及时退出
+    struct pollfd pfd = { _admin_fd, POLLIN, 0 };
+    while (!_admin_stop) {
+        if (poll(&pfd, 1, ADMIN_IO_MS) <= 0) {
+            continue;
+        }
+        struct sockaddr_in addr;
+        socklen_t len = sizeof addr;
+        int fd = accept(_admin_fd, (struct sockaddr*)&addr, &len);
+        if (fd < 0) {
+            continue;
+        }
+        _setFdNonblock(fd);
+        _serveAdmin(fd);
+    }
+}
+
+void Server::_serveAdmin(int fd) {
+    // 管理请求只有一行GET，不为它建立连接状态；读和写共用一个截止时间，对端再慢也只占用管理线程ADMIN_IO_MS
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ADMIN_IO_MS);
+    auto wait = [fd, &deadline](short events) {
+        long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = { fd, events, 0 };
+        return left > 0 and poll(&pfd, 1, static_cast<int>(left)) > 0;
+    };
+    char req[1024];
+    size_t n = 0;
+    // 读到请求行结束为止
+    while (n < sizeof req - 1 and memchr(req, '\n', n) == nullptr and wait(POLLIN)) {
+        ssize_t ret = recv(fd, req + n, sizeof req - 1 - n, 0);
+        if (ret < 0 and errno == EAGAIN) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        n += static_cast<size_t>(ret);
+    }
+    req[n] = '\0';
+    char method[8] = {0}, path[256] = {0};
+    std::string body;
+    const char* status = "404 Not Found";
+    if (sscanf(req, "%7s %255s", method, path) == 2) {
+        auto it = _admin_routes.find(path);
+        if (it != _admin_routes.end()) {
+            body = it->second();
+            status = "200 OK";
+        }
+    }
+    std::string resp = std::string("HTTP/1.1 ") + status + "\r\n"
+                        + "Content-Type: text/plain; version=0.0.4\r\n"
+                        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                        + "Connection: close\r\n\r\n" + body;
+    // 到截止时间还没写完就放弃剩余部分
+    size_t sent = 0;
+    while (sent < resp.size() and wait(POLLOUT)) {
+        ssize_t ret = send(fd, resp.data() + sent, resp.size() - sent, MSG_NOSIGNAL);
+        if (ret < 0 and errno == EAGAIN) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        sent += static_cast<size_t>(ret);
+    }
+    close(fd);
+}
+
 void Server::_dealRead(HttpConn* client) {
     assert(client != nullptr);
+    AllocScope scope(AllocStats::ROUTE);
+    client->mark(RequestTiming::DISPATCH);
     _extendTime(client);
-    _thread_pool->addTask(std::bind(&Server::_onRead, this, client));
+    // lambda只捕获两个指针，能放进std::function的内部存储；bind对象多一个成员函数指针，每次都要堆分配
+    _thread_pool->addTask([this, client] { _onRead(client); });
+}
+
+void Server::_extendTime(HttpConn* client) {
+    assert(client != nullptr);
+    if (_timeout_ms > 0) {
+        _timer->adjustExpire(client->getFd(), _timeout_ms);
+    }
+}
+
+void Server::_sweepSessions() {
+    SessionStore::instance().sweep();
+    _timer->add(SESSION_SWEEP_ID, SESSION_SWEEP_MS, std::bind(&Server::_sweepSessions, this));
+}
+
+void Server::_refreshTraceThreshold() {
+    TraceRing::instance().refresh();
+    _timer->add(TRACE_REFRESH_ID, TRACE_REFRESH_MS, std::bind(&Server::_refreshTraceThreshold, this));
+}
+
+void Server::_dumpTraces() {
+    // 单行日志长度有限，逐条写
+    std::string traces = TraceRing::instance().dump();
+    size_t pos = 0, end;
+    while ((end = traces.find('\n', pos)) != std::string::npos) {
+        LOG_WARN("%s", traces.substr(pos, end - pos).c_str())
+        pos = end + 1;
+    }
+}
+
+void Server::_onDumpSignal(int) {
+    TraceRing::requestDump();
 }
 
 void Server::_dealWrite(HttpConn* client) {
     assert(client != nullptr);
+    AllocScope scope(AllocStats::ROUTE);
     _extendTime(client);
-    _thread_pool->addTask(std::bind(&Server::_onWrite, this, client));
+    _thread_pool->addTask([this, client] { _onWrite(client); });
 }
 
 bool Server::_initSocket() {
     struct sockaddr_in addr;
     if (_port > 65535 or _port < 1024) {
-        LOG_ERROR("Port error! port:[%s]", _port);
+        LOG_ERROR("Port error! port:[%d]", _port);
         return false;
     }
     addr.sin_family = AF_INET;
@@ -157,7 +336,7 @@ bool Server::_initSocket() {
 
     _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (_listen_fd < 0) {
-        LOG_ERROR("Create socket failed! port:[%s]", _port)
+        LOG_ERROR("Create socket failed! port:[%d]", _port)
         return false;
     }
 
@@ -165,7 +344,7 @@ bool Server::_initSocket() {
     int ret = setsockopt(_listen_fd, SOL_SOCKET, SO_LINGER, (const void*)&opt_linger, sizeof opt_linger);
     if (ret < 0) {
         close(_listen_fd);
-        LOG_ERROR("Set SO_LINGER failed! port:[%s]", _port)
+        LOG_ERROR("Set SO_LINGER failed! port:[%d]", _port)
         return false;
     }
 
@@ -173,7 +352,7 @@ bool Server::_initSocket() {
     int opt_val = 1;
     ret = setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, (const void*)&opt_val, sizeof opt_val);
     if (ret < 0) {
-        LOG_ERROR("Set SO_REUSEADDR failed! port:[%s]", _port)
+        LOG_ERROR("Set SO_REUSEADDR failed! port:[%d]", _port)
         close(_listen_fd);
         return false;
     }
@@ -181,7 +360,7 @@ bool Server::_initSocket() {
     // 绑定监听socket和相应地址
     ret = bind(_listen_fd, (const sockaddr*)&addr, sizeof addr);
     if (ret < 0) {
-        LOG_ERROR("Bind addr failed! port:[%s]", _port)
+        LOG_ERROR("Bind addr failed! port:[%d]", _port)
         close(_listen_fd);
         return false;
     }
@@ -189,7 +368,7 @@ bool Server::_initSocket() {
     // 5是三次握手后established连接数，
     ret = listen(_listen_fd, 5);
     if (ret < 0) {
-        LOG_ERROR("Listen failed! port:[%s]", _port)
+        LOG_ERROR("Listen failed! port:[%d]", _port)
         close(_listen_fd);
         return false;
     }
@@ -207,6 +386,75 @@ bool Server::_initSocket() {
     return true;
 }
 
+bool Server::_initAdminSocket(int admin_port) {
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    // 只对本机开放
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(admin_port);
+
+    _admin_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_admin_fd < 0) {
+        return false;
+    }
+    int opt_val = 1;
+    if (setsockopt(_admin_fd, SOL_SOCKET, SO_REUSEADDR, (const void*)&opt_val, sizeof opt_val) < 0
+            or bind(_admin_fd, (const sockaddr*)&addr, sizeof addr) < 0
+            or listen(_admin_fd, 5) < 0) {
+        close(_admin_fd);
+        _admin_fd = -1;
+        return false;
+    }
+    _setFdNonblock(_admin_fd);
+    // 路由表在_initMetrics里已经建好，之后只读
+    _admin_thread = std::thread(&Server::_adminLoop, this);
+    LOG_INFO("Admin port: 127.0.0.1:%d", admin_port)
+    return true;
+}
+
+void Server::_initMetrics(int trace_threshold_ms, double trace_percentile) {
+    Metrics& m = Metrics::instance();
+    m.addSampler("webserver_connections_active", "Open client connections", "gauge",
+                    [] { return static_cast<double>(HttpConn::user_count.load()); });
+    HttpConnPool* users = _users.get();
+    m.addSampler("webserver_conn_pool_overflow", "Connection objects created beyond the prewarmed pool", "gauge",
+                    [users] { return static_cast<double>(users->getOverflow()); });
+    ThreadPool* workers = _thread_pool.get();
+    ThreadPool* db = _db_pool.get();
+    m.addSampler("webserver_threadpool_queue_depth{pool=\"worker\"}", "Tasks waiting in thread pool", "gauge",
+                    [workers] { return static_cast<double>(workers->getQueueSize()); });
+    m.addSampler("webserver_threadpool_queue_depth{pool=\"db\"}", "Tasks waiting in thread pool", "gauge",
+                    [db] { return static_cast<double>(db->getQueueSize()); });
+    m.addSampler("webserver_sql_pool_free", "Idle connections in the primary SQL pool", "gauge",
+                    [] { return static_cast<double>(SqlConnPool::instance().getFreeConnCount()); });
+    m.addSampler("webserver_sql_pool_size", "Open connections in the primary SQL pool", "gauge",
+                    [] { return static_cast<double>(SqlConnPool::instance().getSize()); });
+    m.addSampler("webserver_log_pending_buffers", "Full log buffers waiting for the writer", "gauge",
+                    [] { return static_cast<double>(Log::instance().getPendingBuffers()); });
+    m.addSampler("webserver_log_dropped_lines_total", "Log lines dropped under backpressure", "counter",
+                    [] { return static_cast<double>(Log::instance().getDroppedLines()); });
+    // 按解析后的路径统计，路径是客户端给的，只登记已知页面，其余归入other
+    LatencyStats::instance().init({
+        "/index.html", "/register.html", "/login.html", "/welcome.html",
+        "/picture.html", "/video.html"
+    });
+    m.addCollector([](std::string& out) { LatencyStats::instance().render(out); });
+    // 只有定义了PROFILE_LOCKS才会有锁登记，否则不输出
+    m.addCollector(ProfiledMutex::render);
+    // 同理，只有定义了TRACK_ALLOCS才输出分配统计
+    m.addCollector(AllocStats::render);
+    _admin_routes["/metrics"] = [] { return Metrics::instance().render(); };
+
+    // 路由表确定之后再初始化，阈值按路由分配
+    TraceRing::instance().init(256, trace_threshold_ms, trace_percentile);
+    _admin_routes["/traces"] = [] { return TraceRing::instance().dump(); };
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = _onDumpSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, nullptr);
+}
+
 void Server::_initEventMode(int trigger_mode) {
     // EPOLLRDHUP 对端描述符产生一个挂断事件（读结束标志，对方不会继续写入，而此时已经存在于缓冲区的数据仍然可读）
     _listen_event = EPOLLRDHUP;
@@ -237,19 +485,21 @@ void Server::_sendError(int fd, const char* info) {
     assert(fd > 0);
     int ret = send(fd, info, strlen(info), 0);
     if (ret < 0) {
-        LOG_ERROR("Send error info to client failed! fd:[%s]", fd)
+        LOG_ERROR("Send error info to client failed! fd:[%d]", fd)
     } 
 }
 
 void Server::_closeConn(HttpConn* client) {
     assert(client != nullptr);
-    LOG_INFO("A client quit! fd:[%s]", client->getFd())
+    LOG_INFO_RATE(10, "A client quit! fd:[%d]", client->getFd())
+    PROBE1(conn_close, client->getFd());
     _epoller->delFd(client->getFd());
     client->close_conn();
 }
 
 void Server::_onRead(HttpConn* client) {
     assert(client != nullptr);
+    client->mark(RequestTiming::WORKER);
     int read_errno = 0;
     int ret = client->read(&read_errno);
     // 这里表示读取结束但实际未到达结尾？
@@ -284,13 +534,29 @@ void Server::_onWrite(HttpConn* client) {
 
 void Server::_onProcess(HttpConn* client) {
     assert(client != nullptr);
+    // 解析和生成响应在HttpConn里另有标记，这里剩下的是分派
+    AllocScope scope(AllocStats::ROUTE);
     if (client->process() == true) {
+        if (client->isWaitingDb()) {
+            // 登录/注册需要查库，转交DB线程池，当前工作线程立即返回去处理别的请求
+            // EPOLLONESHOT保证在DB完成之前这个连接不会再被触发
+            _db_pool->addTask([this, client] { _onDb(client); });
+            return;
+        }
         _epoller->modFd(client->getFd(), _conn_event | EPOLLOUT);
     } else {
         _epoller->modFd(client->getFd(), _conn_event | EPOLLIN);
     }
 }
 
+// DB线程池中执行，完成后生成响应并重新注册写事件，相当于完成回调
+void Server::_onDb(HttpConn* client) {
+    assert(client != nullptr);
+    client->mark(RequestTiming::DB_START);
+    client->processDb();
+    _epoller->modFd(client->getFd(), _conn_event | EPOLLOUT);
+}
+
 int Server::_setFdNonblock(int fd) {
     assert(fd > 0);
     // 添加non-block属性 F_GETFL or F_GETFD?
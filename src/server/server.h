@@ -13,13 +13,19 @@
 #define SERVER_H
 
 #include "log/log.h"
+#include "http/http_conn.h"
+#include "http/http_conn_pool.h"
 #include "pool/thread_pool.hpp"
-#include "pool/sql_conn_pool.h"
+#include "pool/sql_router.h"
 #include "timer/timer.h"
 #include "epoller.h"
 
+#include <atomic>
+#include <functional>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 class Server {
 public:
@@ -34,24 +40,48 @@ public:
      * @param sql_username sql用户名
      * @param sql_password sql密码
      * @param sql_dbname sql数据库名
+     * @param conn_pool_num sql连接池大小，同时也是DB线程池大小
+     * @param thread_num 工作线程池大小
      * @param use_log 是否启用日志
      * @param log_level 默认日志等级
+     * @param sql_replicas 只读副本，登录查询分摊到这些实例上，每个副本的连接池大小同conn_pool_num
+     * @param admin_port 管理端口，只监听127.0.0.1，提供/metrics等；0表示不开启
+     * @param conn_prewarm 启动时预分配的连接对象数，按fd下标使用，应不小于预期的最大fd；0表示全部按需创建
+     * @param huge_pages 预分配的连接池是否使用大页
+     * @param log_mode 日志模式，DEFERRED/BINARY把格式化移出请求线程
+     * @param log_rotate 日志滚动策略
+     * @param flight_recorder 黑匣子文件路径，崩溃后用tools/flight_dump读出最近的日志；nullptr表示不开启
+     * @param flight_recorder_size 黑匣子文件大小，决定保留多少条最近的日志
+     * @param trace_threshold_ms 慢请求采样的固定阈值，总耗时不低于它的请求进入/traces
+     * @param trace_percentile 大于0时改用各路由总耗时的这个分位数作为采样阈值，如0.99
      */
     Server(
         int port, int trigger_mode, int timeout_ms, bool opt_linger,
-        int sql_port, const char* sql_username, const char* sql_password, const char* sql_dbname
+        int sql_port, const char* sql_username, const char* sql_password, const char* sql_dbname,
+        int conn_pool_num, int thread_num, bool use_log, int log_level,
+        const std::vector<MysqlParam>& sql_replicas = {}, int admin_port = 0,
+        int conn_prewarm = 0, bool huge_pages = false,
+        Log::MODE log_mode = Log::MODE::TEXT,
+        const LogRotatePolicy& log_rotate = {LogRotatePolicy::DAILY, 50000, 0, false},
+        const char* flight_recorder = nullptr, size_t flight_recorder_size = 64 * 1024 * 1024,
+        int trace_threshold_ms = 100, double trace_percentile = 0
     );
     ~Server();
     void start();
 
 private:
     bool _initSocket();
+    bool _initAdminSocket(int admin_port);
+    void _initMetrics(int trace_threshold_ms, double trace_percentile);
     void _initEventMode(int trigger_mode);
     void _addClient(int fd, sockaddr_in addr);
 
     void _dealListen();
     void _dealRead(HttpConn* client);
     void _dealWrite(HttpConn* client);
+    // 管理端口有自己的线程，不经过Reactor和工作线程池，压测时也能及时拉到指标
+    void _adminLoop();
+    void _serveAdmin(int fd);
 
     void _sendError(int fd, const char* info);
     void _extendTime(HttpConn* client);
@@ -60,19 +90,36 @@ private:
     void _onRead(HttpConn* client);
     void _onWrite(HttpConn* client);
     void _onProcess(HttpConn* client);
+    void _onDb(HttpConn* client);
+
+    // 周期任务：每次清理会话表的一个分片，然后重新挂到定时器上
+    void _sweepSessions();
+    // 周期任务：按分位数刷新慢请求阈值
+    void _refreshTraceThreshold();
+    // SIGUSR2：把慢请求记录写进日志
+    static void _onDumpSignal(int sig);
+    void _dumpTraces();
 
     int _setFdNonblock(int fd);
     
     static const int MAX_FD = 65536;
+    // 定时器id：连接用fd（非负），服务器内部任务用负数
+    static const int SESSION_SWEEP_ID = -1;
+    static const int SESSION_SWEEP_MS = 1000;
+    static const int TRACE_REFRESH_ID = -2;
+    static const int TRACE_REFRESH_MS = 1000;
+    // 一次管理请求从读到写完的总时限
+    static const int ADMIN_IO_MS = 100;
 
     int _port;
     int _timeout_ms;
     bool _opt_linger;
     bool _is_close;
     int _listen_fd;
+    int _admin_fd;
+    std::atomic<bool> _admin_stop;
+    std::thread _admin_thread;
 
-    // 注意！_src_dir由getcwd()产生，getcwd()使用了malloc，
-    // 程序结束需要free()掉_src_dir内部的指针
     std::string _src_dir;
 
     // 我猜这是监听socket和连接socket
@@ -81,9 +128,16 @@ private:
     uint32_t _conn_event;
 
     std::unique_ptr<ThreadPool> _thread_pool;
-    std::unordered_map<int, HttpConn> _users;
+    // 专门执行数据库请求的线程池，慢查询不会占住处理静态资源的工作线程
+    std::unique_ptr<ThreadPool> _db_pool;
+    // fd -> 连接，预分配的部分在启动时建好
+    std::unique_ptr<HttpConnPool> _users;
     std::unique_ptr<Epoller> _epoller;
     std::unique_ptr<Timer> _timer;
+
+    // 管理端口的路径 -> 生成响应体的函数
+    typedef std::function<std::string()> AdminHandler;
+    std::unordered_map<std::string, AdminHandler> _admin_routes;
 };
 
 #endif // SERVER_H
\ No newline at end of file
@@ -2,7 +2,10 @@
 
 #include <assert.h>
 
-Timer::Timer(): _heap(64) {}
+Timer::Timer() {
+    // 只预留空间，_heap(64)会构造64个空节点
+    _heap.reserve(64);
+}
 
 Timer::~Timer() {
 
@@ -17,29 +20,31 @@ void Timer::adjustExpire(int id, int timeout) {
 
 // 添加/覆盖一个计时器
 void Timer::add(int id, int timeout, const TimeoutCallback& tcb) {
-    assert(id >= 0);
     size_t i;
     // 新的id，添加到堆
     if (_ref.find(id) == _ref.end()) {
         i = _heap.size();
         _ref[id] = i;
-        _heap.emplace_back(id, Clock::now() + Ms(timeout), tcb);
+        _heap.push_back(TimerNode{id, Clock::now() + Ms(timeout), tcb});
         _siftup(i);
         return;
     }
-    // 已有id，覆盖原有计时器
+    // 已有id，覆盖原有计时器，到期时间可能变早也可能变晚
     i = _ref[id];
     _heap[i].expire = Clock::now() + Ms(timeout);
     _heap[i].tcb = tcb;
+    _siftup(i);
+    _siftdown(_ref[id]);
 }
 
 void Timer::doWork(int id) {
     if (_ref.find(id) == _ref.end()) {
         return;
     }
-    size_t i = _ref[id];
-    _heap[i].tcb();
-    _delete(i);
+    // 先移出堆再回调，回调里可以重新add同一个id
+    TimeoutCallback tcb = std::move(_heap[_ref[id]].tcb);
+    _delete(_ref[id]);
+    tcb();
 }
 
 /**
@@ -51,23 +56,24 @@ void Timer::doWork(int id) {
  */
 int Timer::getNextTick() {
     _tick();
-    size_t res = -1;
+    int64_t res = -1;
     if (!_heap.empty()) {
         res = std::chrono::duration_cast<Ms>(_heap.front().expire - Clock::now()).count();
         res = res < 0 ? 0 : res;
     }
-    return res;
+    return static_cast<int>(res);
 }
 
 //private method
 void Timer::_tick() {
     while (!_heap.empty()) {
-        const TimerNode& node = _heap.front();
-        if (std::chrono::duration_cast<Ms>(node.expire - Clock::now()).count() > 0) {
+        if (std::chrono::duration_cast<Ms>(_heap.front().expire - Clock::now()).count() > 0) {
             break;
         }
-        node.tcb();
+        // 先出堆再回调：周期任务会在回调里重新add自己
+        TimeoutCallback tcb = std::move(_heap.front().tcb);
         _pop();
+        tcb();
     }
 }
 
@@ -81,24 +87,25 @@ void Timer::_delete(size_t i) {
     _swap(i, _heap.size()-1);
     _ref.erase(_heap.back().id);
     _heap.pop_back();
-    _siftup(i);
-    _siftdown(i);
-    
+    // 删除的恰好是末尾节点时无需调整
+    if (i < _heap.size()) {
+        _siftup(i);
+        _siftdown(i);
+    }
 }
 
 // 向上调整只需关注父节点
 void Timer::_siftup(size_t i) {
     assert(i >= 0 and i < _heap.size());
-    // j为父节点索引位置
-    size_t j = (i - 1) / 2;
-    while (j >= 0) {
+    // j为父节点索引位置，size_t无法小于0，以i到达堆顶为终止条件
+    while (i > 0) {
+        size_t j = (i - 1) / 2;
         // 重载了TimerNode的operator<
         if (_heap[j] < _heap[i]) {
             break;
         }
         _swap(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -0,0 +1,114 @@
+/**
+ * @file flight_dump.cc
+ * @author weilai
+ * @brief 解码Log::enableFlightRecorder写出的黑匣子文件，按写入顺序输出最后保留的日志
+ *        独立构建：g++ -std=c++14 -I src src/tools/flight_dump.cc src/log/log_record.cc src/log/log_clock.cc -o flight_dump
+ *        用法：./flight_dump flight.rec [最后N条]
+ * @version 0.1
+ * @date 2023-08-24
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "log/flight_recorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct DumpFormat {
+    int level;
+    std::string format;
+};
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <flight.rec> [last_n]\n", argv[0]);
+        return 1;
+    }
+    size_t last_n = argc > 2 ? strtoul(argv[2], nullptr, 10) : 0;
+
+    int fd = open(argv[1], O_RDONLY);
+    struct stat st;
+    if (fd < 0 or fstat(fd, &st) != 0) {
+        fprintf(stderr, "open %s failed\n", argv[1]);
+        return 1;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED or size < FLIGHT_HEADER_SIZE) {
+        fprintf(stderr, "mmap %s failed\n", argv[1]);
+        return 1;
+    }
+    const char* base = static_cast<const char*>(p);
+    const FlightHeader* h = reinterpret_cast<const FlightHeader*>(base);
+    if (memcmp(h->magic, FLIGHT_MAGIC, sizeof h->magic) != 0 or h->version != FLIGHT_VERSION
+            or FLIGHT_HEADER_SIZE + h->dict_capacity + h->slot_count * h->slot_size > size) {
+        fprintf(stderr, "%s is not a flight recorder file\n", argv[1]);
+        return 1;
+    }
+
+    // 读字典
+    std::unordered_map<uint32_t, DumpFormat> formats;
+    const char* dict = base + FLIGHT_HEADER_SIZE;
+    uint64_t used = std::min<uint64_t>(h->dict_used.load(), h->dict_capacity);
+    for (uint64_t off = 0; off + 3 * sizeof(uint32_t) <= used; ) {
+        uint32_t id, level, len;
+        memcpy(&id, dict + off, sizeof id);
+        memcpy(&level, dict + off + sizeof(uint32_t), sizeof level);
+        memcpy(&len, dict + off + 2 * sizeof(uint32_t), sizeof len);
+        off += 3 * sizeof(uint32_t);
+        if (off + len > used) {
+            break;
+        }
+        formats[id] = DumpFormat{static_cast<int>(level), std::string(dict + off, len)};
+        off += len;
+    }
+
+    // 收集已发布的槽位，按seq排序还原写入顺序
+    const char* slots = dict + h->dict_capacity;
+    std::vector<std::pair<uint64_t, const FlightSlot*>> live;
+    for (uint64_t i = 0; i < h->slot_count; ++i) {
+        const FlightSlot* s = reinterpret_cast<const FlightSlot*>(slots + i * h->slot_size);
+        uint64_t seq = s->seq.load();
+        if (seq != 0) {
+            live.emplace_back(seq, s);
+        }
+    }
+    std::sort(live.begin(), live.end(),
+        [](const std::pair<uint64_t, const FlightSlot*>& a, const std::pair<uint64_t, const FlightSlot*>& b) {
+            return a.first < b.first;
+        });
+    size_t begin = last_n > 0 and last_n < live.size() ? live.size() - last_n : 0;
+
+    char line[logrec::MAX_STRING * 8];
+    for (size_t i = begin; i < live.size(); ++i) {
+        const FlightSlot* s = live[i].second;
+        const LogRecordHeader& rec = s->header;
+        auto it = formats.find(rec.fmt_id);
+        if (it == formats.end() or rec.size < sizeof rec
+                or rec.size - sizeof rec > h->slot_size - sizeof(FlightSlot)) {
+            continue;
+        }
+        const char* args = reinterpret_cast<const char*>(s) + sizeof(FlightSlot);
+        int64_t ns = h->anchor_real_ns + (rec.ts - h->anchor_steady_ns);
+        timeval tv;
+        tv.tv_sec = static_cast<time_t>(ns / 1000000000);
+        tv.tv_usec = static_cast<suseconds_t>(ns % 1000000000 / 1000);
+        size_t len = logrec::formatLine(line, sizeof line, it->second.level, it->second.format.c_str(),
+                        args, args + (rec.size - sizeof rec), tv);
+        fwrite(line, 1, len, stdout);
+    }
+    munmap(p, size);
+    return 0;
+}
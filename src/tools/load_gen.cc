@@ -0,0 +1,861 @@
+/**
+ * @file load_gen.cc
+ * @author weilai
+ * @brief 压测工具：经回环地址驱动服务器，支持固定并发（闭环）和固定到达率（开环）两种模式。
+ *        开环模式下延迟从计划发送时刻算起，服务端变慢时排队的时间也计入，避免协同遗漏；
+ *        同时给出从实际发送算起的服务时间作对照。
+ *        独立构建：g++ -std=c++14 -O2 -I src src/tools/load_gen.cc -o load_gen -lpthread
+ *        进程内启动服务器需额外加-DLOAD_GEN_INPROC并链接服务器全部源文件（除main.cc）及-lmysqlclient -lz
+ *        用法：./load_gen -c 64 -d 10 -m get=/index.html:8,range=/video.html:1,login:1
+ *              ./load_gen -R 20000 -c 64 -P 4 --server ./server
+ * @version 0.1
+ * @date 2023-09-01
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "metrics/histogram.hpp"
+
+#ifdef LOAD_GEN_INPROC
+#include "server/server.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 响应头超过这个长度视为异常
+static const size_t MAX_HEADER_LEN = 65536;
+// range请求在文件前RANGE_SPAN字节内随机取RANGE_LEN字节
+static const long RANGE_SPAN = 1 << 20;
+static const long RANGE_LEN = 64 << 10;
+static const int RECONNECT_DELAY_US = 100000;
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Config {
+    std::string host = "127.0.0.1";
+    int port = 9006;
+    int conns = 16;
+    int threads = 0;
+    double duration_s = 10;
+    double warmup_s = 1;
+    bool keep_alive = true;
+    int depth = 1;
+    // 总到达率，0表示闭环
+    double rate = 0;
+    std::string mix = "get=/index.html:1";
+    std::string user = "loadgen";
+    std::string password = "loadgen";
+    std::string server_cmd;
+    // 服务器管理端口，非0时读取/metrics中的分配统计（TRACK_ALLOCS构建）
+    int admin_port = 0;
+    bool inproc = false;
+};
+
+// 请求组成中的一类请求，延迟分开统计
+struct MixEntry {
+    enum TYPE { GET, RANGE, LOGIN };
+    TYPE type;
+    std::string path;
+    int weight;
+    std::string name;
+    // 不随请求变化的部分预先拼好
+    std::string head;
+    std::string tail;
+    Histogram latency;
+    Histogram service;
+    std::atomic<uint64_t> done{0};
+};
+
+struct Totals {
+    std::atomic<uint64_t> done{0};
+    std::atomic<uint64_t> bytes_in{0};
+    std::atomic<uint64_t> connects{0};
+    std::atomic<uint64_t> connect_errors{0};
+    // 连接中途断开而丢失的请求
+    std::atomic<uint64_t> io_errors{0};
+    std::atomic<uint64_t> status[6];
+    Histogram latency;
+    Histogram service;
+    Totals() {
+        for (auto& s : status) {
+            s = 0;
+        }
+    }
+};
+
+static Config g_cfg;
+static std::vector<std::unique_ptr<MixEntry>> g_mix;
+static int g_mix_weight = 0;
+static Totals g_totals;
+static sockaddr_in g_addr;
+static int64_t g_start_us = 0;
+static int64_t g_record_us = 0;
+static int64_t g_stop_us = 0;
+
+static bool parseMix(const std::string& spec) {
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        std::string item = spec.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        pos = end == std::string::npos ? spec.size() : end + 1;
+
+        std::unique_ptr<MixEntry> e(new MixEntry);
+        e->weight = 1;
+        size_t colon = item.rfind(':');
+        if (colon != std::string::npos) {
+            e->weight = atoi(item.c_str() + colon + 1);
+            item.resize(colon);
+        }
+        size_t eq = item.find('=');
+        std::string type = item.substr(0, eq);
+        if (type == "get") {
+            e->type = MixEntry::GET;
+            e->path = "/index.html";
+        } else if (type == "range") {
+            e->type = MixEntry::RANGE;
+            e->path = "/video.html";
+        } else if (type == "login") {
+            e->type = MixEntry::LOGIN;
+            e->path = "/login.html";
+        } else {
+            fprintf(stderr, "unknown request type in mix: %s\n", type.c_str());
+            return false;
+        }
+        if (eq != std::string::npos) {
+            e->path = item.substr(eq + 1);
+        }
+        if (e->weight <= 0 or e->path.empty() or e->path[0] != '/') {
+            fprintf(stderr, "bad mix item: %s\n", item.c_str());
+            return false;
+        }
+        e->name = type + " " + e->path;
+        g_mix_weight += e->weight;
+        g_mix.emplace_back(std::move(e));
+    }
+    return !g_mix.empty();
+}
+
+static void buildRequests() {
+    std::string common = "Host: " + g_cfg.host + ":" + std::to_string(g_cfg.port) + "\r\n"
+                            + "Connection: " + (g_cfg.keep_alive ? "keep-alive" : "close") + "\r\n";
+    for (auto& e : g_mix) {
+        if (e->type == MixEntry::LOGIN) {
+            std::string body = "username=" + g_cfg.user + "&password=" + g_cfg.password;
+            e->head = "POST " + e->path + " HTTP/1.1\r\n" + common
+                        + "Content-Type: application/x-www-form-urlencoded\r\n"
+                        + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+        } else {
+            e->head = "GET " + e->path + " HTTP/1.1\r\n" + common;
+            e->tail = "\r\n";
+        }
+    }
+}
+
+struct Pending {
+    MixEntry* entry;
+    int64_t sched_us;
+    int64_t sent_us;
+};
+
+struct Conn {
+    int fd = -1;
+    bool connecting = false;
+    bool want_out = false;
+    // 短连接已经发过请求
+    bool used = false;
+    int64_t retry_us = 0;
+    // 开环模式下一次计划发送的时刻
+    double next_us = 0;
+    double interval_us = 0;
+    std::string out;
+    size_t out_pos = 0;
+    // 已发送等待响应的请求，和计划了但受流水线深度限制还没发出的请求
+    std::deque<Pending> inflight;
+    std::deque<Pending> backlog;
+    // 响应解析状态
+    std::string header;
+    bool header_done = false;
+    int status = 0;
+    // -1表示没有Content-length，读到连接关闭为止
+    long body_left = 0;
+};
+
+class Worker {
+public:
+    Worker(int conn_count, int first, int total): _conns(conn_count), _rng(std::random_device{}() + first) {
+        double interval = g_cfg.rate > 0 ? total * 1e6 / g_cfg.rate : 0;
+        for (int i = 0; i < conn_count; ++i) {
+            _conns[i].interval_us = interval;
+            // 各连接的发送时刻错开，避免整齐的突发
+            _conns[i].next_us = g_start_us + interval * (first + i) / total;
+        }
+    }
+
+    void run() {
+        _epfd = epoll_create1(0);
+        for (auto& c : _conns) {
+            _connect(c);
+        }
+        epoll_event events[256];
+        while (true) {
+            int64_t now = nowUs();
+            if (now >= g_stop_us) {
+                break;
+            }
+            for (auto& c : _conns) {
+                _pump(c, now);
+            }
+            int n = epoll_wait(_epfd, events, 256, _waitMs(now));
+            for (int i = 0; i < n; ++i) {
+                Conn& c = *static_cast<Conn*>(events[i].data.ptr);
+                if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+                    _onWritable(c);
+                }
+                if (c.fd >= 0 and (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) {
+                    _onReadable(c);
+                }
+            }
+        }
+        for (auto& c : _conns) {
+            _unfinished += c.inflight.size() + c.backlog.size();
+            _censor(c);
+            _close(c);
+        }
+        close(_epfd);
+    }
+
+    uint64_t getUnfinished() const {
+        return _unfinished;
+    }
+
+private:
+    int _waitMs(int64_t now) const {
+        int64_t wait = 100000;
+        for (auto& c : _conns) {
+            if (c.fd < 0) {
+                wait = std::min(wait, c.retry_us - now);
+            } else if (g_cfg.rate > 0) {
+                wait = std::min(wait, static_cast<int64_t>(c.next_us) - now);
+            }
+        }
+        wait = std::min(wait, g_stop_us - now);
+        return wait <= 0 ? 0 : static_cast<int>((wait + 999) / 1000);
+    }
+
+    MixEntry* _pick() {
+        int r = std::uniform_int_distribution<int>(0, g_mix_weight - 1)(_rng);
+        for (auto& e : g_mix) {
+            r -= e->weight;
+            if (r < 0) {
+                return e.get();
+            }
+        }
+        return g_mix.back().get();
+    }
+
+    void _connect(Conn& c) {
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        int ret = connect(c.fd, reinterpret_cast<sockaddr*>(&g_addr), sizeof g_addr);
+        if (ret < 0 and errno != EINPROGRESS) {
+            g_totals.connect_errors++;
+            close(c.fd);
+            c.fd = -1;
+            c.retry_us = nowUs() + RECONNECT_DELAY_US;
+            return;
+        }
+        c.connecting = ret < 0;
+        c.want_out = true;
+        c.used = false;
+        c.header.clear();
+        c.header_done = false;
+        epoll_event ev = {0};
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.ptr = &c;
+        epoll_ctl(_epfd, EPOLL_CTL_ADD, c.fd, &ev);
+        g_totals.connects++;
+    }
+
+    void _close(Conn& c) {
+        if (c.fd < 0) {
+            return;
+        }
+        close(c.fd);
+        c.fd = -1;
+        c.connecting = false;
+        c.out.clear();
+        c.out_pos = 0;
+        c.inflight.clear();
+    }
+
+    // 连接中途断开：已发出的请求记为失败，计划中的请求留给新连接
+    void _reset(Conn& c) {
+        g_totals.io_errors += c.inflight.size();
+        _close(c);
+        c.retry_us = nowUs() + RECONNECT_DELAY_US;
+    }
+
+    void _pump(Conn& c, int64_t now) {
+        if (g_cfg.rate > 0) {
+            while (c.next_us <= now) {
+                c.backlog.push_back({_pick(), static_cast<int64_t>(c.next_us), 0});
+                c.next_us += c.interval_us;
+            }
+        }
+        if (c.fd < 0) {
+            if (now >= c.retry_us and (g_cfg.rate <= 0 or !c.backlog.empty())) {
+                _connect(c);
+            }
+            return;
+        }
+        if (c.connecting) {
+            return;
+        }
+        // 短连接一条连接只发一个请求
+        size_t depth = g_cfg.keep_alive ? static_cast<size_t>(g_cfg.depth) : 1;
+        bool added = false;
+        while (c.inflight.size() < depth) {
+            if (!g_cfg.keep_alive and c.used) {
+                break;
+            }
+            Pending p;
+            if (g_cfg.rate > 0) {
+                if (c.backlog.empty()) {
+                    break;
+                }
+                p = c.backlog.front();
+                c.backlog.pop_front();
+            } else {
+                p = {_pick(), now, 0};
+            }
+            p.sent_us = now;
+            _append(c, p.entry);
+            c.inflight.push_back(p);
+            c.used = true;
+            added = true;
+        }
+        if (added) {
+            _flush(c);
+        }
+    }
+
+    void _append(Conn& c, const MixEntry* e) {
+        if (c.out_pos == c.out.size()) {
+            c.out.clear();
+            c.out_pos = 0;
+        }
+        c.out += e->head;
+        if (e->type == MixEntry::RANGE) {
+            long start = std::uniform_int_distribution<long>(0, RANGE_SPAN - RANGE_LEN)(_rng);
+            c.out += "Range: bytes=" + std::to_string(start) + "-" + std::to_string(start + RANGE_LEN - 1) + "\r\n";
+        }
+        c.out += e->tail;
+    }
+
+    void _flush(Conn& c) {
+        while (c.out_pos < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if (n < 0 and errno == EAGAIN) {
+                break;
+            }
+            if (n <= 0) {
+                _reset(c);
+                return;
+            }
+            c.out_pos += static_cast<size_t>(n);
+        }
+        bool want_out = c.out_pos < c.out.size();
+        if (want_out != c.want_out) {
+            c.want_out = want_out;
+            epoll_event ev = {0};
+            ev.events = EPOLLIN;
+            if (want_out) {
+                ev.events |= EPOLLOUT;
+            }
+            ev.data.ptr = &c;
+            epoll_ctl(_epfd, EPOLL_CTL_MOD, c.fd, &ev);
+        }
+    }
+
+    void _onWritable(Conn& c) {
+        if (c.connecting) {
+            int err = 0;
+            socklen_t len = sizeof err;
+            getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                g_totals.connect_errors++;
+                _close(c);
+                c.retry_us = nowUs() + RECONNECT_DELAY_US;
+                return;
+            }
+            c.connecting = false;
+            _pump(c, nowUs());
+        }
+        // 同时负责在没有待发数据时关掉EPOLLOUT
+        if (c.fd >= 0) {
+            _flush(c);
+        }
+    }
+
+    void _onReadable(Conn& c) {
+        char buf[65536];
+        while (c.fd >= 0) {
+            ssize_t n = recv(c.fd, buf, sizeof buf, 0);
+            if (n < 0 and errno == EAGAIN) {
+                return;
+            }
+            if (n <= 0) {
+                // 没有Content-length的响应以关闭连接结束
+                if (c.header_done and c.body_left < 0) {
+                    _complete(c);
+                }
+                if (c.inflight.empty()) {
+                    _close(c);
+                    c.retry_us = nowUs();
+                } else {
+                    _reset(c);
+                }
+                return;
+            }
+            g_totals.bytes_in += static_cast<uint64_t>(n);
+            if (!_feed(c, buf, static_cast<size_t>(n))) {
+                _reset(c);
+                return;
+            }
+        }
+    }
+
+    // 解析响应；响应体只计数不保存
+    bool _feed(Conn& c, const char* p, size_t n) {
+        while (n > 0) {
+            if (!c.header_done) {
+                size_t old = c.header.size();
+                c.header.append(p, n);
+                size_t end = c.header.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+                if (end == std::string::npos) {
+                    return c.header.size() <= MAX_HEADER_LEN;
+                }
+                size_t used = end + 4 - old;
+                p += used;
+                n -= used;
+                c.header.resize(end + 2);
+                if (c.inflight.empty() or !_parseHeader(c)) {
+                    return false;
+                }
+                c.header_done = true;
+                if (c.body_left == 0) {
+                    _complete(c);
+                }
+            } else if (c.body_left < 0) {
+                return true;
+            } else {
+                size_t take = std::min(n, static_cast<size_t>(c.body_left));
+                c.body_left -= static_cast<long>(take);
+                p += take;
+                n -= take;
+                if (c.body_left == 0) {
+                    _complete(c);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool _parseHeader(Conn& c) {
+        const std::string& h = c.header;
+        if (h.compare(0, 5, "HTTP/") != 0) {
+            return false;
+        }
+        size_t sp = h.find(' ');
+        if (sp == std::string::npos) {
+            return false;
+        }
+        c.status = atoi(h.c_str() + sp + 1);
+        c.body_left = -1;
+        size_t line = h.find("\r\n");
+        while (line != std::string::npos and line + 2 < h.size()) {
+            size_t next = h.find("\r\n", line + 2);
+            const char* name = h.c_str() + line + 2;
+            if (strncasecmp(name, "Content-length:", 15) == 0) {
+                c.body_left = atol(name + 15);
+            }
+            line = next;
+        }
+        return c.status > 0;
+    }
+
+    // 到停止时刻还没完成的请求，延迟至少是g_stop_us - sched_us，按这个下限计入直方图
+    // 过载时它们正是最慢的那部分，丢掉会让校正后的分位数偏乐观；不计入完成数和状态码
+    void _censor(Conn& c) {
+        for (const Pending& p : c.inflight) {
+            if (p.sched_us >= g_record_us) {
+                uint64_t latency = static_cast<uint64_t>(g_stop_us - p.sched_us);
+                uint64_t service = static_cast<uint64_t>(g_stop_us - p.sent_us);
+                p.entry->latency.record(latency);
+                p.entry->service.record(service);
+                g_totals.latency.record(latency);
+                g_totals.service.record(service);
+            }
+        }
+        // 还没发出的请求没有服务时间
+        for (const Pending& p : c.backlog) {
+            if (p.sched_us >= g_record_us) {
+                uint64_t latency = static_cast<uint64_t>(g_stop_us - p.sched_us);
+                p.entry->latency.record(latency);
+                g_totals.latency.record(latency);
+            }
+        }
+    }
+
+    void _complete(Conn& c) {
+        int64_t now = nowUs();
+        Pending p = c.inflight.front();
+        c.inflight.pop_front();
+        c.header.clear();
+        c.header_done = false;
+        if (p.sched_us >= g_record_us) {
+            // 闭环模式计划时刻就是发送时刻，两个直方图相同
+            uint64_t latency = static_cast<uint64_t>(now - p.sched_us);
+            uint64_t service = static_cast<uint64_t>(now - p.sent_us);
+            p.entry->latency.record(latency);
+            p.entry->service.record(service);
+            p.entry->done++;
+            g_totals.latency.record(latency);
+            g_totals.service.record(service);
+            g_totals.done++;
+            g_totals.status[std::min(std::max(c.status / 100, 0), 5)]++;
+        }
+        if (!g_cfg.keep_alive) {
+            _close(c);
+            c.retry_us = now;
+        }
+    }
+
+    std::vector<Conn> _conns;
+    std::mt19937 _rng;
+    int _epfd = -1;
+    uint64_t _unfinished = 0;
+};
+
+// 端口能连上时服务器可能还没进入事件循环，要等到第一个响应才开始计时
+static bool waitForServer(int timeout_ms) {
+    const char req[] = "GET / HTTP/1.1\r\nConnection: close\r\n\r\n";
+    int64_t deadline = nowUs() + timeout_ms * 1000LL;
+    while (nowUs() < deadline) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        timeval tv = { 1, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+        char c;
+        bool ok = connect(fd, reinterpret_cast<sockaddr*>(&g_addr), sizeof g_addr) == 0
+                    and send(fd, req, sizeof req - 1, MSG_NOSIGNAL) == sizeof req - 1
+                    and recv(fd, &c, 1, 0) == 1;
+        close(fd);
+        if (ok) {
+            return true;
+        }
+        usleep(50000);
+    }
+    return false;
+}
+
+// 子进程单独成组，结束时整组发SIGTERM；服务器需在前台运行，daemon化后无法回收
+static pid_t startChild(const std::string& cmd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        // exec让服务器直接替换shell，waitpid回收的就是服务器本身
+        std::string line = "exec " + cmd;
+        execl("/bin/sh", "sh", "-c", line.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stopChild(pid_t pid) {
+    kill(-pid, SIGTERM);
+    int status = 0;
+    for (int i = 0; i < 50; ++i) {
+        if (waitpid(pid, &status, WNOHANG) != 0) {
+            return;
+        }
+        usleep(100000);
+    }
+    kill(-pid, SIGKILL);
+    waitpid(pid, &status, 0);
+}
+
+// 读取管理端口/metrics里的webserver_alloc_*，键为"指标名 阶段"
+static std::map<std::string, double> fetchAllocStats() {
+    std::map<std::string, double> stats;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = g_addr;
+    addr.sin_port = htons(static_cast<uint16_t>(g_cfg.admin_port));
+    timeval tv = { 2, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+    const char req[] = "GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n";
+    std::string resp;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0
+            and send(fd, req, sizeof req - 1, MSG_NOSIGNAL) == sizeof req - 1) {
+        char buf[4096];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof buf, 0)) > 0) {
+            resp.append(buf, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+    size_t pos = 0;
+    while ((pos = resp.find("\nwebserver_alloc_", pos)) != std::string::npos) {
+        size_t end = resp.find('\n', pos + 1);
+        std::string line = resp.substr(pos + 1, end == std::string::npos ? std::string::npos : end - pos - 1);
+        pos = end == std::string::npos ? resp.size() : end;
+        size_t sp = line.rfind(' ');
+        std::string key = line.substr(0, sp);
+        size_t q = key.find("{phase=\"");
+        if (q != std::string::npos) {
+            key = key.substr(0, q) + " " + key.substr(q + 8, key.size() - q - 10);
+        }
+        stats[key] = atof(line.c_str() + sp + 1);
+    }
+    return stats;
+}
+
+// 测量期间服务器每完成一个请求，各阶段平均的分配次数和字节数
+static void reportAllocs(const std::map<std::string, double>& before, const std::map<std::string, double>& after) {
+    auto delta = [&](const std::string& key) {
+        auto a = after.find(key), b = before.find(key);
+        return (a == after.end() ? 0 : a->second) - (b == before.end() ? 0 : b->second);
+    };
+    double requests = delta("webserver_alloc_requests_total");
+    if (requests <= 0) {
+        printf("no allocation stats from admin port %d (server not built with -DTRACK_ALLOCS?)\n", g_cfg.admin_port);
+        return;
+    }
+    printf("%-30s %10s %10s\n", "allocations per request", "count", "bytes");
+    double total = 0, total_bytes = 0;
+    const std::string prefix = "webserver_alloc_total ";
+    for (auto& kv : after) {
+        if (kv.first.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        std::string phase = kv.first.substr(prefix.size());
+        double n = delta(kv.first) / requests;
+        double bytes = delta("webserver_alloc_bytes_total " + phase) / requests;
+        total += n;
+        total_bytes += bytes;
+        printf("  %-28s %10.2f %10.0f\n", phase.c_str(), n, bytes);
+    }
+    printf("  %-28s %10.2f %10.0f\n", "all", total, total_bytes);
+}
+
+#ifdef LOAD_GEN_INPROC
+// 与main.cc相同的配置，关闭日志；Server没有停止接口，随进程退出
+static void startInproc() {
+    Server* server = new Server(
+        g_cfg.port, 3, 60000, false,
+        3306, "weilai", "", "mydb",
+        12, 12, false, 1
+    );
+    std::thread([server] { server->start(); }).detach();
+}
+#endif
+
+static void printRow(const char* name, const Histogram& h) {
+    uint64_t n = h.count();
+    printf("  %-28s %10llu %9llu %9llu %9llu %9llu %9llu %9llu\n", name, (unsigned long long)n,
+            (unsigned long long)h.percentile(0.5), (unsigned long long)h.percentile(0.9),
+            (unsigned long long)h.percentile(0.99), (unsigned long long)h.percentile(0.999),
+            (unsigned long long)h.percentile(1.0), (unsigned long long)(n > 0 ? h.sum() / n : 0));
+}
+
+static void printTable(const char* title, bool service) {
+    printf("%-30s %10s %9s %9s %9s %9s %9s %9s\n", title, "count", "p50", "p90", "p99", "p99.9", "max", "mean");
+    for (auto& e : g_mix) {
+        printRow(e->name.c_str(), service ? e->service : e->latency);
+    }
+    if (g_mix.size() > 1) {
+        printRow("all", service ? g_totals.service : g_totals.latency);
+    }
+}
+
+static void report(double seconds, uint64_t bytes_in, uint64_t unfinished) {
+    bool open_loop = g_cfg.rate > 0;
+    printf("%s, %d connections, %d threads, %s, pipeline depth %d\n",
+            open_loop ? ("open-loop " + std::to_string(static_cast<long>(g_cfg.rate)) + " req/s").c_str()
+                      : "closed-loop",
+            g_cfg.conns, g_cfg.threads, g_cfg.keep_alive ? "keep-alive" : "close", g_cfg.depth);
+    uint64_t done = g_totals.done.load();
+    printf("%.2fs measured (%.2fs warmup): %llu requests, %.1f req/s, %.2f MB/s in\n",
+            seconds, g_cfg.warmup_s, (unsigned long long)done, done / seconds, bytes_in / seconds / 1e6);
+    printf("connects %llu, connect errors %llu, lost %llu, unfinished %llu; status 2xx %llu 3xx %llu 4xx %llu 5xx %llu\n",
+            (unsigned long long)g_totals.connects.load(), (unsigned long long)g_totals.connect_errors.load(),
+            (unsigned long long)g_totals.io_errors.load(), (unsigned long long)unfinished,
+            (unsigned long long)g_totals.status[2].load(), (unsigned long long)g_totals.status[3].load(),
+            (unsigned long long)g_totals.status[4].load(), (unsigned long long)g_totals.status[5].load());
+    if (unfinished > 0) {
+        printf("unfinished requests are included in the latency tables at the stop time (lower bounds)\n");
+    }
+    if (open_loop) {
+        // 开环：延迟从计划发送时刻算起，已包含排队；服务时间从实际发送算起，仅供对照
+        printTable("latency (us, corrected)", false);
+        printTable("service time (us)", true);
+    } else {
+        printTable("latency (us)", false);
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -H host          server address (127.0.0.1)\n"
+        "  -p port          server port (9006)\n"
+        "  -c conns         connections (16)\n"
+        "  -t threads       load threads (min(conns, cores/2))\n"
+        "  -d seconds       measured duration (10)\n"
+        "  -w seconds       warmup, not recorded (1)\n"
+        "  -K               close after each request instead of keep-alive\n"
+        "  -P depth         pipelined requests per connection (1)\n"
+        "  -R rate          open loop at a constant total arrival rate; 0 = closed loop (0)\n"
+        "  -m mix           weighted request mix, TYPE[=PATH][:WEIGHT],...; TYPE is get, range or login\n"
+        "                   (get=/index.html:1)\n"
+        "  --user NAME      login username (loadgen)\n"
+        "  --password PW    login password (loadgen)\n"
+        "  --server CMD     start the server as a child process (in the foreground) and stop it afterwards\n"
+        "  --admin-port N   report per-request allocations from the server's /metrics (-DTRACK_ALLOCS builds)\n"
+#ifdef LOAD_GEN_INPROC
+        "  --inproc         start the server in this process\n"
+#endif
+        , prog);
+}
+
+int main(int argc, char* argv[]) {
+    static const option LONG_OPTIONS[] = {
+        { "user",       required_argument, nullptr, 'u' },
+        { "password",   required_argument, nullptr, 'x' },
+        { "server",     required_argument, nullptr, 's' },
+        { "inproc",     no_argument,       nullptr, 'i' },
+        { "admin-port", required_argument, nullptr, 'a' },
+        { "help",       no_argument,       nullptr, 'h' },
+        { nullptr,      0,                 nullptr, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "H:p:c:t:d:w:KP:R:m:h", LONG_OPTIONS, nullptr)) != -1) {
+        switch (opt) {
+            case 'H': g_cfg.host = optarg; break;
+            case 'p': g_cfg.port = atoi(optarg); break;
+            case 'c': g_cfg.conns = atoi(optarg); break;
+            case 't': g_cfg.threads = atoi(optarg); break;
+            case 'd': g_cfg.duration_s = atof(optarg); break;
+            case 'w': g_cfg.warmup_s = atof(optarg); break;
+            case 'K': g_cfg.keep_alive = false; break;
+            case 'P': g_cfg.depth = atoi(optarg); break;
+            case 'R': g_cfg.rate = atof(optarg); break;
+            case 'm': g_cfg.mix = optarg; break;
+            case 'u': g_cfg.user = optarg; break;
+            case 'x': g_cfg.password = optarg; break;
+            case 's': g_cfg.server_cmd = optarg; break;
+            case 'a': g_cfg.admin_port = atoi(optarg); break;
+#ifdef LOAD_GEN_INPROC
+            case 'i': g_cfg.inproc = true; break;
+#endif
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (g_cfg.conns <= 0 or g_cfg.depth <= 0 or g_cfg.duration_s <= 0 or g_cfg.warmup_s < 0
+            or g_cfg.rate < 0 or !parseMix(g_cfg.mix)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (g_cfg.threads <= 0) {
+        g_cfg.threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency() / 2));
+    }
+    g_cfg.threads = std::min(g_cfg.threads, g_cfg.conns);
+    g_addr.sin_family = AF_INET;
+    g_addr.sin_port = htons(static_cast<uint16_t>(g_cfg.port));
+    if (inet_pton(AF_INET, g_cfg.host.c_str(), &g_addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address: %s\n", g_cfg.host.c_str());
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    buildRequests();
+
+    pid_t child = -1;
+    if (!g_cfg.server_cmd.empty()) {
+        child = startChild(g_cfg.server_cmd);
+    }
+#ifdef LOAD_GEN_INPROC
+    if (g_cfg.inproc) {
+        startInproc();
+    }
+#endif
+    if (!waitForServer(10000)) {
+        fprintf(stderr, "server %s:%d not reachable\n", g_cfg.host.c_str(), g_cfg.port);
+        if (child > 0) {
+            stopChild(child);
+        }
+        return 1;
+    }
+
+    g_start_us = nowUs();
+    g_record_us = g_start_us + static_cast<int64_t>(g_cfg.warmup_s * 1e6);
+    g_stop_us = g_record_us + static_cast<int64_t>(g_cfg.duration_s * 1e6);
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    for (int i = 0, first = 0; i < g_cfg.threads; ++i) {
+        int n = g_cfg.conns / g_cfg.threads + (i < g_cfg.conns % g_cfg.threads);
+        workers.emplace_back(new Worker(n, first, g_cfg.conns));
+        first += n;
+    }
+    for (auto& w : workers) {
+        threads.emplace_back(&Worker::run, w.get());
+    }
+    // 预热期间收到的字节不计入
+    std::this_thread::sleep_for(std::chrono::microseconds(g_record_us - nowUs()));
+    uint64_t warm_bytes = g_totals.bytes_in.load();
+    std::map<std::string, double> allocs_before;
+    if (g_cfg.admin_port > 0) {
+        allocs_before = fetchAllocStats();
+    }
+    uint64_t unfinished = 0;
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+        unfinished += workers[i]->getUnfinished();
+    }
+    double seconds = (nowUs() - g_record_us) / 1e6;
+    report(seconds, g_totals.bytes_in.load() - warm_bytes, unfinished);
+    if (g_cfg.admin_port > 0) {
+        reportAllocs(allocs_before, fetchAllocStats());
+    }
+    if (child > 0) {
+        stopChild(child);
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file log_decode.cc
+ * @author weilai
+ * @brief 离线解码Log::MODE::BINARY写出的.bin日志，输出与文本日志相同的格式
+ *        独立构建：g++ -std=c++14 -I src src/tools/log_decode.cc src/log/log_record.cc src/log/log_clock.cc -o log_decode
+ *        用法：./log_decode 2023_08_21.log.bin [more.bin ...]
+ * @version 0.1
+ * @date 2023-08-21
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "log/log_record.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+struct DecodeFormat {
+    int level;
+    std::string format;
+};
+
+static bool readFile(const char* path, std::vector<char>& data) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof chunk, fp)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(fp);
+    return true;
+}
+
+static int decodeFile(const char* path) {
+    std::vector<char> data;
+    if (!readFile(path, data)) {
+        fprintf(stderr, "open %s failed\n", path);
+        return 1;
+    }
+    // 字典和锚点都写在文件内部，每个文件单独解码
+    std::unordered_map<uint32_t, DecodeFormat> formats;
+    int64_t anchor_steady = 0, anchor_real = 0;
+    std::vector<char> line(logrec::MAX_STRING * 8);
+
+    const char* p = data.data();
+    const char* end = p + data.size();
+    while (p + sizeof(LogRecordHeader) <= end) {
+        LogRecordHeader header;
+        memcpy(&header, p, sizeof header);
+        if (header.size < sizeof header or p + header.size > end) {
+            fprintf(stderr, "%s: truncated record at offset %ld\n", path, (long)(p - data.data()));
+            return 1;
+        }
+        const char* body = p + sizeof header;
+        const char* next = p + header.size;
+        p = next;
+
+        if (header.fmt_id == LOG_RECORD_ANCHOR) {
+            memcpy(&anchor_steady, body, sizeof(int64_t));
+            memcpy(&anchor_real, body + sizeof(int64_t), sizeof(int64_t));
+            continue;
+        }
+        if (header.fmt_id == LOG_RECORD_DICT) {
+            uint32_t id, level;
+            memcpy(&id, body, sizeof id);
+            memcpy(&level, body + sizeof id, sizeof level);
+            const char* fmt = body + 2 * sizeof(uint32_t);
+            formats[id] = DecodeFormat{static_cast<int>(level), std::string(fmt, next - fmt)};
+            continue;
+        }
+        auto it = formats.find(header.fmt_id);
+        if (it == formats.end()) {
+            fprintf(stderr, "%s: unknown format id %u\n", path, header.fmt_id);
+            continue;
+        }
+        int64_t ns = anchor_real + (header.ts - anchor_steady);
+        timeval tv;
+        tv.tv_sec = static_cast<time_t>(ns / 1000000000);
+        tv.tv_usec = static_cast<suseconds_t>(ns % 1000000000 / 1000);
+        size_t len = logrec::formatLine(line.data(), line.size(), it->second.level,
+                        it->second.format.c_str(), body, next, tv);
+        fwrite(line.data(), 1, len, stdout);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <log.bin> [more.bin ...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        ret |= decodeFile(argv[i]);
+    }
+    return ret;
+}
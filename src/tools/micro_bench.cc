@@ -0,0 +1,552 @@
+/**
+ * @file micro_bench.cc
+ * @author weilai
+ * @brief 核心组件微基准：Buffer、请求解析、响应生成、定时器、阻塞队列、线程池和日志。
+ *        自带极简计时框架，每个用例先自动定标迭代次数，再重复多轮取中位数；
+ *        --json输出的字段与Google Benchmark一致（name/iterations/real_time/cpu_time/time_unit/items_per_second），
+ *        可以直接用它的compare.py对比两次提交的结果。
+ *        独立构建：g++ -std=c++14 -O2 -I src -o micro_bench src/tools/micro_bench.cc src/http/http_request.cc
+ *                  src/http/http_response.cc 以及src/{buffer,timer,log,auth,pool,metrics}下的全部.cc
+ *                  -lmysqlclient -lz -lpthread
+ *        用法：./micro_bench [--filter 子串] [--min-time 秒] [--reps N] [--json 文件]
+ * @version 0.1
+ * @date 2023-09-02
+ *
+ * @copyright Copyleft Apache 2.0
+ *
+ */
+
+#include "buffer/arena.h"
+#include "buffer/buffer.h"
+#include "http/http_request.h"
+#include "http/http_response.h"
+#include "log/block_queue.hpp"
+#include "log/log.h"
+#include "pool/thread_pool.hpp"
+#include "timer/timer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// 计时状态：用例执行iterations次操作，准备工作用pause/resume排除在计时之外
+// CPU时间按进程统计，多线程用例包含所有线程
+class BenchState {
+public:
+    explicit BenchState(uint64_t iterations): iterations(iterations), items(iterations),
+        _real_ns(0), _cpu_ns(0), _running(false) {}
+
+    void start() {
+        _running = true;
+        _real_start = _now(CLOCK_MONOTONIC);
+        _cpu_start = _now(CLOCK_PROCESS_CPUTIME_ID);
+    }
+
+    void pause() {
+        if (_running) {
+            _real_ns += _now(CLOCK_MONOTONIC) - _real_start;
+            _cpu_ns += _now(CLOCK_PROCESS_CPUTIME_ID) - _cpu_start;
+            _running = false;
+        }
+    }
+
+    void resume() {
+        start();
+    }
+
+    int64_t getRealNs() const {
+        return _real_ns;
+    }
+
+    int64_t getCpuNs() const {
+        return _cpu_ns;
+    }
+
+    const uint64_t iterations;
+    // 本轮处理的条目数，默认每次迭代一条，批量用例自行设置
+    uint64_t items;
+
+private:
+    static int64_t _now(clockid_t clock) {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    int64_t _real_ns;
+    int64_t _cpu_ns;
+    int64_t _real_start;
+    int64_t _cpu_start;
+    bool _running;
+};
+
+typedef std::function<void(BenchState&)> BenchFn;
+
+struct BenchCase {
+    std::string name;
+    BenchFn fn;
+    // 每次迭代本身很重（如一次填满上百万定时器）时固定迭代次数，不做定标
+    uint64_t fixed_iterations;
+};
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    int reps;
+    // 每次迭代的耗时，取各轮中位数
+    double real_ns;
+    double cpu_ns;
+    double real_min_ns;
+    double real_max_ns;
+    double items_per_second;
+};
+
+struct BenchOptions {
+    std::string filter;
+    double min_time_s = 0.2;
+    int reps = 5;
+    std::string json_path;
+};
+
+static std::vector<BenchCase> g_cases;
+static BenchOptions g_opts;
+static std::string g_tmp_dir;
+
+static void addBench(const std::string& name, const BenchFn& fn, uint64_t fixed_iterations = 0) {
+    g_cases.push_back({ name, fn, fixed_iterations });
+}
+
+static void runOnce(const BenchCase& c, BenchState* st) {
+    st->start();
+    c.fn(*st);
+    st->pause();
+}
+
+static BenchResult runCase(const BenchCase& c) {
+    // 定标：迭代次数每次放大，直到单轮耗时达到min_time的十分之一，再按比例推算
+    uint64_t iterations = c.fixed_iterations;
+    if (iterations == 0) {
+        iterations = 1;
+        while (true) {
+            BenchState st(iterations);
+            runOnce(c, &st);
+            double seconds = st.getRealNs() / 1e9;
+            if (seconds >= g_opts.min_time_s / 10 or iterations >= (1ULL << 34)) {
+                double scale = g_opts.min_time_s / std::max(seconds, 1e-9);
+                iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * scale));
+                break;
+            }
+            iterations *= 10;
+        }
+    }
+    std::vector<double> real, cpu, items;
+    for (int r = 0; r < g_opts.reps; ++r) {
+        BenchState st(iterations);
+        runOnce(c, &st);
+        real.push_back(static_cast<double>(st.getRealNs()) / iterations);
+        cpu.push_back(static_cast<double>(st.getCpuNs()) / iterations);
+        items.push_back(st.items * 1e9 / std::max<int64_t>(st.getRealNs(), 1));
+    }
+    auto median = [](std::vector<double> v) {
+        std::sort(v.begin(), v.end());
+        return v[v.size() / 2];
+    };
+    BenchResult res;
+    res.name = c.name;
+    res.iterations = iterations;
+    res.reps = g_opts.reps;
+    res.real_ns = median(real);
+    res.cpu_ns = median(cpu);
+    res.real_min_ns = *std::min_element(real.begin(), real.end());
+    res.real_max_ns = *std::max_element(real.begin(), real.end());
+    res.items_per_second = median(items);
+    return res;
+}
+
+static std::string jsonEscape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' or c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+static bool writeJson(const std::string& path, const std::vector<BenchResult>& results) {
+    FILE* fp = path == "-" ? stdout : fopen(path.c_str(), "w");
+    if (fp == nullptr) {
+        fprintf(stderr, "open %s failed\n", path.c_str());
+        return false;
+    }
+    char host[256] = "";
+    gethostname(host, sizeof host - 1);
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    fprintf(fp, "{\n  \"context\": {\n");
+    fprintf(fp, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n", date, jsonEscape(host).c_str());
+    fprintf(fp, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+#ifdef NDEBUG
+    fprintf(fp, "    \"library_build_type\": \"release\",\n");
+#else
+    fprintf(fp, "    \"library_build_type\": \"debug\",\n");
+#endif
+    fprintf(fp, "    \"min_time\": %.3f,\n    \"repetitions\": %d\n  },\n", g_opts.min_time_s, g_opts.reps);
+    fprintf(fp, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        fprintf(fp, "    {\n      \"name\": \"%s\",\n      \"run_type\": \"iteration\",\n", jsonEscape(r.name).c_str());
+        fprintf(fp, "      \"repetitions\": %d,\n      \"iterations\": %llu,\n", r.reps, (unsigned long long)r.iterations);
+        fprintf(fp, "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\",\n",
+                r.real_ns, r.cpu_ns);
+        fprintf(fp, "      \"real_time_min\": %.3f,\n      \"real_time_max\": %.3f,\n", r.real_min_ns, r.real_max_ns);
+        fprintf(fp, "      \"items_per_second\": %.1f\n    }%s\n", r.items_per_second, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    if (fp != stdout) {
+        fclose(fp);
+    }
+    return true;
+}
+
+// 禁止编译器把结果优化掉
+template<class T>
+static void doNotOptimize(const T& v) {
+    asm volatile("" : : "r,m"(v) : "memory");
+}
+
+static void removeDir(const std::string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name == "." or name == "..") {
+            continue;
+        }
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0 and S_ISDIR(st.st_mode)) {
+            removeDir(path);
+        } else {
+            unlink(path.c_str());
+        }
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+static void writeFile(const std::string& path, size_t size) {
+    std::string content(size, 'x');
+    FILE* fp = fopen(path.c_str(), "w");
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+}
+
+static void registerBufferBenches() {
+    for (size_t len : { 16, 256, 4096 }) {
+        addBench("buffer/append_retrieve/" + std::to_string(len), [len](BenchState& st) {
+            Buffer buf;
+            std::string data(len, 'a');
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                buf.append(data);
+                buf.retrieve(len);
+            }
+            st.items = st.iterations;
+        });
+    }
+    // 从1KB追加到64KB，反复触发_extendSpace扩容
+    addBench("buffer/grow_64k", [](BenchState& st) {
+        std::string chunk(1024, 'a');
+        for (uint64_t i = 0; i < st.iterations; ++i) {
+            Buffer buf;
+            for (int j = 0; j < 64; ++j) {
+                buf.append(chunk);
+            }
+            doNotOptimize(buf.getReadableBytes());
+        }
+    });
+    // 前部已读空间足够时_extendSpace只搬移数据不扩容
+    addBench("buffer/compact", [](BenchState& st) {
+        Buffer buf(1024);
+        std::string chunk(600, 'a');
+        for (uint64_t i = 0; i < st.iterations; ++i) {
+            buf.append(chunk);
+            buf.retrieve(500);
+            buf.append(chunk);
+            buf.retrieveAll();
+        }
+    });
+    addBench("buffer/retrieve_all_to_string/1024", [](BenchState& st) {
+        Buffer buf;
+        std::string chunk(1024, 'a');
+        for (uint64_t i = 0; i < st.iterations; ++i) {
+            buf.append(chunk);
+            doNotOptimize(buf.retrieveAllTOString());
+        }
+    });
+}
+
+static void registerHttpBenches() {
+    static const std::pair<const char*, std::string> REQUESTS[] = {
+        { "get_minimal", "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n" },
+        { "get_browser",
+            "GET /picture.html HTTP/1.1\r\n"
+            "Host: 127.0.0.1:9006\r\n"
+            "Connection: keep-alive\r\n"
+            "Cache-Control: max-age=0\r\n"
+            "sec-ch-ua: \"Chromium\";v=\"116\", \"Not)A;Brand\";v=\"24\"\r\n"
+            "sec-ch-ua-mobile: ?0\r\n"
+            "sec-ch-ua-platform: \"Linux\"\r\n"
+            "Upgrade-Insecure-Requests: 1\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/116.0.0.0 Safari/537.36\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+            "Sec-Fetch-Site: same-origin\r\n"
+            "Sec-Fetch-Mode: navigate\r\n"
+            "Sec-Fetch-Dest: document\r\n"
+            "Referer: http://127.0.0.1:9006/welcome.html\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n\r\n" },
+        { "post_login",
+            "POST /login.html HTTP/1.1\r\n"
+            "Host: 127.0.0.1:9006\r\n"
+            "Connection: keep-alive\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: 33\r\n"
+            "Origin: http://127.0.0.1:9006\r\n"
+            "Referer: http://127.0.0.1:9006/login.html\r\n\r\n"
+            "username=weilai&password=12%2B34" },
+    };
+    for (auto& r : REQUESTS) {
+        const std::string raw = r.second;
+        addBench(std::string("http/parse/") + r.first, [raw](BenchState& st) {
+            Buffer buf;
+            Arena arena;
+            HttpRequest req;
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                buf.append(raw);
+                arena.reset();
+                req.init(arena);
+                doNotOptimize(req.parse(buf));
+                buf.retrieveAll();
+            }
+        });
+    }
+
+    writeFile(g_tmp_dir + "/small.html", 2 * 1024);
+    writeFile(g_tmp_dir + "/large.html", 4 * 1024 * 1024);
+    for (const char* file : { "small", "large", "missing" }) {
+        std::string path = std::string("/") + file + ".html";
+        addBench(std::string("http/response/") + file, [path](BenchState& st) {
+            Buffer buf;
+            Arena arena;
+            HttpResponse resp;
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                arena.reset();
+                resp.init(arena, g_tmp_dir.c_str(), ArenaStr(path.c_str(), path.size()), true, 200);
+                resp.makeResponse(buf);
+                doNotOptimize(resp.getFile());
+                buf.retrieveAll();
+            }
+        });
+    }
+}
+
+static void registerTimerBenches() {
+    for (int n : { 10000, 100000, 1000000 }) {
+        uint64_t fixed = n >= 1000000 ? 3 : 0;
+        std::string size = n >= 1000000 ? std::to_string(n / 1000000) + "m" : std::to_string(n / 1000) + "k";
+        // 每次迭代从空堆插入n个随机超时的定时器
+        addBench("timer/add/" + size, [n](BenchState& st) {
+            std::mt19937 rng(1);
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                st.pause();
+                Timer* timer = new Timer;
+                st.resume();
+                for (int id = 0; id < n; ++id) {
+                    timer->add(id, 60000 + static_cast<int>(rng() % 60000), [] {});
+                }
+                st.pause();
+                delete timer;
+                st.resume();
+            }
+            st.items = st.iterations * n;
+        }, fixed);
+        // 堆中已有n个定时器，随机挑一个延后，对应keep-alive连接每次读写刷新超时
+        addBench("timer/adjust_expire/" + size, [n](BenchState& st) {
+            st.pause();
+            Timer timer;
+            std::mt19937 rng(1);
+            for (int id = 0; id < n; ++id) {
+                timer.add(id, 60000 + static_cast<int>(rng() % 60000), [] {});
+            }
+            st.resume();
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                timer.adjustExpire(static_cast<int>(rng() % n), 120000 + static_cast<int>(i % 60000));
+            }
+        });
+        // n个定时器全部到期，一次getNextTick逐个弹出并执行回调
+        addBench("timer/tick_expired/" + size, [n](BenchState& st) {
+            uint64_t fired = 0;
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                st.pause();
+                Timer* timer = new Timer;
+                for (int id = 0; id < n; ++id) {
+                    timer->add(id, 0, [&fired] { ++fired; });
+                }
+                st.resume();
+                doNotOptimize(timer->getNextTick());
+                st.pause();
+                delete timer;
+                st.resume();
+            }
+            doNotOptimize(fired);
+            st.items = st.iterations * n;
+        }, fixed);
+    }
+}
+
+static void registerQueueBenches() {
+    for (int producers : { 1, 4, 16 }) {
+        // producers个线程共push iterations个元素，一个线程pop
+        addBench("block_queue/push_pop/" + std::to_string(producers) + "p", [producers](BenchState& st) {
+            BlockQueue<std::string> q(1024);
+            uint64_t n = st.iterations;
+            std::thread consumer([&q, n] {
+                std::string item;
+                for (uint64_t i = 0; i < n; ++i) {
+                    q.pop(item);
+                }
+            });
+            std::vector<std::thread> threads;
+            for (int p = 0; p < producers; ++p) {
+                uint64_t share = n / producers + (static_cast<uint64_t>(p) < n % producers);
+                threads.emplace_back([&q, share] {
+                    const std::string item(64, 'a');
+                    for (uint64_t i = 0; i < share; ++i) {
+                        q.push(item);
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            consumer.join();
+        });
+    }
+
+    for (int workers : { 1, 4, 8 }) {
+        // 主线程提交空任务，衡量入队加唤醒的开销和工作线程的吞吐
+        addBench("thread_pool/add_task/" + std::to_string(workers) + "w", [workers](BenchState& st) {
+            st.pause();
+            std::atomic<uint64_t> done(0);
+            ThreadPool* pool = new ThreadPool(workers);
+            st.resume();
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                pool->addTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+            }
+            while (done.load() < st.iterations) {
+                std::this_thread::yield();
+            }
+            st.pause();
+            delete pool;
+            st.resume();
+        });
+    }
+}
+
+static void registerLogBenches() {
+    static const char* const LEVELS[] = { "debug", "info", "warn", "error" };
+    for (int level = 0; level < 4; ++level) {
+        addBench(std::string("log/write/") + LEVELS[level], [level](BenchState& st) {
+            Log::instance().setLevel(0);
+            for (uint64_t i = 0; i < st.iterations; ++i) {
+                LOG_BASE(level, "bench request fd:[%d] path: %s, bytes: %llu", 42, "/index.html",
+                            (unsigned long long)i)
+            }
+            Log::instance().flush();
+        });
+    }
+    // 低于阈值的调用点只读一个原子量
+    addBench("log/write/filtered", [](BenchState& st) {
+        Log::instance().setLevel(3);
+        for (uint64_t i = 0; i < st.iterations; ++i) {
+            LOG_DEBUG("bench request fd:[%d] path: %s, bytes: %llu", 42, "/index.html", (unsigned long long)i)
+        }
+    });
+}
+
+int main(int argc, char* argv[]) {
+    static const option LONG_OPTIONS[] = {
+        { "filter",   required_argument, nullptr, 'f' },
+        { "min-time", required_argument, nullptr, 't' },
+        { "reps",     required_argument, nullptr, 'r' },
+        { "json",     required_argument, nullptr, 'j' },
+        { nullptr,    0,                 nullptr, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", LONG_OPTIONS, nullptr)) != -1) {
+        switch (opt) {
+            case 'f': g_opts.filter = optarg; break;
+            case 't': g_opts.min_time_s = atof(optarg); break;
+            case 'r': g_opts.reps = std::max(1, atoi(optarg)); break;
+            case 'j': g_opts.json_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [--filter substr] [--min-time seconds] [--reps n] [--json file|-]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    char tmpl[] = "/tmp/micro_bench.XXXXXX";
+    if (mkdtemp(tmpl) == nullptr) {
+        fprintf(stderr, "mkdtemp failed\n");
+        return 1;
+    }
+    g_tmp_dir = tmpl;
+    // 异步日志写到临时目录，结束后整个删除；Log只保存目录名指针，字符串需一直有效
+    static const std::string log_dir = g_tmp_dir + "/log";
+    Log::instance().init(0, log_dir.c_str(), ".log", 16);
+
+    registerBufferBenches();
+    registerHttpBenches();
+    registerTimerBenches();
+    registerQueueBenches();
+    registerLogBenches();
+
+    // JSON写到标准输出时表格改写到标准错误
+    FILE* table = g_opts.json_path == "-" ? stderr : stdout;
+    fprintf(table, "%-40s %12s %12s %12s %14s\n", "benchmark", "real ns/op", "cpu ns/op", "iterations", "items/s");
+    std::vector<BenchResult> results;
+    for (auto& c : g_cases) {
+        if (!g_opts.filter.empty() and c.name.find(g_opts.filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(runCase(c));
+        const BenchResult& r = results.back();
+        fprintf(table, "%-40s %12.1f %12.1f %12llu %14.0f\n", r.name.c_str(), r.real_ns, r.cpu_ns,
+                (unsigned long long)r.iterations, r.items_per_second);
+        fflush(table);
+    }
+    bool ok = g_opts.json_path.empty() or writeJson(g_opts.json_path, results);
+    Log::instance().flush();
+    removeDir(g_tmp_dir);
+    return ok ? 0 : 1;
+}